@@ -0,0 +1,478 @@
+/////////////////////////////////////////////////////////////////////////////
+// File: BatchMorph.cpp
+//
+// Batch morph driver
+// CBatchMorph renders many image pairs without opening any windows. The
+// images and their line sets are listed in a manifest, and a pair policy
+// decides which entries are morphed into each other. Pairs are rendered
+// by a pool of worker threads running the CPU kernel, while a prefetch
+// thread decodes the images needed by the next pairs.
+//
+// Frames are rendered through a content-addressed result cache shared by
+// all pairs and runs, so re-exporting unchanged pairs only re-muxes them.
+//
+// The manifest can be replaced by a dataset pack, whose images are used
+// straight from the mapped file without decoding.
+//
+// Usage: -batch <manifest|pack> [-pairs all|subject|chain] [-both]
+//        [-workers n] [-out dir] [-cache dir] [-fields]
+//
+// Author: Leon Ho
+/////////////////////////////////////////////////////////////////////////////
+
+#include "BatchMorph.h"
+#include "constants.h"
+#include "MorphKernel.h"
+#include "line_io.h"
+#include "manifest_io.h"
+#include <stdio.h>
+#include <string.h>
+#include <highgui.h>
+
+CBatchMorph::CBatchMorph(void)
+{
+	m_outputDir = BATCH_OUTDIR;
+	m_cacheDir = RESULTCACHE_DIR;
+	m_policy = PAIRS_ALL;
+	m_isBothDirections = false;
+	m_isCachingFields = false;
+
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	m_numWorkers = info.dwNumberOfProcessors;
+
+	m_nextPair = 0;
+	m_pairsDone = m_pairsFailed = 0;
+	m_framesRendered = 0;
+	InitializeCriticalSection(&m_lock);
+	InitializeConditionVariable(&m_entryDecoded);
+	InitializeConditionVariable(&m_pairStarted);
+}
+
+CBatchMorph::~CBatchMorph(void)
+{
+	for(auto it=m_entryList.begin(); it!=m_entryList.end(); it++)
+		releaseImage(&*it);
+	DeleteCriticalSection(&m_lock);
+}
+
+bool CBatchMorph::parseArgs( int argc, char* argv[] )
+{
+	if(argc < 3)
+	{
+		printUsage();
+		return false;
+	}
+	m_manifest = argv[2];
+
+	for(int i=3; i<argc; i++)
+	{
+		if(strcmp(argv[i], "-both") == 0)
+			m_isBothDirections = true;
+		else if(strcmp(argv[i], "-fields") == 0)
+			m_isCachingFields = true;
+		else if(strcmp(argv[i], "-pairs") == 0 && i+1 < argc)
+		{
+			i++;
+			if(strcmp(argv[i], "all") == 0)
+				m_policy = PAIRS_ALL;
+			else if(strcmp(argv[i], "subject") == 0)
+				m_policy = PAIRS_SUBJECT;
+			else if(strcmp(argv[i], "chain") == 0)
+				m_policy = PAIRS_CHAIN;
+			else
+			{
+				printUsage();
+				return false;
+			}
+		}
+		else if(strcmp(argv[i], "-workers") == 0 && i+1 < argc)
+			m_numWorkers = max(atoi(argv[++i]), 1);
+		else if(strcmp(argv[i], "-out") == 0 && i+1 < argc)
+			m_outputDir = argv[++i];
+		else if(strcmp(argv[i], "-cache") == 0 && i+1 < argc)
+			m_cacheDir = argv[++i];
+		else
+		{
+			printUsage();
+			return false;
+		}
+	}
+	return true;
+}
+
+void CBatchMorph::printUsage()
+{
+	fprintf(stderr, "Usage: -batch <manifest|pack> [-pairs all|subject|chain] [-both] [-workers n] [-out dir]\n");
+	fprintf(stderr, "       [-cache dir] [-fields]\n");
+	fprintf(stderr, "Each manifest line holds an image and optionally its line file.\n");
+	fprintf(stderr, "A .pack file built with -pack can be given instead of a manifest.\n");
+}
+
+//---------------------------------------------------------------------------
+// Entries come from a manifest, or from the index of a dataset pack.
+//---------------------------------------------------------------------------
+bool CBatchMorph::loadManifest()
+{
+	vector<ManifestEntry> manifestEntries;
+	string ext = m_manifest.substr(m_manifest.find_last_of(".") + 1);
+	if(_stricmp(ext.c_str(), "pack") == 0)
+	{
+		if(!m_pack.open(m_manifest.c_str()))
+			return false;
+		for(int i=0; i<m_pack.getEntryCount(); i++)
+		{
+			ManifestEntry entry;
+			entry.name = m_pack.getName(i);
+			entry.subject = getSubject(entry.name);
+			manifestEntries.push_back(entry);
+		}
+	}
+	else if(!readManifest(m_manifest.c_str(), &manifestEntries))
+	{
+		fprintf(stderr, "Error: Cannot open manifest %s\n", m_manifest.c_str());
+		return false;
+	}
+
+	for(auto it=manifestEntries.begin(); it!=manifestEntries.end(); it++)
+	{
+		Entry entry;
+		entry.imageFile = it->imageFile;
+		entry.lineFile = it->lineFile;
+		entry.name = it->name;
+		entry.subject = it->subject;
+		entry.image = NULL;
+		entry.hash = entry.lineHash = 0;
+		entry.firstUse = -1;
+		entry.remainingUses = 0;
+		entry.isDecoded = false;
+		m_entryList.push_back(entry);
+	}
+	return true;
+}
+
+void CBatchMorph::selectPairs()
+{
+	int numEntries = m_entryList.size();
+	for(int i=0; i<numEntries; i++)
+	{
+		for(int j=i+1; j<numEntries; j++)
+		{
+			if(m_policy == PAIRS_SUBJECT && m_entryList[i].subject != m_entryList[j].subject)
+				continue;
+			if(m_policy == PAIRS_CHAIN && j != i+1)
+				break;
+			Pair pair; pair.a = i; pair.b = j;
+			m_pairList.push_back(pair);
+		}
+	}
+
+	// Decode entries in the order the pairs first need them
+	for(int i=0; i<(int)m_pairList.size(); i++)
+	{
+		int ends[2] = {m_pairList[i].a, m_pairList[i].b};
+		for(int j=0; j<2; j++)
+		{
+			Entry& entry = m_entryList[ends[j]];
+			if(entry.firstUse == -1)
+			{
+				entry.firstUse = i;
+				m_decodeOrder.push_back(ends[j]);
+			}
+			entry.remainingUses++;
+		}
+	}
+}
+
+bool CBatchMorph::run()
+{
+	if(!loadManifest())
+		return false;
+	selectPairs();
+	if(m_pairList.empty())
+	{
+		fprintf(stderr, "Error: No pairs to render\n");
+		return false;
+	}
+
+	CreateDirectoryA(m_outputDir.c_str(), NULL);
+	m_resultCache.open(m_cacheDir.c_str(), (__int64)RESULTCACHE_RAM_MB << 20,
+		(__int64)RESULTCACHE_DISK_MB << 20, m_isCachingFields);
+	printf("Batch rendering %d pairs from %d images with %d workers\n",
+		(int)m_pairList.size(), (int)m_entryList.size(), m_numWorkers);
+	DWORD startTime = GetTickCount();
+
+	HANDLE prefetcher = CreateThread(NULL, 0, prefetchThread, this, 0, NULL);
+	vector<HANDLE> workers;
+	for(int i=0; i<m_numWorkers; i++)
+		workers.push_back(CreateThread(NULL, 0, workerThread, this, 0, NULL));
+	for(auto it=workers.begin(); it!=workers.end(); it++)
+	{
+		WaitForSingleObject(*it, INFINITE);
+		CloseHandle(*it);
+	}
+	WaitForSingleObject(prefetcher, INFINITE);
+	CloseHandle(prefetcher);
+
+	// Throughput report
+	float elapsed = (GetTickCount() - startTime) / 1000.0f;
+	printf("\nBatch complete\n");
+	printf("Pairs: %d rendered, %d failed\n", m_pairsDone, m_pairsFailed);
+	printf("Frames rendered: %d\n", m_framesRendered);
+	printf("Result cache: %d hits, %d misses\n", m_resultCache.getHits(), m_resultCache.getMisses());
+	printf("Time taken: %.3f\n", elapsed);
+	if(elapsed > 0)
+		printf("Throughput: %.1f pairs/hour, %.2f frames/s\n",
+			m_pairsDone * 3600.0f / elapsed, m_framesRendered / elapsed);
+	return m_pairsFailed == 0;
+}
+
+bool CBatchMorph::loadEntry( Entry* entry )
+{
+	if(m_pack.isOpen())
+		return loadPackedEntry(entry);
+
+	entry->image = cvLoadImage(entry->imageFile.c_str(), CV_LOAD_IMAGE_COLOR);
+	if(entry->image == NULL)
+	{
+		fprintf(stderr, "Error: Cannot load image %s\n", entry->imageFile.c_str());
+		return false;
+	}
+	if(!loadLineFile(entry->lineFile.c_str(), &entry->lines))
+	{
+		fprintf(stderr, "Error: Cannot load lines %s\n", entry->lineFile.c_str());
+		cvReleaseImage(&entry->image);
+		return false;
+	}
+
+	entry->lineHash = HASH_SEED;
+	if(!entry->lines.empty())
+		entry->lineHash = hashBytes(&entry->lines[0], entry->lines.size() * sizeof(float));
+	entry->hash = hashBytes(entry->image->imageData, entry->image->imageSize);
+	entry->hash = hashBytes(&entry->lineHash, sizeof(entry->lineHash), entry->hash);
+	return true;
+}
+
+//---------------------------------------------------------------------------
+// Packed images are used in place and their hashes are read from the
+// index, so loading an entry does not touch its pixels.
+//---------------------------------------------------------------------------
+bool CBatchMorph::loadPackedEntry( Entry* entry )
+{
+	int index = entry - &m_entryList[0];
+	entry->image = m_pack.getImage(index);
+	if(entry->image == NULL || !m_pack.getLines(index, &entry->lines))
+	{
+		fprintf(stderr, "Error: Cannot read %s from pack\n", entry->name.c_str());
+		releaseImage(entry);
+		return false;
+	}
+
+	// The kernel samples the packed levels instead of building them
+	for(int i=1; i<m_pack.getLevelCount(index); i++)
+	{
+		IplImage* level = m_pack.getImage(index, i);
+		if(level == NULL)
+			break;
+		entry->levels.push_back(level);
+	}
+
+	entry->lineHash = m_pack.getLineHash(index);
+	entry->hash = hashBytes(&entry->lineHash, sizeof(entry->lineHash), m_pack.getImageHash(index));
+	return true;
+}
+
+void CBatchMorph::releaseImage( Entry* entry )
+{
+	for(auto it=entry->levels.begin(); it!=entry->levels.end(); it++)
+		cvReleaseImageHeader(&*it);
+	entry->levels.clear();
+	if(entry->image == NULL)
+		return;
+	if(m_pack.isOpen())
+		cvReleaseImageHeader(&entry->image);
+	else
+		cvReleaseImage(&entry->image);
+}
+
+//---------------------------------------------------------------------------
+// Decoded images are freed after the last pair using them. Called with
+// m_lock held.
+//---------------------------------------------------------------------------
+void CBatchMorph::releaseEntry( int index )
+{
+	Entry& entry = m_entryList[index];
+	if(--entry.remainingUses > 0)
+		return;
+	releaseImage(&entry);
+}
+
+//---------------------------------------------------------------------------
+// Decode entries ahead of the workers, staying at most BATCH_PREFETCH pairs
+// ahead so memory use stays bounded.
+//---------------------------------------------------------------------------
+void CBatchMorph::prefetch()
+{
+	for(auto it=m_decodeOrder.begin(); it!=m_decodeOrder.end(); it++)
+	{
+		Entry& entry = m_entryList[*it];
+
+		EnterCriticalSection(&m_lock);
+		while(entry.firstUse >= m_nextPair + BATCH_PREFETCH)
+			SleepConditionVariableCS(&m_pairStarted, &m_lock, INFINITE);
+		LeaveCriticalSection(&m_lock);
+
+		loadEntry(&entry);
+
+		EnterCriticalSection(&m_lock);
+		entry.isDecoded = true;
+		WakeAllConditionVariable(&m_entryDecoded);
+		LeaveCriticalSection(&m_lock);
+	}
+}
+
+void CBatchMorph::work()
+{
+	while(true)
+	{
+		// Take the next pair and wait for its images
+		EnterCriticalSection(&m_lock);
+		if(m_nextPair >= (int)m_pairList.size())
+		{
+			LeaveCriticalSection(&m_lock);
+			return;
+		}
+		Pair pair = m_pairList[m_nextPair++];
+		WakeAllConditionVariable(&m_pairStarted);
+		while(!m_entryList[pair.a].isDecoded || !m_entryList[pair.b].isDecoded)
+			SleepConditionVariableCS(&m_entryDecoded, &m_lock, INFINITE);
+		LeaveCriticalSection(&m_lock);
+
+		int framesRendered = 0;
+		bool isRendered = renderPair(pair, &framesRendered);
+
+		EnterCriticalSection(&m_lock);
+		if(isRendered)
+			m_pairsDone++;
+		else
+			m_pairsFailed++;
+		m_framesRendered += framesRendered;
+		releaseEntry(pair.a);
+		releaseEntry(pair.b);
+		LeaveCriticalSection(&m_lock);
+	}
+}
+
+DWORD WINAPI CBatchMorph::prefetchThread( LPVOID param )
+{
+	((CBatchMorph*)param)->prefetch();
+	return 0;
+}
+
+DWORD WINAPI CBatchMorph::workerThread( LPVOID param )
+{
+	((CBatchMorph*)param)->work();
+	return 0;
+}
+
+//---------------------------------------------------------------------------
+// Render one pair and mux it. The result cache is the only place frames
+// are kept, so an interrupted batch resumes from the frames it cached, and
+// the reverse direction is muxed from the same cached frames read
+// backwards.
+//---------------------------------------------------------------------------
+bool CBatchMorph::renderPair( const Pair& pair, int* framesRendered )
+{
+	Entry& a = m_entryList[pair.a];
+	Entry& b = m_entryList[pair.b];
+	if(a.image == NULL || b.image == NULL)
+		return false;
+	if(a.image->width != b.image->width || a.image->height != b.image->height)
+	{
+		fprintf(stderr, "Error: %s and %s are not the same size\n", a.name.c_str(), b.name.c_str());
+		return false;
+	}
+	if(a.lines.size() != b.lines.size())
+	{
+		fprintf(stderr, "Error: %s and %s have different line counts\n", a.name.c_str(), b.name.c_str());
+		return false;
+	}
+
+	int width = a.image->width;
+	int height = a.image->height;
+	int numLines = a.lines.size() / 4;
+	CMorphKernel kernel;
+	kernel.setImages(a.image, b.image, &a.levels, &b.levels);
+	if(numLines > 0)
+		kernel.setLines(&a.lines[0], &b.lines[0], numLines);
+
+	string name = a.name + "_" + b.name;
+	string outputPath = m_outputDir + "\\";
+	PairRender render;
+	render.kernel = &kernel;
+	render.frame.resize(width * height * 3);
+	render.framesRendered = 0;
+	render.warpHash = hashBytes(&b.lineHash, sizeof(b.lineHash), a.lineHash);
+	render.warpHash = hashFloat(WARP_A, render.warpHash);
+	render.warpHash = hashFloat(WARP_B, render.warpHash);
+	render.warpHash = hashFloat(WARP_P, render.warpHash);
+	render.inputHash = hashBytes(&b.hash, sizeof(b.hash), a.hash);
+	render.inputHash = hashBytes(&render.warpHash, sizeof(render.warpHash), render.inputHash);
+
+	bool isWritten = writeVideo(&render, outputPath + name + ".avi", width, height, false);
+	if(isWritten && m_isBothDirections)
+		isWritten = writeVideo(&render, outputPath + b.name + "_" + a.name + ".avi", width, height, true);
+
+	*framesRendered = render.framesRendered;
+	if(isWritten)
+		printf("%s: %d frames rendered\n", name.c_str(), *framesRendered);
+	else
+		fprintf(stderr, "Error: %s failed after %d frames rendered\n", name.c_str(), *framesRendered);
+	return isWritten;
+}
+
+//---------------------------------------------------------------------------
+// Frames come from the result cache if this or another pair or run
+// rendered the same inputs, and are rendered into it otherwise. The frame
+// is left in render->frame.
+//---------------------------------------------------------------------------
+void CBatchMorph::renderFrame( PairRender* render, int index )
+{
+	float t = (float)index / (FRAMERATE*DURATION);
+	if(!m_resultCache.render(render->kernel, render->inputHash, render->warpHash, t, &render->frame[0]))
+		render->framesRendered++;
+}
+
+//---------------------------------------------------------------------------
+// A video that cannot be written completely is deleted, so a failed pair
+// leaves no partial output behind.
+//---------------------------------------------------------------------------
+bool CBatchMorph::writeVideo( PairRender* render, const string& filename, int width, int height, bool isReversed )
+{
+	CvSize size = cvSize(width, height);
+	CvVideoWriter *vidw = cvCreateVideoWriter(filename.c_str(), CODEC, FRAMERATE, size);
+	if(vidw == NULL)
+	{
+		fprintf(stderr, "Error: Cannot create video %s\n", filename.c_str());
+		return false;
+	}
+
+	IplImage *frameImage = cvCreateImageHeader(size, IPL_DEPTH_8U, 3);
+	cvSetData(frameImage, &render->frame[0], width * 3);
+	int frameCount = FRAMERATE*DURATION+1;
+	bool isWritten = true;
+	for(int i=0; i<frameCount && isWritten; i++)
+	{
+		renderFrame(render, isReversed ? frameCount - 1 - i : i);
+		if(!cvWriteFrame(vidw, frameImage))
+		{
+			fprintf(stderr, "Error: Cannot write frame %d of %s\n", i, filename.c_str());
+			isWritten = false;
+		}
+	}
+	cvReleaseImageHeader(&frameImage);
+	cvReleaseVideoWriter(&vidw);
+	if(!isWritten)
+		DeleteFileA(filename.c_str());
+	return isWritten;
+}
@@ -0,0 +1,122 @@
+/////////////////////////////////////////////////////////////////////////////
+// File: BatchMorph.h
+//
+// Batch morph driver
+// CBatchMorph renders many image pairs without opening any windows. The
+// images and their line sets are listed in a manifest, and a pair policy
+// decides which entries are morphed into each other. Pairs are rendered
+// by a pool of worker threads running the CPU kernel, while a prefetch
+// thread decodes the images needed by the next pairs.
+//
+// Frames are rendered through a content-addressed result cache shared by
+// all pairs and runs, so re-exporting unchanged pairs only re-muxes them.
+//
+// The manifest can be replaced by a dataset pack, whose images are used
+// straight from the mapped file without decoding.
+//
+// Usage: -batch <manifest|pack> [-pairs all|subject|chain] [-both]
+//        [-workers n] [-out dir] [-cache dir] [-fields]
+//
+// Author: Leon Ho
+/////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <windows.h>
+#include <string>
+#include <vector>
+#include <cv.h>
+#include "DatasetPack.h"
+#include "hash_util.h"
+#include "ResultCache.h"
+
+using namespace std;
+
+class CMorphKernel;
+
+class CBatchMorph
+{
+private:
+	enum PairPolicy
+	{
+		PAIRS_ALL,			// Every unordered pair
+		PAIRS_SUBJECT,		// Pairs with the same subject prefix
+		PAIRS_CHAIN			// Consecutive manifest entries
+	};
+
+	struct Entry
+	{
+		string imageFile, lineFile;
+		string name, subject;
+		IplImage* image;
+		vector<IplImage*> levels;	// Coarser levels from the pack, finest first
+		vector<float> lines;
+		hash64 hash;
+		hash64 lineHash;
+		int firstUse;			// First pair using this entry
+		int remainingUses;
+		bool isDecoded;
+	};
+
+	struct Pair
+	{
+		int a, b;
+	};
+
+	// State of one pair being rendered
+	struct PairRender
+	{
+		CMorphKernel* kernel;
+		hash64 inputHash;		// Images, lines and warp parameters
+		hash64 warpHash;		// Lines and warp parameters only
+		vector<char> frame;		// Frame being muxed
+		int framesRendered;
+	};
+
+private:
+	string m_manifest, m_outputDir, m_cacheDir;
+	PairPolicy m_policy;
+	bool m_isBothDirections;
+	bool m_isCachingFields;
+	int m_numWorkers;
+
+	vector<Entry> m_entryList;
+	vector<Pair> m_pairList;
+	vector<int> m_decodeOrder;
+	CResultCache m_resultCache;
+	CDatasetPack m_pack;
+
+	// Scheduling state shared by the worker and prefetch threads
+	CRITICAL_SECTION m_lock;
+	CONDITION_VARIABLE m_entryDecoded;
+	CONDITION_VARIABLE m_pairStarted;
+	int m_nextPair;
+	int m_pairsDone, m_pairsFailed;
+	int m_framesRendered;
+
+public:
+	bool parseArgs(int argc, char* argv[]);
+	bool run();
+
+	CBatchMorph(void);
+	~CBatchMorph(void);
+
+private:
+	bool loadManifest();
+	void selectPairs();
+	bool loadEntry(Entry* entry);
+	bool loadPackedEntry(Entry* entry);
+	void releaseImage(Entry* entry);
+	void releaseEntry(int index);
+
+	bool renderPair(const Pair& pair, int* framesRendered);
+	void renderFrame(PairRender* render, int index);
+	bool writeVideo(PairRender* render, const string& filename, int width, int height, bool isReversed);
+
+	void prefetch();
+	void work();
+	static DWORD WINAPI prefetchThread(LPVOID param);
+	static DWORD WINAPI workerThread(LPVOID param);
+
+	void printUsage();
+};
@@ -0,0 +1,296 @@
+/////////////////////////////////////////////////////////////////////////////
+// File: DatasetPack.cpp
+//
+// Dataset pack file
+// CDatasetPack holds the decoded images and line sets of a whole dataset
+// in one file behind an index. Each image is stored as BGR pixels with the
+// same row alignment as an IplImage, starting on a page boundary, together
+// with optional downscaled levels, and the hashes batch mode keys its
+// caches by. Levels are halved with cvPyrDown like the CPU kernel's
+// pyramid, so batch mode renders from them instead of building its own.
+//
+// The pack is mapped read-only in one view. Images are returned as
+// IplImage headers pointing into the mapping, so nothing is decoded or
+// copied, and only the pages of the images a job touches are read in.
+//
+// Author: Leon Ho
+/////////////////////////////////////////////////////////////////////////////
+
+#include "DatasetPack.h"
+#include "line_io.h"
+#include "manifest_io.h"
+#include <stdio.h>
+#include <string.h>
+#include <highgui.h>
+
+const char PACK_MAGIC[] = "MDP";
+const int PACK_VERSION = 2;
+const int PACK_ALIGNMENT = 4096;
+const int PACK_MIN_LEVEL_SIZE = 16;
+
+CDatasetPack::CDatasetPack(void)
+{
+	m_file = INVALID_HANDLE_VALUE;
+	m_mapping = NULL;
+	m_view = NULL;
+	m_fileSize = 0;
+	m_header = NULL;
+	m_index = NULL;
+}
+
+CDatasetPack::~CDatasetPack(void)
+{
+	close();
+}
+
+bool CDatasetPack::open( const char* filename )
+{
+	close();
+
+	m_file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL,
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	LARGE_INTEGER fileSize;
+	if(m_file != INVALID_HANDLE_VALUE && GetFileSizeEx(m_file, &fileSize) &&
+		fileSize.QuadPart >= (__int64)sizeof(Header))
+	{
+		m_fileSize = fileSize.QuadPart;
+		m_mapping = CreateFileMappingA(m_file, NULL, PAGE_READONLY, 0, 0, NULL);
+	}
+	if(m_mapping != NULL)
+		m_view = (const char*)MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0);
+	if(m_view == NULL)
+	{
+		fprintf(stderr, "Error: Cannot open pack %s\n", filename);
+		close();
+		return false;
+	}
+
+	m_header = (const Header*)m_view;
+	if(memcmp(m_header->magic, PACK_MAGIC, sizeof(m_header->magic)) != 0 ||
+		m_header->version != PACK_VERSION || m_header->entryCount < 0 ||
+		m_header->indexOffset < (__int64)sizeof(Header) ||
+		m_header->indexOffset + (__int64)m_header->entryCount * sizeof(IndexEntry) > m_fileSize)
+	{
+		fprintf(stderr, "Error: %s is not a valid pack\n", filename);
+		close();
+		return false;
+	}
+	m_index = (const IndexEntry*)(m_view + m_header->indexOffset);
+
+	// Images and lines are used straight from the mapping, so every entry
+	// is checked once here rather than on each access
+	for(int i=0; i<m_header->entryCount; i++)
+	{
+		if(!isValidEntry(m_index[i]))
+		{
+			fprintf(stderr, "Error: %s has an invalid or truncated entry %d\n", filename, i);
+			close();
+			return false;
+		}
+	}
+	return true;
+}
+
+//---------------------------------------------------------------------------
+// True if the entry's levels and lines lie inside the file, past the
+// header, and its name is terminated.
+//---------------------------------------------------------------------------
+bool CDatasetPack::isValidEntry( const IndexEntry& entry )
+{
+	if(memchr(entry.name, 0, sizeof(entry.name)) == NULL)
+		return false;
+	if(entry.levelCount < 1 || entry.levelCount > PACK_MAX_LEVELS)
+		return false;
+	for(int i=0; i<entry.levelCount; i++)
+	{
+		const Level& level = entry.level[i];
+		if(level.width <= 0 || level.height <= 0 || level.widthStep < (__int64)level.width * 3 ||
+			level.offset < (__int64)sizeof(Header) ||
+			level.offset + (__int64)level.widthStep * level.height > m_fileSize)
+			return false;
+	}
+	return entry.numLines >= 0 && entry.lineOffset >= (__int64)sizeof(Header) &&
+		entry.lineOffset + (__int64)entry.numLines * 4 * sizeof(float) <= m_fileSize;
+}
+
+void CDatasetPack::close()
+{
+	if(m_view != NULL)
+		UnmapViewOfFile(m_view);
+	if(m_mapping != NULL)
+		CloseHandle(m_mapping);
+	if(m_file != INVALID_HANDLE_VALUE)
+		CloseHandle(m_file);
+
+	m_file = INVALID_HANDLE_VALUE;
+	m_mapping = NULL;
+	m_view = NULL;
+	m_fileSize = 0;
+	m_header = NULL;
+	m_index = NULL;
+}
+
+bool CDatasetPack::isOpen()
+{
+	return m_header != NULL;
+}
+
+int CDatasetPack::getEntryCount()
+{
+	return m_header ? m_header->entryCount : 0;
+}
+
+const char* CDatasetPack::getName( int entry )
+{
+	return m_index[entry].name;
+}
+
+int CDatasetPack::getLevelCount( int entry )
+{
+	return m_index[entry].levelCount;
+}
+
+hash64 CDatasetPack::getImageHash( int entry )
+{
+	return m_index[entry].imageHash;
+}
+
+hash64 CDatasetPack::getLineHash( int entry )
+{
+	return m_index[entry].lineHash;
+}
+
+IplImage* CDatasetPack::getImage( int entry, int level )
+{
+	const IndexEntry& index = m_index[entry];
+	if(level < 0 || level >= index.levelCount)
+		return NULL;
+
+	const Level& data = index.level[level];
+	IplImage* image = cvCreateImageHeader(cvSize(data.width, data.height), IPL_DEPTH_8U, 3);
+	cvSetData(image, (void*)(m_view + data.offset), data.widthStep);
+	return image;
+}
+
+bool CDatasetPack::getLines( int entry, vector<float>* lines )
+{
+	const IndexEntry& index = m_index[entry];
+	const float* data = (const float*)(m_view + index.lineOffset);
+	lines->assign(data, data + index.numLines * 4);
+	return true;
+}
+
+//---------------------------------------------------------------------------
+// Pad the file with zeros up to the next multiple of PACK_ALIGNMENT
+//---------------------------------------------------------------------------
+static void alignFile(FILE* file, __int64* offset)
+{
+	static const char zeros[PACK_ALIGNMENT] = {0};
+	int padding = (int)((PACK_ALIGNMENT - *offset % PACK_ALIGNMENT) % PACK_ALIGNMENT);
+	fwrite(zeros, 1, padding, file);
+	*offset += padding;
+}
+
+//---------------------------------------------------------------------------
+// Entries are stored in manifest order. The hashes match the ones batch
+// mode computes for decoded files, so packed and unpacked runs share the
+// result cache.
+//---------------------------------------------------------------------------
+bool CDatasetPack::build( const char* manifest, const char* filename, int levelCount )
+{
+	vector<ManifestEntry> entries;
+	if(!readManifest(manifest, &entries))
+	{
+		fprintf(stderr, "Error: Cannot open manifest %s\n", manifest);
+		return false;
+	}
+	levelCount = min(max(levelCount, 1), PACK_MAX_LEVELS);
+
+	FILE* file = fopen(filename, "wb");
+	if(file == NULL)
+	{
+		fprintf(stderr, "Error: Cannot write pack %s\n", filename);
+		return false;
+	}
+
+	Header header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, PACK_MAGIC, sizeof(header.magic));
+	header.version = PACK_VERSION;
+	fwrite(&header, sizeof(header), 1, file);
+	__int64 offset = sizeof(header);
+
+	vector<IndexEntry> index;
+	for(auto it=entries.begin(); it!=entries.end(); it++)
+	{
+		IplImage* image = cvLoadImage(it->imageFile.c_str(), CV_LOAD_IMAGE_COLOR);
+		vector<float> lines;
+		if(image == NULL || !loadLineFile(it->lineFile.c_str(), &lines))
+		{
+			fprintf(stderr, "Error: Cannot load %s or its lines\n", it->imageFile.c_str());
+			if(image != NULL)
+				cvReleaseImage(&image);
+			fclose(file);
+			return false;
+		}
+
+		IndexEntry entry;
+		memset(&entry, 0, sizeof(entry));
+		strncpy(entry.name, it->name.c_str(), sizeof(entry.name) - 1);
+		entry.imageHash = hashBytes(image->imageData, image->imageSize);
+		entry.lineHash = lines.empty() ? HASH_SEED : hashBytes(&lines[0], lines.size() * sizeof(float));
+		entry.numLines = lines.size() / 4;
+
+		// Store each level on a page boundary, halving the size each time
+		// the way CMorphKernel builds its pyramid
+		IplImage* level = image;
+		while(true)
+		{
+			alignFile(file, &offset);
+			Level& data = entry.level[entry.levelCount++];
+			data.offset = offset;
+			data.width = level->width;
+			data.height = level->height;
+			data.widthStep = level->widthStep;
+			fwrite(level->imageData, 1, level->imageSize, file);
+			offset += level->imageSize;
+
+			int width = (level->width + 1) / 2;
+			int height = (level->height + 1) / 2;
+			if(entry.levelCount >= levelCount || width < PACK_MIN_LEVEL_SIZE || height < PACK_MIN_LEVEL_SIZE)
+				break;
+			IplImage* next = cvCreateImage(cvSize(width, height), IPL_DEPTH_8U, 3);
+			cvPyrDown(level, next);
+			if(level != image)
+				cvReleaseImage(&level);
+			level = next;
+		}
+		if(level != image)
+			cvReleaseImage(&level);
+		cvReleaseImage(&image);
+
+		entry.lineOffset = offset;
+		if(!lines.empty())
+			fwrite(&lines[0], sizeof(float), lines.size(), file);
+		offset += lines.size() * sizeof(float);
+
+		header.levelCount = max(header.levelCount, entry.levelCount);
+		index.push_back(entry);
+		printf("Packed %s: %dx%d, %d levels, %d lines\n", entry.name,
+			entry.level[0].width, entry.level[0].height, entry.levelCount, entry.numLines);
+	}
+
+	alignFile(file, &offset);
+	header.entryCount = index.size();
+	header.indexOffset = offset;
+	if(!index.empty())
+		fwrite(&index[0], sizeof(IndexEntry), index.size(), file);
+	_fseeki64(file, 0, SEEK_SET);
+	fwrite(&header, sizeof(header), 1, file);
+
+	bool isWritten = !ferror(file);
+	isWritten = fclose(file) == 0 && isWritten;
+	if(!isWritten)
+		fprintf(stderr, "Error: Cannot write pack %s\n", filename);
+	return isWritten;
+}
@@ -0,0 +1,89 @@
+/////////////////////////////////////////////////////////////////////////////
+// File: DatasetPack.h
+//
+// Dataset pack file
+// CDatasetPack holds the decoded images and line sets of a whole dataset
+// in one file behind an index. Each image is stored as BGR pixels with the
+// same row alignment as an IplImage, starting on a page boundary, together
+// with optional downscaled levels, and the hashes batch mode keys its
+// caches by. Levels are halved with cvPyrDown like the CPU kernel's
+// pyramid, so batch mode renders from them instead of building its own.
+//
+// The pack is mapped read-only in one view. Images are returned as
+// IplImage headers pointing into the mapping, so nothing is decoded or
+// copied, and only the pages of the images a job touches are read in.
+//
+// Author: Leon Ho
+/////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <windows.h>
+#include <vector>
+#include <cv.h>
+#include "hash_util.h"
+
+using namespace std;
+
+const int PACK_MAX_LEVELS = 8;
+
+class CDatasetPack
+{
+private:
+	struct Header
+	{
+		char magic[4];
+		int version;
+		int entryCount;
+		int levelCount;			// Most levels stored for any entry
+		__int64 indexOffset;
+	};
+
+	struct Level
+	{
+		__int64 offset;
+		int width, height;
+		int widthStep;
+	};
+
+	struct IndexEntry
+	{
+		char name[64];
+		hash64 imageHash, lineHash;
+		int numLines;
+		int levelCount;
+		__int64 lineOffset;
+		Level level[PACK_MAX_LEVELS];
+	};
+
+private:
+	HANDLE m_file, m_mapping;
+	const char* m_view;
+	__int64 m_fileSize;
+	const Header* m_header;
+	const IndexEntry* m_index;
+
+public:
+	bool open(const char* filename);
+	void close();
+	bool isOpen();
+
+	int getEntryCount();
+	const char* getName(int entry);
+	int getLevelCount(int entry);
+	hash64 getImageHash(int entry);
+	hash64 getLineHash(int entry);
+
+	// Release returned images with cvReleaseImageHeader
+	IplImage* getImage(int entry, int level = 0);
+	bool getLines(int entry, vector<float>* lines);
+
+	// Build a pack from the entries of a manifest
+	static bool build(const char* manifest, const char* filename, int levelCount);
+
+	CDatasetPack(void);
+	~CDatasetPack(void);
+
+private:
+	bool isValidEntry(const IndexEntry& entry);
+};
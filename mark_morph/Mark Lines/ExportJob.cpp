@@ -0,0 +1,260 @@
+/////////////////////////////////////////////////////////////////////////////
+// File: ExportJob.cpp
+//
+// Background video export
+// CExportJob writes the morph to a video file on a worker thread, so the
+// edit and output windows stay responsive while it runs. Frames are
+// rendered with the CPU kernel from a snapshot of the line sets taken when
+// the export starts; later edits do not affect it.
+//
+// If the renderer's background fill has stored every frame under the
+// snapshot's input hash, the export only muxes them. Otherwise the whole
+// video comes from the CPU kernel, whose frames are stored under their own
+// key. If a stored frame is evicted while it is muxed, the video starts
+// over from the CPU kernel, so one video never mixes the two. An
+// interrupted export resumes from the CPU frames, and neither renderer's
+// frames are ever stored under the other's key.
+//
+// Author: Leon Ho
+/////////////////////////////////////////////////////////////////////////////
+
+#include "ExportJob.h"
+#include "constants.h"
+#include "FrameStore.h"
+#include <stdio.h>
+#include <highgui.h>
+
+const int CPU_RENDERER = 1;		// Mixed into the input hash of frames the CPU kernel renders
+
+CExportJob::CExportJob(void)
+{
+	m_frameStore = NULL;
+	m_isReversed = false;
+	m_width = m_height = 0;
+	m_frameCount = 0;
+	m_thread = NULL;
+	m_startTime = m_endTime = 0;
+	m_framesDone = m_framesRendered = 0;
+	m_isCancelled = 0;
+	m_isWritten = false;
+	InitializeCriticalSection(&m_lock);
+}
+
+CExportJob::~CExportJob(void)
+{
+	cancel();
+	wait();
+	DeleteCriticalSection(&m_lock);
+}
+
+//---------------------------------------------------------------------------
+// Start exporting on a worker thread. The snapshot is only referenced
+// here; the kernel is set up on the worker, so starting costs the caller
+// nothing. Returns false if an export is already running.
+//---------------------------------------------------------------------------
+bool CExportJob::start( const char* filename, const Snapshot& snapshot, CFrameStore* frameStore, bool isReversed )
+{
+	if(isRunning())
+		return false;
+	wait();
+
+	m_filename = filename;
+	m_snapshot = snapshot;
+	m_frameStore = frameStore;
+	m_isReversed = isReversed;
+	m_width = snapshot.imageA->width;
+	m_height = snapshot.imageA->height;
+	m_frameCount = FRAMERATE*DURATION+1;
+	m_framesDone = m_framesRendered = 0;
+	m_isCancelled = 0;
+	m_isWritten = false;
+	m_startTime = m_endTime = GetTickCount();
+
+	m_thread = CreateThread(NULL, 0, exportThread, this, 0, NULL);
+	if(m_thread == NULL)
+	{
+		fprintf(stderr, "Error: Cannot start export thread\n");
+		return false;
+	}
+	return true;
+}
+
+//---------------------------------------------------------------------------
+// Ask the worker to stop after the frame it is on. The partial video is
+// deleted.
+//---------------------------------------------------------------------------
+void CExportJob::cancel()
+{
+	InterlockedExchange(&m_isCancelled, 1);
+}
+
+//---------------------------------------------------------------------------
+// Wait for the worker to finish. Returns whether the video was written.
+//---------------------------------------------------------------------------
+bool CExportJob::wait()
+{
+	if(m_thread != NULL)
+	{
+		WaitForSingleObject(m_thread, INFINITE);
+		CloseHandle(m_thread);
+		m_thread = NULL;
+
+		// The snapshot's copies of the lines are freed
+		m_snapshot.linesA.reset();
+		m_snapshot.linesB.reset();
+	}
+	EnterCriticalSection(&m_lock);
+	bool isWritten = m_isWritten;
+	LeaveCriticalSection(&m_lock);
+	return isWritten;
+}
+
+bool CExportJob::isRunning()
+{
+	return m_thread != NULL && WaitForSingleObject(m_thread, 0) == WAIT_TIMEOUT;
+}
+
+bool CExportJob::isCancelled()
+{
+	return m_isCancelled != 0;
+}
+
+int CExportJob::getFramesDone()
+{
+	return m_framesDone;
+}
+
+int CExportJob::getFramesRendered()
+{
+	return m_framesRendered;
+}
+
+int CExportJob::getFrameCount()
+{
+	return m_frameCount;
+}
+
+float CExportJob::getElapsed()
+{
+	if(isRunning())
+		return (GetTickCount() - m_startTime) / 1000.0f;
+	EnterCriticalSection(&m_lock);
+	DWORD endTime = m_endTime;
+	LeaveCriticalSection(&m_lock);
+	return (endTime - m_startTime) / 1000.0f;
+}
+
+const char* CExportJob::getFilename()
+{
+	return m_filename.c_str();
+}
+
+DWORD WINAPI CExportJob::exportThread( LPVOID param )
+{
+	CExportJob* job = (CExportJob*)param;
+	bool isWritten = job->run();
+	EnterCriticalSection(&job->m_lock);
+	job->m_isWritten = isWritten;
+	job->m_endTime = GetTickCount();
+	LeaveCriticalSection(&job->m_lock);
+	return 0;
+}
+
+CvVideoWriter* CExportJob::createWriter()
+{
+	CvVideoWriter *vidw = cvCreateVideoWriter(m_filename.c_str(), CODEC, FRAMERATE, cvSize(m_width, m_height));
+	if(vidw == NULL)
+		fprintf(stderr, "Error: Cannot create video %s\n", m_filename.c_str());
+	return vidw;
+}
+
+//---------------------------------------------------------------------------
+// Frame i of the video is the morph at i/(frameCount-1), or at its mirror
+// for the reversed video. Stored frames of a reversed input state run from
+// B to A, so they are looked up mirrored as well. The store is synced once
+// at the end, which is all a later export needs to resume.
+//---------------------------------------------------------------------------
+bool CExportJob::run()
+{
+	m_kernel.setImages(m_snapshot.imageA, m_snapshot.imageB);
+	if(m_snapshot.numLines > 0)
+		m_kernel.setLines(&(*m_snapshot.linesA)[0], &(*m_snapshot.linesB)[0], m_snapshot.numLines);
+	m_kernel.setBlendType(m_snapshot.blendType);
+	m_kernel.setParameters(m_snapshot.a, m_snapshot.b, m_snapshot.p);
+
+	CvSize size = cvSize(m_width, m_height);
+	CvVideoWriter *vidw = createWriter();
+	if(vidw == NULL)
+		return false;
+
+	// Muxed from the renderer's frames only if it stored all of them
+	hash64 cpuHash = hashInt(CPU_RENDERER, m_snapshot.inputHash);
+	hash64 storeHash = cpuHash;
+	if(m_frameStore != NULL)
+	{
+		bool isFilled = true;
+		for(int i=0; i<m_frameCount && isFilled; i++)
+			isFilled = m_frameStore->hasFrame(m_snapshot.inputHash, i);
+		if(isFilled)
+			storeHash = m_snapshot.inputHash;
+	}
+
+	vector<char> frame(m_width * m_height * 3);
+	IplImage *frameImage = cvCreateImageHeader(size, IPL_DEPTH_8U, 3);
+	IplImage *outputImage = cvCreateImage(size, IPL_DEPTH_8U, 3);
+	cvSetData(frameImage, &frame[0], m_width * 3);
+
+	bool isWritten = true;
+	for(int i=0; i<m_frameCount; i++)
+	{
+		if(m_isCancelled)
+		{
+			isWritten = false;
+			break;
+		}
+
+		int frameIndex = m_isReversed ? m_frameCount - 1 - i : i;
+		int storedIndex = m_snapshot.isStoreReversed ? m_frameCount - 1 - frameIndex : frameIndex;
+		bool isStored = m_frameStore != NULL && m_frameStore->readFrame(storeHash, storedIndex, &frame[0]);
+		if(!isStored && storeHash != cpuHash)
+		{
+			// The background fill evicted a frame since the check. The
+			// video is started over from the CPU kernel.
+			cvReleaseVideoWriter(&vidw);
+			vidw = createWriter();
+			if(vidw == NULL)
+			{
+				isWritten = false;
+				break;
+			}
+			storeHash = cpuHash;
+			InterlockedExchange(&m_framesDone, 0);
+			i = -1;
+			continue;
+		}
+		if(!isStored)
+		{
+			m_kernel.render((float)frameIndex / (m_frameCount - 1), &frame[0], m_width * 3);
+			InterlockedIncrement(&m_framesRendered);
+
+			// Checkpoint the frame, so an interrupted export resumes here
+			if(m_frameStore != NULL)
+				m_frameStore->writeFrame(cpuHash, storedIndex, &frame[0]);
+		}
+
+		// Frames are y-up and flipped into the output
+		cvFlip(frameImage, outputImage, 0);
+		cvWriteFrame(vidw, outputImage);
+		InterlockedIncrement(&m_framesDone);
+	}
+	if(vidw != NULL)
+		cvReleaseVideoWriter(&vidw);
+	cvReleaseImageHeader(&frameImage);
+	cvReleaseImage(&outputImage);
+	if(m_frameStore != NULL)
+		m_frameStore->sync();
+
+	if(!isWritten)
+		DeleteFileA(m_filename.c_str());
+	return isWritten;
+}
@@ -0,0 +1,90 @@
+/////////////////////////////////////////////////////////////////////////////
+// File: ExportJob.h
+//
+// Background video export
+// CExportJob writes the morph to a video file on a worker thread, so the
+// edit and output windows stay responsive while it runs. Frames are
+// rendered with the CPU kernel from a snapshot of the line sets taken when
+// the export starts; later edits do not affect it.
+//
+// If the renderer's background fill has stored every frame under the
+// snapshot's input hash, the export only muxes them. Otherwise the whole
+// video comes from the CPU kernel, whose frames are stored under their own
+// key. If a stored frame is evicted while it is muxed, the video starts
+// over from the CPU kernel, so one video never mixes the two. An
+// interrupted export resumes from the CPU frames, and neither renderer's
+// frames are ever stored under the other's key.
+//
+// Author: Leon Ho
+/////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <windows.h>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cv.h>
+#include "hash_util.h"
+#include "MorphKernel.h"
+
+using namespace std;
+
+class CFrameStore;
+
+class CExportJob
+{
+public:
+	// Inputs of an export. Images and lines are y-up, as in the editor.
+	struct Snapshot
+	{
+		const IplImage *imageA, *imageB;		// Must outlive the job
+		shared_ptr< const vector<float> > linesA, linesB;
+		int numLines;
+		int blendType;
+		float a, b, p;			// Warp parameters
+		hash64 inputHash;		// Frame store state of these inputs
+		bool isStoreReversed;	// Stored frames run from B to A
+	};
+
+private:
+	string m_filename;
+	Snapshot m_snapshot;
+	CFrameStore *m_frameStore;
+	CMorphKernel m_kernel;
+	bool m_isReversed;
+	int m_width, m_height;
+	int m_frameCount;
+
+	HANDLE m_thread;
+	DWORD m_startTime;
+	volatile LONG m_framesDone;
+	volatile LONG m_framesRendered;
+	volatile LONG m_isCancelled;
+
+	// Results the worker publishes when it finishes, guarded by m_lock
+	CRITICAL_SECTION m_lock;
+	DWORD m_endTime;
+	bool m_isWritten;
+
+public:
+	bool start(const char* filename, const Snapshot& snapshot, CFrameStore* frameStore, bool isReversed);
+	void cancel();
+	bool wait();
+
+	bool isRunning();
+	bool isCancelled();
+	int getFramesDone();
+	int getFramesRendered();
+	int getFrameCount();
+	float getElapsed();
+	const char* getFilename();
+
+	CExportJob(void);
+	~CExportJob(void);
+
+private:
+	bool run();
+	CvVideoWriter* createWriter();
+	static DWORD WINAPI exportThread(LPVOID param);
+};
@@ -0,0 +1,336 @@
+/////////////////////////////////////////////////////////////////////////////
+// File: FeatureSnap.cpp
+//
+// Sub-pixel feature snapping
+// CFeatureSnap moves points placed in the editor onto a nearby corner or
+// edge of the image. Sobel gradients of every level of a grey pyramid are
+// computed once with SSE2 when the image is loaded. A snap searches the
+// level where the snap radius spans a few pixels, ranking candidates by
+// the smaller eigenvalue of the structure tensor for corners and by
+// gradient magnitude for edges, then follows the feature down to the
+// full-resolution level and refines it to a fraction of a pixel. Corners
+// are refined the same way as cvFindCornerSubPix, and edges by fitting a
+// parabola across the edge, keeping the point's position along it.
+//
+// Points are in image space with y pointing up, and pixel (i, j) covering
+// [i, i+1) x [j, j+1), as in the editor.
+//
+// Author: Leon Ho
+/////////////////////////////////////////////////////////////////////////////
+
+#include "FeatureSnap.h"
+#include <emmintrin.h>
+#include <math.h>
+#include <algorithm>
+
+const int SNAP_SEARCH_RADIUS = 8;		// Largest search radius in level pixels
+const int SNAP_MIN_LEVEL_SIZE = 32;		// Smallest level side
+const float CORNER_GRADIENT = 40;		// Weakest corner, as a Sobel gradient magnitude
+const float EDGE_GRADIENT = 80;			// Weakest edge, as a Sobel gradient magnitude
+const int REFINE_WINDOW = 4;			// Half size of the corner refinement window
+const int REFINE_ITERATIONS = 5;
+
+CFeatureSnap::CFeatureSnap(void)
+{
+}
+
+CFeatureSnap::~CFeatureSnap(void)
+{
+}
+
+//---------------------------------------------------------------------------
+// Build the gradient pyramid of a BGR image
+//---------------------------------------------------------------------------
+bool CFeatureSnap::init( const IplImage* image )
+{
+	m_levelList.clear();
+	if(image == NULL || image->nChannels != 3)
+		return false;
+
+	IplImage* gray = cvCreateImage(cvGetSize(image), IPL_DEPTH_8U, 1);
+	cvCvtColor(image, gray, CV_BGR2GRAY);
+	while(true)
+	{
+		Level level;
+		computeGradients(gray, &level);
+		m_levelList.push_back(level);
+		if(gray->width < SNAP_MIN_LEVEL_SIZE * 2 || gray->height < SNAP_MIN_LEVEL_SIZE * 2)
+			break;
+
+		IplImage* half = cvCreateImage(cvSize((gray->width + 1) / 2, (gray->height + 1) / 2), IPL_DEPTH_8U, 1);
+		cvPyrDown(gray, half);
+		cvReleaseImage(&gray);
+		gray = half;
+	}
+	cvReleaseImage(&gray);
+	return true;
+}
+
+//---------------------------------------------------------------------------
+// 3x3 Sobel gradients, eight pixels at a time. Values fit in 16 bits.
+//---------------------------------------------------------------------------
+void CFeatureSnap::computeGradients( const IplImage* gray, Level* level )
+{
+	int width = gray->width;
+	int height = gray->height;
+	level->width = width;
+	level->height = height;
+	level->gradX.assign(width * height, 0);
+	level->gradY.assign(width * height, 0);
+
+	__m128i zero = _mm_setzero_si128();
+	for(int y=1; y<height-1; y++)
+	{
+		const unsigned char* r0 = (const unsigned char*)gray->imageData + (y-1) * gray->widthStep;
+		const unsigned char* r1 = r0 + gray->widthStep;
+		const unsigned char* r2 = r1 + gray->widthStep;
+		short* gx = &level->gradX[y * width];
+		short* gy = &level->gradY[y * width];
+
+		int x = 1;
+		for(; x + 8 <= width - 1; x += 8)
+		{
+			__m128i r0l = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(r0 + x - 1)), zero);
+			__m128i r0c = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(r0 + x)), zero);
+			__m128i r0r = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(r0 + x + 1)), zero);
+			__m128i r1l = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(r1 + x - 1)), zero);
+			__m128i r1r = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(r1 + x + 1)), zero);
+			__m128i r2l = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(r2 + x - 1)), zero);
+			__m128i r2c = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(r2 + x)), zero);
+			__m128i r2r = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(r2 + x + 1)), zero);
+
+			// gx = (r0r - r0l) + 2(r1r - r1l) + (r2r - r2l)
+			__m128i dx = _mm_sub_epi16(r1r, r1l);
+			__m128i sx = _mm_add_epi16(_mm_sub_epi16(r0r, r0l), _mm_sub_epi16(r2r, r2l));
+			sx = _mm_add_epi16(sx, _mm_add_epi16(dx, dx));
+
+			// gy = (r2l + 2r2c + r2r) - (r0l + 2r0c + r0r)
+			__m128i sy = _mm_sub_epi16(_mm_add_epi16(r2l, r2r), _mm_add_epi16(r0l, r0r));
+			__m128i dy = _mm_sub_epi16(r2c, r0c);
+			sy = _mm_add_epi16(sy, _mm_add_epi16(dy, dy));
+
+			_mm_storeu_si128((__m128i*)(gx + x), sx);
+			_mm_storeu_si128((__m128i*)(gy + x), sy);
+		}
+		for(; x<width-1; x++)
+		{
+			gx[x] = (short)((r0[x+1] - r0[x-1]) + 2 * (r1[x+1] - r1[x-1]) + (r2[x+1] - r2[x-1]));
+			gy[x] = (short)((r2[x-1] + 2 * r2[x] + r2[x+1]) - (r0[x-1] + 2 * r0[x] + r0[x+1]));
+		}
+	}
+}
+
+//---------------------------------------------------------------------------
+// Snap (x, y) to a corner within radius, or failing that an edge. Returns
+// false and leaves the point alone if there is neither.
+//---------------------------------------------------------------------------
+bool CFeatureSnap::snap( float x, float y, float radius, float* snapX, float* snapY )
+{
+	if(m_levelList.empty())
+		return false;
+
+	// Search the level where the radius spans a few pixels
+	int levelIndex = 0;
+	float levelScale = 1;
+	while(levelIndex + 1 < (int)m_levelList.size() && radius / levelScale > SNAP_SEARCH_RADIUS)
+	{
+		levelIndex++;
+		levelScale *= 2;
+	}
+
+	const Level& coarse = m_levelList[levelIndex];
+	int centerX = (int)floor(x / levelScale);
+	int centerY = (int)floor(y / levelScale);
+	int levelRadius = (int)ceil(radius / levelScale);
+
+	FeatureType type = FEATURE_CORNER;
+	int featureX, featureY;
+	if(!findFeature(coarse, FEATURE_CORNER, centerX, centerY, levelRadius,
+		CORNER_GRADIENT * CORNER_GRADIENT, &featureX, &featureY))
+	{
+		type = FEATURE_EDGE;
+		if(!findFeature(coarse, FEATURE_EDGE, centerX, centerY, levelRadius,
+			EDGE_GRADIENT * EDGE_GRADIENT, &featureX, &featureY))
+			return false;
+	}
+
+	// Follow the feature down the pyramid. Pixel i of a level covers pixels
+	// 2i and 2i+1 of the one below.
+	for(int i=levelIndex-1; i>=0; i--)
+	{
+		featureX *= 2;
+		featureY *= 2;
+		findFeature(m_levelList[i], type, featureX, featureY, 2, 0, &featureX, &featureY);
+	}
+
+	// Refine to a fraction of a pixel; pixel centres are at i + 0.5
+	const Level& fine = m_levelList[0];
+	float fx, fy;
+	if(type == FEATURE_CORNER)
+		refineCorner(fine, featureX, featureY, &fx, &fy);
+	else
+	{
+		refineEdge(fine, featureX, featureY, &fx, &fy);
+
+		// Keep the point where it was along the edge
+		int index = featureY * fine.width + featureX;
+		float gx = fine.gradX[index], gy = fine.gradY[index];
+		float length = sqrt(gx * gx + gy * gy);
+		if(length < 1)
+			return false;
+		float nx = gx / length, ny = gy / length;
+		float across = (x - fx - 0.5f) * nx + (y - fy - 0.5f) * ny;
+		fx += x - fx - 0.5f - across * nx;
+		fy += y - fy - 0.5f - across * ny;
+	}
+	fx += 0.5f;
+	fy += 0.5f;
+
+	// Refinement may wander off on weak features
+	if((fx - x) * (fx - x) + (fy - y) * (fy - y) > 4 * radius * radius)
+		return false;
+	*snapX = fx;
+	*snapY = fy;
+	return true;
+}
+
+//---------------------------------------------------------------------------
+// Strongest feature within radius of (centerX, centerY), weighted to prefer
+// nearer pixels. Returns false if none has a response of at least
+// minResponse.
+//---------------------------------------------------------------------------
+bool CFeatureSnap::findFeature( const Level& level, FeatureType type, int centerX, int centerY, int radius,
+	float minResponse, int* featureX, int* featureY )
+{
+	int x0 = max(centerX - radius, 2), x1 = min(centerX + radius, level.width - 3);
+	int y0 = max(centerY - radius, 2), y1 = min(centerY + radius, level.height - 3);
+	float falloff = 1.0f / ((radius + 1) * (radius + 1));
+
+	bool isFound = false;
+	float bestScore = 0;
+	for(int y=y0; y<=y1; y++)
+	{
+		for(int x=x0; x<=x1; x++)
+		{
+			int distSq = (x - centerX) * (x - centerX) + (y - centerY) * (y - centerY);
+			if(distSq > radius * radius)
+				continue;
+			float response = getResponse(level, type, x, y);
+			if(response < minResponse)
+				continue;
+			float score = response * (1 - distSq * falloff);
+			if(!isFound || score > bestScore)
+			{
+				bestScore = score;
+				*featureX = x;
+				*featureY = y;
+				isFound = true;
+			}
+		}
+	}
+	return isFound;
+}
+
+//---------------------------------------------------------------------------
+// Corners: smaller eigenvalue of the structure tensor over a 3x3 window,
+// per pixel. Edges: squared gradient magnitude.
+//---------------------------------------------------------------------------
+float CFeatureSnap::getResponse( const Level& level, FeatureType type, int x, int y )
+{
+	if(type == FEATURE_EDGE)
+	{
+		int index = y * level.width + x;
+		float gx = level.gradX[index], gy = level.gradY[index];
+		return gx * gx + gy * gy;
+	}
+
+	float a = 0, b = 0, c = 0;
+	for(int j=y-1; j<=y+1; j++)
+	{
+		const short* gx = &level.gradX[j * level.width];
+		const short* gy = &level.gradY[j * level.width];
+		for(int i=x-1; i<=x+1; i++)
+		{
+			a += (float)gx[i] * gx[i];
+			b += (float)gx[i] * gy[i];
+			c += (float)gy[i] * gy[i];
+		}
+	}
+	float half = (a + c) / 2;
+	float root = sqrt((a - c) * (a - c) / 4 + b * b);
+	return (half - root) / 9;
+}
+
+//---------------------------------------------------------------------------
+// The corner is the point q where every gradient in the window is
+// orthogonal to the vector from q to its pixel, found in a least squares
+// sense. The window is re-centred until q settles.
+//---------------------------------------------------------------------------
+void CFeatureSnap::refineCorner( const Level& level, int x, int y, float* cornerX, float* cornerY )
+{
+	*cornerX = (float)x;
+	*cornerY = (float)y;
+	for(int iter=0; iter<REFINE_ITERATIONS; iter++)
+	{
+		int x0 = max(x - REFINE_WINDOW, 1), x1 = min(x + REFINE_WINDOW, level.width - 2);
+		int y0 = max(y - REFINE_WINDOW, 1), y1 = min(y + REFINE_WINDOW, level.height - 2);
+		double a = 0, b = 0, c = 0, bx = 0, by = 0;
+		for(int j=y0; j<=y1; j++)
+		{
+			for(int i=x0; i<=x1; i++)
+			{
+				int index = j * level.width + i;
+				double gx = level.gradX[index], gy = level.gradY[index];
+				double gxx = gx * gx, gxy = gx * gy, gyy = gy * gy;
+				a += gxx;
+				b += gxy;
+				c += gyy;
+				bx += gxx * i + gxy * j;
+				by += gxy * i + gyy * j;
+			}
+		}
+
+		double det = a * c - b * b;
+		if(fabs(det) < 1e-6 * (a + c) * (a + c))
+			return;
+		float qx = (float)((c * bx - b * by) / det);
+		float qy = (float)((a * by - b * bx) / det);
+		if(fabs(qx - x) > REFINE_WINDOW || fabs(qy - y) > REFINE_WINDOW)
+			return;
+		*cornerX = qx;
+		*cornerY = qy;
+
+		int nextX = (int)floor(qx + 0.5f), nextY = (int)floor(qy + 0.5f);
+		if(nextX == x && nextY == y)
+			return;
+		x = nextX;
+		y = nextY;
+	}
+}
+
+//---------------------------------------------------------------------------
+// Fit a parabola to the gradient magnitude across the edge, along the axis
+// closer to the gradient direction
+//---------------------------------------------------------------------------
+void CFeatureSnap::refineEdge( const Level& level, int x, int y, float* edgeX, float* edgeY )
+{
+	*edgeX = (float)x;
+	*edgeY = (float)y;
+
+	int index = y * level.width + x;
+	int step = abs(level.gradX[index]) >= abs(level.gradY[index]) ? 1 : level.width;
+	float m0 = sqrt(getResponse(level, FEATURE_EDGE, x, y));
+	float mPrev = sqrt((float)level.gradX[index - step] * level.gradX[index - step] +
+		(float)level.gradY[index - step] * level.gradY[index - step]);
+	float mNext = sqrt((float)level.gradX[index + step] * level.gradX[index + step] +
+		(float)level.gradY[index + step] * level.gradY[index + step]);
+
+	float curvature = mPrev - 2 * m0 + mNext;
+	if(curvature >= 0)
+		return;
+	float offset = min(max(0.5f * (mPrev - mNext) / curvature, -0.5f), 0.5f);
+	if(step == 1)
+		*edgeX += offset;
+	else
+		*edgeY += offset;
+}
@@ -0,0 +1,60 @@
+/////////////////////////////////////////////////////////////////////////////
+// File: FeatureSnap.h
+//
+// Sub-pixel feature snapping
+// CFeatureSnap moves points placed in the editor onto a nearby corner or
+// edge of the image. Sobel gradients of every level of a grey pyramid are
+// computed once with SSE2 when the image is loaded. A snap searches the
+// level where the snap radius spans a few pixels, ranking candidates by
+// the smaller eigenvalue of the structure tensor for corners and by
+// gradient magnitude for edges, then follows the feature down to the
+// full-resolution level and refines it to a fraction of a pixel. Corners
+// are refined the same way as cvFindCornerSubPix, and edges by fitting a
+// parabola across the edge, keeping the point's position along it.
+//
+// Points are in image space with y pointing up, and pixel (i, j) covering
+// [i, i+1) x [j, j+1), as in the editor.
+//
+// Author: Leon Ho
+/////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <vector>
+#include <cv.h>
+
+using namespace std;
+
+class CFeatureSnap
+{
+private:
+	enum FeatureType
+	{
+		FEATURE_CORNER,
+		FEATURE_EDGE
+	};
+
+	struct Level
+	{
+		int width, height;
+		vector<short> gradX, gradY;		// Sobel gradients, 0 on the border
+	};
+
+private:
+	vector<Level> m_levelList;		// Finest first
+
+public:
+	bool init(const IplImage* image);
+	bool snap(float x, float y, float radius, float* snapX, float* snapY);
+
+	CFeatureSnap(void);
+	~CFeatureSnap(void);
+
+private:
+	static void computeGradients(const IplImage* gray, Level* level);
+	bool findFeature(const Level& level, FeatureType type, int centerX, int centerY, int radius,
+		float minResponse, int* featureX, int* featureY);
+	float getResponse(const Level& level, FeatureType type, int x, int y);
+	void refineCorner(const Level& level, int x, int y, float* cornerX, float* cornerY);
+	void refineEdge(const Level& level, int x, int y, float* edgeX, float* edgeY);
+};
@@ -0,0 +1,595 @@
+/////////////////////////////////////////////////////////////////////////////
+// File: FrameStore.cpp
+//
+// Memory-mapped frame store
+// CFrameStore keeps rendered frames in a single memory-mapped file of
+// fixed-size slots, together with an index recording the input hash and
+// frame number each slot holds. Frames are looked up under the current
+// input hash, so they survive restarts and an interrupted export resumes
+// from the frames already written. Frames are read straight from the
+// mapped pages.
+//
+// Changing the input hash does not discard frames. A store opened with
+// room for several input states keeps the frames of earlier states until
+// they are evicted, so going back to them costs no rendering.
+//
+// A store can also be read backwards, which serves the reverse morph of a
+// pair from the frames of the forward one.
+//
+// Disk use is bounded by the number of slots; when all slots are taken
+// the least recently used frame is evicted. Memory use is bounded by the
+// number of mapped frame views, which are also evicted in LRU order.
+//
+// Calls are serialised, so a worker thread can copy frames of a given
+// input state in and out while the GUI thread uses the store. Slots whose
+// pointers were handed out are never reused by the other thread.
+//
+// Author: Leon Ho
+/////////////////////////////////////////////////////////////////////////////
+
+#include "FrameStore.h"
+#include <stdio.h>
+#include <string.h>
+
+const char FRAMESTORE_MAGIC[] = "MFS";
+const int FRAMESTORE_VERSION = 3;
+
+CFrameStore::CFrameStore(void)
+{
+	m_file = INVALID_HANDLE_VALUE;
+	m_mapping = NULL;
+	m_indexView = NULL;
+	m_header = NULL;
+	m_slotList = NULL;
+	m_dataOffset = 0;
+	m_granularity = 1;
+	m_maxViews = 1;
+	m_useCounter = 0;
+	m_completeCount = 0;
+	m_pendingFrame = m_pendingSlot = -1;
+	m_readSlot = -1;
+	m_isReversed = false;
+	InitializeCriticalSection(&m_lock);
+}
+
+CFrameStore::~CFrameStore(void)
+{
+	close();
+	DeleteCriticalSection(&m_lock);
+}
+
+//---------------------------------------------------------------------------
+// Open the store file, keeping its frames if it was written with the same
+// layout. The number of slots is enough for the frames of stateCount
+// input states, bounded by diskBudget. The number of mapped frames is
+// bounded by ramBudget. Budgets are in bytes.
+//---------------------------------------------------------------------------
+bool CFrameStore::open( const char* filename, int width, int height, int frameCount,
+	__int64 diskBudget, __int64 ramBudget, int stateCount )
+{
+	close();
+	EnterCriticalSection(&m_lock);
+
+	Header header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, FRAMESTORE_MAGIC, sizeof(header.magic));
+	header.version = FRAMESTORE_VERSION;
+	header.width = width;
+	header.height = height;
+	header.frameCount = frameCount;
+	header.frameSize = width * height * 3;
+	header.slotCount = (int)min(diskBudget / header.frameSize, (__int64)frameCount * max(stateCount, 1));
+	header.slotCount = max(header.slotCount, 1);
+	m_maxViews = (int)max(ramBudget / header.frameSize, (__int64)1);
+
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	m_granularity = info.dwAllocationGranularity;
+
+	m_file = CreateFileA(filename, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL,
+		OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if(m_file == INVALID_HANDLE_VALUE)
+	{
+		fprintf(stderr, "Error: Cannot open frame store %s\n", filename);
+		LeaveCriticalSection(&m_lock);
+		return false;
+	}
+
+	// Check if the existing file has the same layout
+	Header existing;
+	DWORD bytesRead = 0;
+	bool isValid = ReadFile(m_file, &existing, sizeof(existing), &bytesRead, NULL) &&
+		bytesRead == sizeof(existing);
+	if(isValid)
+	{
+		header.inputHash = existing.inputHash;
+		isValid = memcmp(&existing, &header, sizeof(Header)) == 0;
+	}
+
+	// Map the whole file, growing it if necessary
+	m_dataOffset = sizeof(Header) + header.slotCount * sizeof(SlotEntry);
+	m_dataOffset = (m_dataOffset + m_granularity - 1) / m_granularity * m_granularity;
+	__int64 fileSize = m_dataOffset + (__int64)header.slotCount * header.frameSize;
+	m_mapping = CreateFileMappingA(m_file, NULL, PAGE_READWRITE,
+		(DWORD)(fileSize >> 32), (DWORD)fileSize, NULL);
+	if(m_mapping != NULL)
+		m_indexView = MapViewOfFile(m_mapping, FILE_MAP_WRITE, 0, 0, (SIZE_T)m_dataOffset);
+	if(m_indexView == NULL)
+	{
+		fprintf(stderr, "Error: Cannot map frame store %s\n", filename);
+		LeaveCriticalSection(&m_lock);
+		close();
+		return false;
+	}
+	m_header = (Header*)m_indexView;
+	m_slotList = (SlotEntry*)(m_header + 1);
+
+	if(!isValid)
+	{
+		memcpy(m_header, &header, sizeof(Header));
+		resetIndex();
+		LeaveCriticalSection(&m_lock);
+		return true;
+	}
+
+	// Rebuild the key table from the index
+	m_keySlot.clear();
+	m_slotUse.assign(m_header->slotCount, 0);
+	m_completeCount = 0;
+	for(int i=0; i<m_header->slotCount; i++)
+	{
+		SlotEntry& entry = m_slotList[i];
+		if(entry.frame < 0)
+			continue;
+		hash64 key = getKey(entry.inputHash, entry.frame);
+		if(entry.frame >= frameCount || m_keySlot.count(key) > 0)
+		{
+			entry.frame = -1;
+			continue;
+		}
+		m_keySlot[key] = i;
+		if(entry.inputHash == m_header->inputHash)
+			m_completeCount++;
+	}
+	FlushViewOfFile(m_indexView, 0);
+	LeaveCriticalSection(&m_lock);
+	return true;
+}
+
+void CFrameStore::close()
+{
+	EnterCriticalSection(&m_lock);
+	for(auto it=m_viewList.begin(); it!=m_viewList.end(); it++)
+		UnmapViewOfFile(it->second.base);
+	m_viewList.clear();
+
+	if(m_indexView != NULL)
+		UnmapViewOfFile(m_indexView);
+	if(m_mapping != NULL)
+		CloseHandle(m_mapping);
+	if(m_file != INVALID_HANDLE_VALUE)
+		CloseHandle(m_file);
+
+	m_file = INVALID_HANDLE_VALUE;
+	m_mapping = NULL;
+	m_indexView = NULL;
+	m_header = NULL;
+	m_slotList = NULL;
+	m_keySlot.clear();
+	m_slotUse.clear();
+	m_completeCount = 0;
+	m_pendingFrame = m_pendingSlot = -1;
+	m_readSlot = -1;
+	LeaveCriticalSection(&m_lock);
+}
+
+//---------------------------------------------------------------------------
+// Frames rendered from other inputs are kept, but are no longer found
+// until their input hash is set again. A reversed store serves frame i
+// from the frame stored as frameCount-1-i.
+//---------------------------------------------------------------------------
+void CFrameStore::setInputHash( hash64 inputHash, bool isReversed )
+{
+	EnterCriticalSection(&m_lock);
+	m_isReversed = isReversed;
+	if(m_header == NULL || m_header->inputHash == inputHash)
+	{
+		LeaveCriticalSection(&m_lock);
+		return;
+	}
+	m_header->inputHash = inputHash;
+	FlushViewOfFile(m_header, sizeof(Header));
+
+	m_completeCount = 0;
+	for(int i=0; i<m_header->slotCount; i++)
+	{
+		if(m_slotList[i].frame >= 0 && m_slotList[i].inputHash == inputHash)
+			m_completeCount++;
+	}
+	LeaveCriticalSection(&m_lock);
+}
+
+hash64 CFrameStore::getInputHash()
+{
+	EnterCriticalSection(&m_lock);
+	hash64 inputHash = m_header != NULL ? m_header->inputHash : 0;
+	LeaveCriticalSection(&m_lock);
+	return inputHash;
+}
+
+void CFrameStore::resetIndex()
+{
+	for(int i=0; i<m_header->slotCount; i++)
+	{
+		m_slotList[i].inputHash = 0;
+		m_slotList[i].frame = -1;
+		m_slotList[i].reserved = 0;
+	}
+	FlushViewOfFile(m_indexView, 0);
+
+	m_keySlot.clear();
+	m_slotUse.assign(m_header->slotCount, 0);
+	m_completeCount = 0;
+	m_pendingFrame = m_pendingSlot = -1;
+	m_readSlot = -1;
+}
+
+int CFrameStore::mapIndex( int index )
+{
+	if(!m_isReversed || m_header == NULL)
+		return index;
+	return m_header->frameCount - 1 - index;
+}
+
+hash64 CFrameStore::getKey( hash64 inputHash, int frame )
+{
+	return hashInt(frame, inputHash);
+}
+
+//---------------------------------------------------------------------------
+// Slot holding a stored frame of the given inputs, or -1
+//---------------------------------------------------------------------------
+int CFrameStore::findSlot( hash64 inputHash, int frame )
+{
+	auto it = m_keySlot.find(getKey(inputHash, frame));
+	if(it == m_keySlot.end())
+		return -1;
+	const SlotEntry& entry = m_slotList[it->second];
+	if(entry.inputHash != inputHash || entry.frame != frame)
+		return -1;
+	return it->second;
+}
+
+void CFrameStore::writeEntry( int slot, hash64 inputHash, int frame )
+{
+	m_slotList[slot].inputHash = inputHash;
+	m_slotList[slot].frame = frame;
+	FlushViewOfFile(&m_slotList[slot], sizeof(SlotEntry));
+}
+
+//---------------------------------------------------------------------------
+// Make a written slot visible to readers. Frame data must be flushed
+// before its index entry is written.
+//---------------------------------------------------------------------------
+void CFrameStore::commitSlot( int slot, hash64 inputHash, int frame )
+{
+	writeEntry(slot, inputHash, frame);
+	m_keySlot[getKey(inputHash, frame)] = slot;
+	if(inputHash == m_header->inputHash)
+		m_completeCount++;
+}
+
+bool CFrameStore::hasFrame( int index )
+{
+	EnterCriticalSection(&m_lock);
+	bool isStored = m_header != NULL && index >= 0 && index < m_header->frameCount &&
+		findSlot(m_header->inputHash, mapIndex(index)) >= 0;
+	LeaveCriticalSection(&m_lock);
+	return isStored;
+}
+
+int CFrameStore::getCompletedCount()
+{
+	EnterCriticalSection(&m_lock);
+	int completeCount = m_completeCount;
+	LeaveCriticalSection(&m_lock);
+	return completeCount;
+}
+
+int CFrameStore::getFrameCount()
+{
+	if(m_header == NULL)
+		return 0;
+	return m_header->frameCount;
+}
+
+int CFrameStore::getFrameSize()
+{
+	if(m_header == NULL)
+		return 0;
+	return m_header->frameSize;
+}
+
+const char* CFrameStore::getFrame( int index )
+{
+	EnterCriticalSection(&m_lock);
+	if(!hasFrame(index))
+	{
+		LeaveCriticalSection(&m_lock);
+		return NULL;
+	}
+
+	int slot = findSlot(m_header->inputHash, mapIndex(index));
+	m_slotUse[slot] = ++m_useCounter;
+	m_readSlot = slot;
+	const char* frame = mapSlot(slot);
+	LeaveCriticalSection(&m_lock);
+	return frame;
+}
+
+//---------------------------------------------------------------------------
+// Reserve a slot for a frame and return its mapped pages for writing.
+// The frame is not visible to readers until commitFrame is called.
+//---------------------------------------------------------------------------
+char* CFrameStore::beginFrame( int index )
+{
+	EnterCriticalSection(&m_lock);
+	if(m_header == NULL || index < 0 || index >= m_header->frameCount)
+	{
+		LeaveCriticalSection(&m_lock);
+		return NULL;
+	}
+
+	// The pointer last returned by getFrame is no longer used
+	m_readSlot = -1;
+	index = mapIndex(index);
+	int slot = findSlot(m_header->inputHash, index);
+	if(slot >= 0)
+		freeSlot(slot);
+	else
+		slot = allocSlot();
+	if(slot < 0)
+	{
+		LeaveCriticalSection(&m_lock);
+		return NULL;
+	}
+	m_slotUse[slot] = ++m_useCounter;
+
+	m_pendingFrame = index;
+	m_pendingSlot = slot;
+	char* frame = mapSlot(slot);
+	LeaveCriticalSection(&m_lock);
+	return frame;
+}
+
+//---------------------------------------------------------------------------
+// Frame data is flushed before its index entry, so a frame is never marked
+// complete unless all of its pixels made it to the file.
+//---------------------------------------------------------------------------
+void CFrameStore::commitFrame( int index )
+{
+	EnterCriticalSection(&m_lock);
+	index = mapIndex(index);
+	if(index != m_pendingFrame)
+	{
+		LeaveCriticalSection(&m_lock);
+		return;
+	}
+
+	auto it = m_viewList.find(m_pendingSlot);
+	if(it != m_viewList.end())
+		FlushViewOfFile(it->second.frame, m_header->frameSize);
+
+	commitSlot(m_pendingSlot, m_header->inputHash, index);
+	m_pendingFrame = m_pendingSlot = -1;
+	LeaveCriticalSection(&m_lock);
+}
+
+void CFrameStore::sync()
+{
+	if(m_file != INVALID_HANDLE_VALUE)
+		FlushFileBuffers(m_file);
+}
+
+bool CFrameStore::readFrame( int index, char* data )
+{
+	EnterCriticalSection(&m_lock);
+	const char* frame = getFrame(index);
+	if(frame != NULL)
+		memcpy(data, frame, m_header->frameSize);
+	LeaveCriticalSection(&m_lock);
+	return frame != NULL;
+}
+
+bool CFrameStore::writeFrame( int index, const char* data )
+{
+	EnterCriticalSection(&m_lock);
+	char* frame = beginFrame(index);
+	if(frame != NULL)
+	{
+		memcpy(frame, data, m_header->frameSize);
+		commitFrame(index);
+	}
+	LeaveCriticalSection(&m_lock);
+	return frame != NULL;
+}
+
+bool CFrameStore::hasFrame( hash64 inputHash, int frame )
+{
+	EnterCriticalSection(&m_lock);
+	bool isStored = m_header != NULL && findSlot(inputHash, frame) >= 0;
+	LeaveCriticalSection(&m_lock);
+	return isStored;
+}
+
+//---------------------------------------------------------------------------
+// Copy a frame of the given input state out of the store. The frame is
+// read through a temporary view, so views handed out by getFrame and
+// beginFrame stay mapped.
+//---------------------------------------------------------------------------
+bool CFrameStore::readFrame( hash64 inputHash, int frame, char* data )
+{
+	EnterCriticalSection(&m_lock);
+	View view;
+	int slot = m_header != NULL ? findSlot(inputHash, frame) : -1;
+	bool isRead = slot >= 0 && mapView(slot, &view);
+	if(isRead)
+	{
+		m_slotUse[slot] = ++m_useCounter;
+		memcpy(data, view.frame, m_header->frameSize);
+		UnmapViewOfFile(view.base);
+	}
+	LeaveCriticalSection(&m_lock);
+	return isRead;
+}
+
+//---------------------------------------------------------------------------
+// Store a frame of the given input state, which need not be the current
+// one. Pinned slots are never taken.
+//---------------------------------------------------------------------------
+bool CFrameStore::writeFrame( hash64 inputHash, int frame, const char* data )
+{
+	EnterCriticalSection(&m_lock);
+	if(m_header == NULL || frame < 0 || frame >= m_header->frameCount)
+	{
+		LeaveCriticalSection(&m_lock);
+		return false;
+	}
+
+	int slot = findSlot(inputHash, frame);
+	if(slot >= 0 && isPinned(slot))
+	{
+		LeaveCriticalSection(&m_lock);
+		return false;
+	}
+	if(slot >= 0)
+		freeSlot(slot);
+	else
+		slot = allocSlot();
+
+	View view;
+	bool isWritten = slot >= 0 && mapView(slot, &view);
+	if(isWritten)
+	{
+		m_slotUse[slot] = ++m_useCounter;
+		memcpy(view.frame, data, m_header->frameSize);
+		FlushViewOfFile(view.frame, m_header->frameSize);
+		UnmapViewOfFile(view.base);
+		commitSlot(slot, inputHash, frame);
+	}
+	LeaveCriticalSection(&m_lock);
+	return isWritten;
+}
+
+//---------------------------------------------------------------------------
+// Frames of other input states are evicted before those of the current
+// one, least recently used first
+//---------------------------------------------------------------------------
+int CFrameStore::allocSlot()
+{
+	int lruSlot = -1;
+	bool isLruCurrent = true;
+	for(int i=0; i<m_header->slotCount; i++)
+	{
+		if(isPinned(i))
+			continue;
+		if(m_slotList[i].frame == -1)
+			return i;
+		if(lruSlot == -1)
+		{
+			lruSlot = i;
+			isLruCurrent = m_slotList[i].inputHash == m_header->inputHash;
+			continue;
+		}
+		bool isCurrent = m_slotList[i].inputHash == m_header->inputHash;
+		if((isLruCurrent && !isCurrent) ||
+			(isLruCurrent == isCurrent && m_slotUse[i] < m_slotUse[lruSlot]))
+		{
+			lruSlot = i;
+			isLruCurrent = isCurrent;
+		}
+	}
+	if(lruSlot >= 0)
+		freeSlot(lruSlot);
+	return lruSlot;
+}
+
+//---------------------------------------------------------------------------
+// Evict the frame held in a slot. Its index entry is flushed before the
+// slot can be overwritten.
+//---------------------------------------------------------------------------
+void CFrameStore::freeSlot( int slot )
+{
+	SlotEntry& entry = m_slotList[slot];
+	if(entry.frame < 0)
+		return;
+	m_keySlot.erase(getKey(entry.inputHash, entry.frame));
+	if(entry.inputHash == m_header->inputHash)
+		m_completeCount--;
+	writeEntry(slot, 0, -1);
+}
+
+//---------------------------------------------------------------------------
+// Slots being written or last read through a returned pointer
+//---------------------------------------------------------------------------
+bool CFrameStore::isPinned( int slot )
+{
+	return slot == m_pendingSlot || slot == m_readSlot;
+}
+
+//---------------------------------------------------------------------------
+// Map the pages of a slot. Views must start on an allocation granularity
+// boundary.
+//---------------------------------------------------------------------------
+bool CFrameStore::mapView( int slot, View* view )
+{
+	__int64 offset = m_dataOffset + (__int64)slot * m_header->frameSize;
+	__int64 aligned = offset - offset % m_granularity;
+	view->base = MapViewOfFile(m_mapping, FILE_MAP_WRITE, (DWORD)(aligned >> 32), (DWORD)aligned,
+		(SIZE_T)(offset - aligned + m_header->frameSize));
+	if(view->base == NULL)
+	{
+		fprintf(stderr, "Error: Cannot map frame store slot %d\n", slot);
+		return false;
+	}
+	view->frame = (char*)view->base + (offset - aligned);
+	view->lastUse = m_useCounter;
+	return true;
+}
+
+char* CFrameStore::mapSlot( int slot )
+{
+	auto it = m_viewList.find(slot);
+	if(it != m_viewList.end())
+	{
+		it->second.lastUse = m_useCounter;
+		return it->second.frame;
+	}
+
+	// Stay within the memory budget, keeping pinned views mapped
+	while((int)m_viewList.size() >= m_maxViews)
+	{
+		auto lru = m_viewList.end();
+		for(auto it=m_viewList.begin(); it!=m_viewList.end(); it++)
+			if(!isPinned(it->first) && (lru == m_viewList.end() || it->second.lastUse < lru->second.lastUse))
+				lru = it;
+		if(lru == m_viewList.end())
+			break;
+		unmapSlot(lru->first);
+	}
+
+	View view;
+	if(!mapView(slot, &view))
+		return NULL;
+	m_viewList[slot] = view;
+	return view.frame;
+}
+
+void CFrameStore::unmapSlot( int slot )
+{
+	auto it = m_viewList.find(slot);
+	if(it == m_viewList.end())
+		return;
+	UnmapViewOfFile(it->second.base);
+	m_viewList.erase(it);
+}
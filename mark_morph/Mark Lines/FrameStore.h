@@ -0,0 +1,131 @@
+/////////////////////////////////////////////////////////////////////////////
+// File: FrameStore.h
+//
+// Memory-mapped frame store
+// CFrameStore keeps rendered frames in a single memory-mapped file of
+// fixed-size slots, together with an index recording the input hash and
+// frame number each slot holds. Frames are looked up under the current
+// input hash, so they survive restarts and an interrupted export resumes
+// from the frames already written. Frames are read straight from the
+// mapped pages.
+//
+// Changing the input hash does not discard frames. A store opened with
+// room for several input states keeps the frames of earlier states until
+// they are evicted, so going back to them costs no rendering.
+//
+// A store can also be read backwards, which serves the reverse morph of a
+// pair from the frames of the forward one.
+//
+// Disk use is bounded by the number of slots; when all slots are taken
+// the least recently used frame is evicted. Memory use is bounded by the
+// number of mapped frame views, which are also evicted in LRU order.
+//
+// Calls are serialised, so a worker thread can copy frames of a given
+// input state in and out while the GUI thread uses the store. Slots whose
+// pointers were handed out are never reused by the other thread.
+//
+// Author: Leon Ho
+/////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <windows.h>
+#include <map>
+#include <vector>
+#include "hash_util.h"
+
+using namespace std;
+
+class CFrameStore
+{
+private:
+	struct Header
+	{
+		char magic[4];
+		int version;
+		hash64 inputHash;
+		int width, height;
+		int frameCount;
+		int frameSize;
+		int slotCount;
+	};
+
+	// On-disk index entry of a slot
+	struct SlotEntry
+	{
+		hash64 inputHash;
+		int frame;			// -1 if the slot is free
+		int reserved;
+	};
+
+	struct View
+	{
+		void* base;
+		char* frame;
+		unsigned int lastUse;
+	};
+
+private:
+	HANDLE m_file, m_mapping;
+	void* m_indexView;
+	Header* m_header;
+	SlotEntry* m_slotList;
+	__int64 m_dataOffset;
+	unsigned int m_granularity;
+
+	map<hash64, int> m_keySlot;			// Slot holding each frame key
+	vector<unsigned int> m_slotUse;
+	map<int, View> m_viewList;		// Mapped views keyed by slot
+	int m_maxViews;
+	unsigned int m_useCounter;
+	int m_completeCount;
+	int m_pendingFrame, m_pendingSlot;
+	int m_readSlot;					// Slot last returned by getFrame
+	bool m_isReversed;
+	CRITICAL_SECTION m_lock;
+
+public:
+	bool open(const char* filename, int width, int height, int frameCount,
+		__int64 diskBudget, __int64 ramBudget, int stateCount = 1);
+	void close();
+
+	void setInputHash(hash64 inputHash, bool isReversed = false);
+	hash64 getInputHash();
+
+	bool hasFrame(int index);
+	int getCompletedCount();
+	int getFrameCount();
+	int getFrameSize();
+
+	// Returned pointers stay valid until the caller's next call into the
+	// store. Only one thread may use these.
+	const char* getFrame(int index);
+	char* beginFrame(int index);
+	void commitFrame(int index);
+	void sync();
+
+	bool readFrame(int index, char* data);
+	bool writeFrame(int index, const char* data);
+
+	// Frames of any input state, by stored frame number
+	bool hasFrame(hash64 inputHash, int frame);
+	bool readFrame(hash64 inputHash, int frame, char* data);
+	bool writeFrame(hash64 inputHash, int frame, const char* data);
+
+	CFrameStore(void);
+	~CFrameStore(void);
+
+private:
+	void resetIndex();
+	int mapIndex(int index);
+	hash64 getKey(hash64 inputHash, int frame);
+	int findSlot(hash64 inputHash, int frame);
+	void writeEntry(int slot, hash64 inputHash, int frame);
+	void commitSlot(int slot, hash64 inputHash, int frame);
+	int allocSlot();
+	void freeSlot(int slot);
+	bool isPinned(int slot);
+	bool mapView(int slot, View* view);
+	char* mapSlot(int slot);
+	void unmapSlot(int slot);
+};
@@ -6,6 +6,10 @@
 // GLUT event callbacks are forwarded to a delegate class. GL context is
 // also guranteed to belong to the active GLUT window.
 //
+// There is no idle callback. Delegates are only updated when they schedule
+// an update, and redraws requested through postRedisplay are batched
+// across all windows, so the program sleeps when nothing is happening.
+//
 // Author: Daniel Seah
 /////////////////////////////////////////////////////////////////////////////
 
@@ -14,7 +18,14 @@
 
 using namespace std;
 
+const int REDISPLAY_INTERVAL = 1000 / 60;	// Shortest time between batched redraws
+
 map<GLuint, IGLUTDelegate*> CGLUTWindow::m_delegateList;
+map<GLuint, int> CGLUTWindow::m_updateList;
+set<GLuint> CGLUTWindow::m_redisplayList;
+int CGLUTWindow::m_redisplayTime = 0;
+int CGLUTWindow::m_timerDeadline = -1;
+int CGLUTWindow::m_timerId = 0;
 
 CGLUTWindow::CGLUTWindow(const char* name, int width, int height)
 {
@@ -31,11 +42,12 @@ CGLUTWindow::CGLUTWindow(const char* name, int width, int height)
 	glutKeyboardFunc(onKeyPress);
 	glutMotionFunc(onMouseMove);
 	glutMouseFunc(onMousePress);
-	glutIdleFunc(onUpdate);
 }
 
 CGLUTWindow::~CGLUTWindow(void)
 {
+	m_updateList.erase(m_window);
+	m_redisplayList.erase(m_window);
 	glutDestroyWindow(m_window);
 }
 
@@ -69,13 +81,80 @@ void CGLUTWindow::onResize( int width, int height )
 	m_delegateList[glutGetWindow()]->onResize(width, height);
 }
 
-void CGLUTWindow::onUpdate()
+//---------------------------------------------------------------------------
+// Scheduler
+// All deadlines share one GLUT timer, armed for the earliest of them. GLUT
+// timers cannot be cancelled, so arming an earlier one bumps the timer ID
+// and the timer it replaces is ignored when it fires.
+//---------------------------------------------------------------------------
+void CGLUTWindow::postRedisplay()
+{
+	m_redisplayList.insert(m_window);
+	armTimer(m_redisplayTime);
+}
+
+//---------------------------------------------------------------------------
+// Call the delegate's onUpdate in delay ms. An earlier pending update is
+// kept. Delegates that need regular updates schedule the next one from
+// onUpdate.
+//---------------------------------------------------------------------------
+void CGLUTWindow::scheduleUpdate( int delay )
+{
+	int deadline = glutGet(GLUT_ELAPSED_TIME) + (delay > 0 ? delay : 0);
+	auto it = m_updateList.find(m_window);
+	if(it != m_updateList.end() && it->second <= deadline)
+		return;
+	m_updateList[m_window] = deadline;
+	armTimer(deadline);
+}
+
+void CGLUTWindow::armTimer( int deadline )
+{
+	if(m_timerDeadline != -1 && m_timerDeadline <= deadline)
+		return;
+	m_timerDeadline = deadline;
+	int delay = deadline - glutGet(GLUT_ELAPSED_TIME);
+	glutTimerFunc(delay > 0 ? delay : 0, onTimer, ++m_timerId);
+}
+
+void CGLUTWindow::onTimer( int id )
 {
-	for(auto it=m_delegateList.begin(); it!=m_delegateList.end(); it++)
+	if(id != m_timerId)
+		return;
+	m_timerDeadline = -1;
+	int currentTime = glutGet(GLUT_ELAPSED_TIME);
+
+	// Updates that are due. They may schedule more updates or redraws.
+	vector<GLuint> dueList;
+	for(auto it=m_updateList.begin(); it!=m_updateList.end(); it++)
+	{
+		if(it->second <= currentTime)
+			dueList.push_back(it->first);
+	}
+	for(auto it=dueList.begin(); it!=dueList.end(); it++)
+	{
+		m_updateList.erase(*it);
+		glutSetWindow(*it);
+		m_delegateList[*it]->onUpdate();
+	}
+
+	// Redraw every waiting window in the same pass
+	if(!m_redisplayList.empty() && m_redisplayTime <= currentTime)
 	{
-		glutSetWindow(it->first);
-		it->second->onUpdate();
+		for(auto it=m_redisplayList.begin(); it!=m_redisplayList.end(); it++)
+		{
+			glutSetWindow(*it);
+			glutPostRedisplay();
+		}
+		m_redisplayList.clear();
+		m_redisplayTime = currentTime + REDISPLAY_INTERVAL;
 	}
+
+	// Wait for the next deadline
+	for(auto it=m_updateList.begin(); it!=m_updateList.end(); it++)
+		armTimer(it->second);
+	if(!m_redisplayList.empty())
+		armTimer(m_redisplayTime);
 }
 
 void CGLUTWindow::onRender()
@@ -97,3 +176,12 @@ int CGLUTWindow::getWindow()
 {
 	return m_window;
 }
+
+void CGLUTWindow::setTitle( const char* title )
+{
+	int current = glutGetWindow();
+	glutSetWindow(m_window);
+	glutSetWindowTitle(title);
+	if(current != 0)
+		glutSetWindow(current);
+}
@@ -6,11 +6,17 @@
 // GLUT event callbacks are forwarded to a delegate class. GL context is
 // also guranteed to belong to the active GLUT window.
 //
+// There is no idle callback. Delegates are only updated when they schedule
+// an update, and redraws requested through postRedisplay are batched
+// across all windows, so the program sleeps when nothing is happening.
+//
 // Author: Daniel Seah
 /////////////////////////////////////////////////////////////////////////////
 
 #pragma once
 #include <map>
+#include <set>
+#include <vector>
 #include <GL/glew.h>
 #include <GL/glut.h>
 
@@ -26,20 +32,32 @@ private:
 
 	static map<GLuint, IGLUTDelegate*> m_delegateList;
 
+	// Scheduler states
+	static map<GLuint, int> m_updateList;		// Update deadline of each window
+	static set<GLuint> m_redisplayList;			// Windows waiting to be redrawn
+	static int m_redisplayTime;					// Earliest time of the next redraw
+	static int m_timerDeadline, m_timerId;		// Armed timer, -1 if none
+
 public:
 	void setDelegate(IGLUTDelegate* delegate);
 	int getWidth();
 	int getHeight();
 	int getWindow();
+	void setTitle(const char* title);
+	void postRedisplay();
+	void scheduleUpdate(int delay);
 
 	static void onMousePress(int button, int state, int x, int y);
 	static void onMouseMove(int x, int y);
 	static void onKeyPress(unsigned char key, int x, int y);
 	static void onResize(int width, int height);
 	static void onRender();
-	static void onUpdate();
+	static void onTimer(int id);
 
 	CGLUTWindow(const char* name, int width, int height);
 	~CGLUTWindow(void);
+
+private:
+	static void armTimer(int deadline);
 };
 
@@ -4,7 +4,8 @@
 // Delegate interface
 // Classes implementing IGLUTDelgate will receive window events from GLUT.
 // GL context will be set to the active GLUT window sending the event.
-// All event handlers are optional.
+// All event handlers are optional. onUpdate is only called when the
+// delegate schedules it through its window.
 //
 // Author: Daniel Seah
 /////////////////////////////////////////////////////////////////////////////
@@ -15,6 +16,7 @@
 
 IGLUTDelegate::IGLUTDelegate(void)
 {
+	m_window = NULL;
 }
 
 
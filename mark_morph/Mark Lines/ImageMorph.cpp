@@ -12,15 +12,21 @@
 #include "MarkUI.h"
 #include "Renderer.h"
 #include "GLUTWindow.h"
+#include "FrameStore.h"
+#include "ExportJob.h"
 #include <cv.h>
 #include <highgui.h>
+#include <string.h>
 
 using namespace cv;
 
+const char OUTPUT_TITLE[] = "Morphed Image";
+
 CImageMorph::CImageMorph(void)
 {
 	// Init application states
 	m_isConsistent = false;
+	m_isExporting = false;
 
 	// Read image size
 	IplImage *imga = cvLoadImage(IMAGEA);
@@ -58,31 +64,61 @@ CImageMorph::CImageMorph(void)
 	m_windowList.push_back(win);
 
 	// Initialise output window
-	win = new CGLUTWindow("Morphed Image", m_width, m_height);
+	win = new CGLUTWindow(OUTPUT_TITLE, m_width, m_height);
 	m_renderer = new CRenderer(this, m_imageA, m_imageB);
 	m_renderer->setWindow(win);
 	m_windowList.push_back(win);
+	loadWarpParameters();
+
+	// Images never change, so their hash is only computed once
+	IplImage *inImageA = m_imageA->getImage();
+	IplImage *inImageB = m_imageB->getImage();
+	m_imageHashA = hashBytes(inImageA->imageData, inImageA->imageSize);
+	m_imageHashB = hashBytes(inImageB->imageData, inImageB->imageSize);
+
+	// Rendered frames are kept on disk for scrubbing and export
+	m_frameStore = new CFrameStore();
+	m_frameStore->open(FRAMESTORE, m_width, m_height, FRAMERATE*DURATION+1,
+		(__int64)FRAMESTORE_DISK_MB << 20, (__int64)FRAMESTORE_RAM_MB << 20, FRAMESTORE_STATES);
+	m_renderer->setFrameStore(m_frameStore);
+	m_exportJob = new CExportJob();
 
+	// The store still carries the last session's key, which may describe
+	// other images. Key it now, since onLineUpdate leaves it alone while
+	// the line counts differ.
+	bool isReversed;
+	hash64 hash = getInputHash(&isReversed);
+	m_frameStore->setInputHash(hash, isReversed);
 	onLineUpdate();
 
 	// Display user instructions in console window.
 	printf( "Press and hold 'A/D' to control morphing\n" );
 	printf( "Press 'R' to render to file\n" );
+	printf( "Press 'V' to render the reverse morph to file\n" );
+	printf( "Press 'C' to cancel rendering to file\n" );
 	printf( "Press 'T' to morph between faces\n" );
 	printf( "Press 'X' to toggle between blending\n(Cross-dissolve, source only, destination only)\n" );
 	printf( "Press 'L' to show lines\n" );
+	printf( "Press 'P' to select a warp parameter and '[/]' to adjust it\n" );
+	printf( "Press '+/-' in an edit window to zoom at the cursor, 'F' to fit\n" );
+	printf( "Drag with the middle mouse button to pan\n" );
+	printf( "Press 'S' in an edit window to snap points to corners and edges\n" );
 	printf( "Press '0-9' to go to positions\n" );
 	printf( "Press 'Q' to quit.\n\n" );
 }
 
 CImageMorph::~CImageMorph(void)
 {
-	for(auto it=m_windowList.begin(); it!=m_windowList.end(); it++)
-		delete (*it);
-	m_windowList.clear();
+	// The export reads the images and frame store. The views are deleted
+	// while their windows' GL contexts still exist.
+	delete m_exportJob;
 	delete m_renderer;
 	delete m_imageA;
 	delete m_imageB;
+	for(auto it=m_windowList.begin(); it!=m_windowList.end(); it++)
+		delete (*it);
+	m_windowList.clear();
+	delete m_frameStore;
 }
 
 void CImageMorph::run()
@@ -92,6 +128,8 @@ void CImageMorph::run()
 
 void CImageMorph::onLineUpdate()
 {
+	m_renderer->endPreview();
+
 	// Check if we have the same number of lines on both images
 	if(m_imageA->getNumLines() != m_imageB->getNumLines())
 	{
@@ -102,6 +140,84 @@ void CImageMorph::onLineUpdate()
 	m_isConsistent = true;
 	m_outputLineCount = m_imageA->getNumLines();
 	m_renderer->setLines();
+	onRenderUpdate();
+}
+
+//---------------------------------------------------------------------------
+// Called while a point is dragged. The renderer previews the morph without
+// storing frames until the drag ends with onLineUpdate.
+//---------------------------------------------------------------------------
+void CImageMorph::onLineDrag()
+{
+	if(!m_isConsistent)
+		return;
+	m_renderer->requestPreview();
+}
+
+//---------------------------------------------------------------------------
+// Called whenever the renderer inputs change. Stored frames rendered from
+// other inputs are discarded.
+//---------------------------------------------------------------------------
+void CImageMorph::onRenderUpdate()
+{
+	bool isReversed;
+	hash64 hash = getInputHash(&isReversed);
+	m_frameStore->setInputHash(hash, isReversed);
+	m_renderer->startFill();
+}
+
+//---------------------------------------------------------------------------
+// Called when tuned warp parameters are committed. They are kept with the
+// pair, so the next session starts from them.
+//---------------------------------------------------------------------------
+void CImageMorph::onWarpUpdate()
+{
+	saveWarpParameters();
+	onRenderUpdate();
+}
+
+//---------------------------------------------------------------------------
+// Read the warp parameters saved for this pair, one "name value" row per
+// parameter. Missing parameters keep their defaults.
+//---------------------------------------------------------------------------
+void CImageMorph::loadWarpParameters()
+{
+	FILE *file = fopen(WARPFILE, "r");
+	if(file == NULL)
+		return;
+
+	float a, b, p;
+	m_renderer->getWarpParameters(&a, &b, &p);
+	char name[16];
+	float value;
+	while(fscanf(file, "%15s %f", name, &value) == 2)
+	{
+		if(strcmp(name, "a") == 0)
+			a = value;
+		else if(strcmp(name, "b") == 0)
+			b = value;
+		else if(strcmp(name, "p") == 0)
+			p = value;
+	}
+	fclose(file);
+
+	m_renderer->setWarpParameters(a, b, p);
+	printf("Warp parameters from %s: a %.2f, b %.2f, p %.2f\n", WARPFILE, a, b, p);
+}
+
+void CImageMorph::saveWarpParameters()
+{
+	FILE *file = fopen(WARPFILE, "w");
+	if(file == NULL)
+	{
+		fprintf(stderr, "Error: Cannot write %s\n", WARPFILE);
+		return;
+	}
+
+	float a, b, p;
+	m_renderer->getWarpParameters(&a, &b, &p);
+	fprintf(file, "a %.9g\nb %.9g\np %.9g\n", a, b, p);
+	fclose(file);
 }
 
 //---------------------------------------------------------------------------
@@ -143,6 +259,11 @@ void CImageMorph::initGlew()
 		fprintf( stderr, "Error: Framebuffer objects not supported.\n" );
 		extSupported = false;
 	}
+	if ( !GLEW_ARB_shader_texture_lod)
+	{
+		fprintf( stderr, "Error: Shader texture LOD not supported.\n" );
+		extSupported = false;
+	}
 	if ( !extSupported)
 	{
 		char ch; scanf( "%c", &ch ); // Prevents the console window from closing.
@@ -155,31 +276,129 @@ void CImageMorph::forwardKeyPress( unsigned char key, int x, int y )
 	m_renderer->onKeyPress(key, x, y);
 }
 
-void CImageMorph::writeVideo()
+//---------------------------------------------------------------------------
+// Hash everything that affects the rendered frames, including the shader
+// source and the warp parameters it is given.
+//
+// Morphing B to A at t gives the same frame as A to B at 1-t, so the pair
+// is hashed in a canonical order. isReversed is set when the pair had to
+// be swapped, in which case stored frames are read backwards.
+//---------------------------------------------------------------------------
+hash64 CImageMorph::getInputHash(bool* isReversed)
 {
-	printf("\nRendering to %s...\nDo not close window!\n", OUTVIDEO);
-	printf("Width: %d\tHeight: %d\tFrames: %d\tLines: %d\n", m_width, m_height,
-		FRAMERATE*DURATION+1, m_outputLineCount);
+	// Lines are hashed as the renderer last uploaded them, not as edited
+	const float *linesA, *linesB;
+	m_renderer->getUploadedLines(&linesA, &linesB);
+	int numLines = m_renderer->getNumLines();
 
-	int currentTime = glutGet(GLUT_ELAPSED_TIME);
-	CvSize size = Size(m_width, m_height);
-	CvVideoWriter *vidw = cvCreateVideoWriter(OUTVIDEO, CODEC, FRAMERATE, size);
+	hash64 sideA = m_imageHashA;
+	hash64 sideB = m_imageHashB;
+	if(numLines > 0)
+	{
+		sideA = hashBytes(linesA, numLines * 4 * sizeof(float), sideA);
+		sideB = hashBytes(linesB, numLines * 4 * sizeof(float), sideB);
+	}
+
+	*isReversed = sideB < sideA;
+	hash64 hash = *isReversed ? hashBytes(&sideA, sizeof(sideA), sideB) :
+		hashBytes(&sideB, sizeof(sideB), sideA);
+
+	// Source only and destination only swap roles in the reversed pair
+	int blendType = m_renderer->getBlendType();
+	if(*isReversed && blendType != 0)
+		blendType = 3 - blendType;
+
+	hash = hashInt(numLines, hash);
+	hash = hashInt(m_width, hash);
+	hash = hashInt(m_height, hash);
+	hash = hashInt(FRAMERATE, hash);
+	hash = hashInt(DURATION, hash);
+	hash = hashInt(blendType, hash);
+	hash = hashFile(FRAGSHADER, hash);
 
-	char *outputData = new char[m_width * m_height * 3];
-	IplImage *outputImage = cvCreateImageHeader(size, IPL_DEPTH_8U, 3);
+	float a, b, p;
+	m_renderer->getWarpParameters(&a, &b, &p);
+	hash = hashFloat(a, hash);
+	hash = hashFloat(b, hash);
+	hash = hashFloat(p, hash);
+	return hash;
+}
 
-	for(int i=0; i<=FRAMERATE*DURATION; i++)
+//---------------------------------------------------------------------------
+// Export the morph to a video file in the background. The reversed video
+// plays the frames backwards, which for cross-dissolve is the morph from B
+// to A. The export works from a snapshot of the current lines, so editing
+// can go on while it runs.
+//---------------------------------------------------------------------------
+void CImageMorph::writeVideo(bool isReversed)
+{
+	if(m_exportJob->isRunning())
 	{
-		m_renderer->makeMorphImage((float)i / (FRAMERATE*DURATION));
-		m_renderer->getRender(outputData);
-		outputImage->imageData = outputData;
-		outputImage->imageDataOrigin = outputImage->imageData;
-		cvFlip(outputImage, 0);
-		cvWriteFrame(vidw, outputImage);
+		printf("Already rendering to %s, press 'C' to cancel\n", m_exportJob->getFilename());
+		return;
 	}
-	cvReleaseVideoWriter(&vidw);
+	if(!m_isConsistent)
+	{
+		fprintf(stderr, "Error: Both images must have the same number of lines\n");
+		return;
+	}
+
+	CExportJob::Snapshot snapshot;
+	snapshot.imageA = m_imageA->getImage();
+	snapshot.imageB = m_imageB->getImage();
+	m_renderer->getLineSnapshot(&snapshot.linesA, &snapshot.linesB);
+	snapshot.numLines = m_renderer->getNumLines();
+	snapshot.blendType = m_renderer->getBlendType();
+	m_renderer->getWarpParameters(&snapshot.a, &snapshot.b, &snapshot.p);
+	snapshot.inputHash = getInputHash(&snapshot.isStoreReversed);
+
+	const char *filename = isReversed ? OUTVIDEO_REVERSE : OUTVIDEO;
+	if(!m_exportJob->start(filename, snapshot, m_frameStore, isReversed))
+		return;
+	m_isExporting = true;
 
-	float elapsed = (glutGet(GLUT_ELAPSED_TIME) - currentTime) / 1000.0f;
-	printf("Render complete\n");
-	printf("Time taken: %.3f\n\n", elapsed);
+	printf("\nRendering to %s in the background...\n", filename);
+	printf("Width: %d\tHeight: %d\tFrames: %d\tLines: %d\n", m_width, m_height,
+		m_exportJob->getFrameCount(), snapshot.numLines);
+	updateExport();
+}
+
+//---------------------------------------------------------------------------
+// Show the progress of a running export in the output window title, and
+// report it once it has finished. Returns whether it is still running.
+//---------------------------------------------------------------------------
+bool CImageMorph::updateExport()
+{
+	CGLUTWindow *win = m_renderer->getWindow();
+	if(m_exportJob->isRunning())
+	{
+		char title[64];
+		sprintf(title, "%s - Rendering %d/%d", OUTPUT_TITLE,
+			m_exportJob->getFramesDone(), m_exportJob->getFrameCount());
+		win->setTitle(title);
+		return true;
+	}
+
+	if(!m_isExporting)
+		return false;
+	m_isExporting = false;
+	bool isWritten = m_exportJob->wait();
+	win->setTitle(OUTPUT_TITLE);
+
+	if(isWritten)
+		printf("Render complete\n");
+	else if(m_exportJob->isCancelled())
+		printf("Render cancelled\n");
+	else
+		fprintf(stderr, "Error: Cannot render to %s\n", m_exportJob->getFilename());
+	printf("Frames rendered: %d, reused: %d\n", m_exportJob->getFramesRendered(),
+		m_exportJob->getFramesDone() - m_exportJob->getFramesRendered());
+	printf("Time taken: %.3f\n\n", m_exportJob->getElapsed());
+	return false;
+}
+
+void CImageMorph::cancelExport()
+{
+	if(m_exportJob->isRunning())
+		m_exportJob->cancel();
 }
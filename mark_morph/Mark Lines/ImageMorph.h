@@ -10,34 +10,49 @@
 #pragma once
 
 #include <vector>
+#include "hash_util.h"
 
 using namespace std;
 
 class CMarkUI;
 class CRenderer;
 class CGLUTWindow;
+class CFrameStore;
+class CExportJob;
 
 class CImageMorph
 {
 private:
 	CMarkUI *m_imageA, *m_imageB;
 	CRenderer *m_renderer;
+	CFrameStore *m_frameStore;
+	CExportJob *m_exportJob;
 	vector<CGLUTWindow*> m_windowList;
 	
 	// App states
 	int m_width, m_height;
 	bool m_isConsistent;
+	bool m_isExporting;		// Export started and not yet reported
 	int m_outputLineCount;
+	hash64 m_imageHashA, m_imageHashB;
 
 public:
 	void run();
 	void onLineUpdate();
+	void onLineDrag();
+	void onRenderUpdate();
+	void onWarpUpdate();
 	void forwardKeyPress(unsigned char key, int x, int y);
-	void writeVideo();
+	void writeVideo(bool isReversed = false);
+	bool updateExport();
+	void cancelExport();
 
 	CImageMorph(void);
 	~CImageMorph(void);
 
 private:
 	void initGlew();
+	void loadWarpParameters();
+	void saveWarpParameters();
+	hash64 getInputHash(bool* isReversed);
 };
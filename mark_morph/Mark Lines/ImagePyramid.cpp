@@ -0,0 +1,106 @@
+/////////////////////////////////////////////////////////////////////////////
+// File: ImagePyramid.cpp
+//
+// Image pyramid
+// CImagePyramid holds a BGR image and its levels, halved with cvPyrDown
+// down to a single pixel row or column as CMorphKernel builds its
+// pyramids. The edit window draws its image from it and the renderer
+// pages the morph's sources out of it, so each image's pyramid is built
+// and kept in memory once.
+//
+// Levels are copied into textures as square blocks with a border, and
+// blocks are keyed by level and position for caching.
+//
+// Author: Leon Ho
+/////////////////////////////////////////////////////////////////////////////
+
+#include "ImagePyramid.h"
+#include <algorithm>
+#include <string.h>
+
+CImagePyramid::CImagePyramid(void)
+{
+}
+
+CImagePyramid::~CImagePyramid(void)
+{
+	release();
+}
+
+//---------------------------------------------------------------------------
+// Build the pyramid of a BGR image. The image itself is level 0 and must
+// outlive this object.
+//---------------------------------------------------------------------------
+bool CImagePyramid::init( const IplImage* image )
+{
+	release();
+	if(image == NULL || image->nChannels != 3)
+		return false;
+
+	IplImage* src = const_cast<IplImage*>(image);
+	m_levelList.push_back(src);
+	while(src->width > 1 && src->height > 1)
+	{
+		IplImage* dst = cvCreateImage(cvSize((src->width + 1) / 2, (src->height + 1) / 2),
+			src->depth, src->nChannels);
+		cvPyrDown(src, dst);
+		m_levelList.push_back(dst);
+		src = dst;
+	}
+	return true;
+}
+
+void CImagePyramid::release()
+{
+	for(int i=1; i<(int)m_levelList.size(); i++)
+		cvReleaseImage(&m_levelList[i]);
+	m_levelList.clear();
+}
+
+int CImagePyramid::getLevelCount()
+{
+	return m_levelList.size();
+}
+
+const IplImage* CImagePyramid::getLevel( int level )
+{
+	return m_levelList[level];
+}
+
+//---------------------------------------------------------------------------
+// Copy a size x size block of a level, whose first pixel is (x0, y0), into
+// data as packed BGR rows. The block must overlap the level. Pixels past the level's edges repeat the edge
+// pixels, so filtering at the image border matches a single clamped
+// texture.
+//---------------------------------------------------------------------------
+void CImagePyramid::copyBlock( int level, int x0, int y0, int size, unsigned char* data )
+{
+	const IplImage* image = m_levelList[level];
+	int copyX0 = max(x0, 0);
+	int copyX1 = min(x0 + size, image->width);
+
+	for(int r=0; r<size; r++)
+	{
+		int sy = min(max(y0 + r, 0), image->height - 1);
+		const unsigned char* src = (const unsigned char*)image->imageData + sy * image->widthStep;
+		unsigned char* dst = data + r * size * 3;
+
+		for(int c=0; c<copyX0-x0; c++)
+			memcpy(dst + c*3, src, 3);
+		memcpy(dst + (copyX0-x0)*3, src + copyX0*3, (copyX1-copyX0)*3);
+		for(int c=copyX1-x0; c<size; c++)
+			memcpy(dst + c*3, src + (image->width-1)*3, 3);
+	}
+}
+
+long long CImagePyramid::getKey( int level, int blockX, int blockY )
+{
+	return ((long long)level << 48) | ((long long)blockY << 24) | blockX;
+}
+
+void CImagePyramid::splitKey( long long key, int* level, int* blockX, int* blockY )
+{
+	*level = (int)(key >> 48);
+	*blockY = (int)((key >> 24) & 0xFFFFFF);
+	*blockX = (int)(key & 0xFFFFFF);
+}
@@ -0,0 +1,41 @@
+/////////////////////////////////////////////////////////////////////////////
+// File: ImagePyramid.h
+//
+// Image pyramid
+// CImagePyramid holds a BGR image and its levels, halved with cvPyrDown
+// down to a single pixel row or column as CMorphKernel builds its
+// pyramids. The edit window draws its image from it and the renderer
+// pages the morph's sources out of it, so each image's pyramid is built
+// and kept in memory once.
+//
+// Levels are copied into textures as square blocks with a border, and
+// blocks are keyed by level and position for caching.
+//
+// Author: Leon Ho
+/////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <vector>
+#include <cv.h>
+
+using namespace std;
+
+class CImagePyramid
+{
+private:
+	vector<IplImage*> m_levelList;	// Finest first; level 0 is the caller's image
+
+public:
+	bool init(const IplImage* image);
+	void release();
+	int getLevelCount();
+	const IplImage* getLevel(int level);
+	void copyBlock(int level, int x0, int y0, int size, unsigned char* data);
+
+	static long long getKey(int level, int blockX, int blockY);
+	static void splitKey(long long key, int* level, int* blockX, int* blockY);
+
+	CImagePyramid(void);
+	~CImagePyramid(void);
+};
@@ -0,0 +1,291 @@
+/////////////////////////////////////////////////////////////////////////////
+// File: LineGraph.cpp
+//
+// Editable line set
+// CLineGraph stores the vertices and lines being edited as dense vertex
+// and index buffers, ready to be packed for GPU upload or saved, together
+// with the lines using each vertex. Vertices and lines are referred to by
+// IDs that stay valid until they are removed. A removed vertex's slot is
+// taken by the last vertex, costing O(1) plus its degree. Lines keep their
+// order, since the lines of the two images are paired by line number, so
+// the lines after a removed line each move down a slot. Vertices that
+// lose their last line are removed with it.
+//
+// A spatial index over the vertices that have lines is kept in step for
+// hit testing. The range of line slots changed since the lines were last
+// packed is tracked, so packing only rewrites that range.
+//
+// Author: Leon Ho
+/////////////////////////////////////////////////////////////////////////////
+
+#include "LineGraph.h"
+#include <algorithm>
+
+CLineGraph::CLineGraph( float cellSize )
+	: m_index(cellSize)
+{
+	m_dirtyBegin = m_dirtyEnd = 0;
+}
+
+CLineGraph::~CLineGraph(void)
+{
+}
+
+void CLineGraph::clear()
+{
+	m_vertexBuffer.clear();
+	m_indexBuffer.clear();
+	m_vertexLines.clear();
+	m_vertexId.clear();
+	m_lineId.clear();
+	m_vertexSlot.clear();
+	m_lineSlot.clear();
+	m_freeVertexIds.clear();
+	m_freeLineIds.clear();
+	m_index.clear();
+	m_dirtyBegin = m_dirtyEnd = 0;
+}
+
+//---------------------------------------------------------------------------
+// Load buffers as saved. IDs start out equal to slots. Vertices no line
+// uses are dropped.
+//---------------------------------------------------------------------------
+void CLineGraph::setBuffers( const vector<CvPoint2D32f>& vertices, const vector<LineIndex>& lines )
+{
+	clear();
+	for(auto it=vertices.begin(); it!=vertices.end(); it++)
+		addVertex(it->x, it->y);
+	for(auto it=lines.begin(); it!=lines.end(); it++)
+		addLine(it->start, it->end);
+	for(int i=vertices.size()-1; i>=0; i--)
+		collectVertex(i);
+}
+
+int CLineGraph::allocId( vector<int>* slots, vector<int>* freeIds, int slot )
+{
+	int id;
+	if(!freeIds->empty())
+	{
+		id = freeIds->back();
+		freeIds->pop_back();
+		(*slots)[id] = slot;
+	}
+	else
+	{
+		id = slots->size();
+		slots->push_back(slot);
+	}
+	return id;
+}
+
+//---------------------------------------------------------------------------
+// Vertices
+//---------------------------------------------------------------------------
+int CLineGraph::addVertex( float x, float y )
+{
+	CvPoint2D32f pt; pt.x = x; pt.y = y;
+	int slot = m_vertexBuffer.size();
+	int id = allocId(&m_vertexSlot, &m_freeVertexIds, slot);
+	m_vertexBuffer.push_back(pt);
+	m_vertexId.push_back(id);
+	m_vertexLines.push_back(vector<int>());
+	return id;
+}
+
+void CLineGraph::moveVertex( int id, float x, float y )
+{
+	if(!isVertex(id))
+		return;
+	CvPoint2D32f& pt = m_vertexBuffer[m_vertexSlot[id]];
+	pt.x = x;
+	pt.y = y;
+	m_index.moveVertex(id, x, y);
+
+	const vector<int>& lines = m_vertexLines[m_vertexSlot[id]];
+	for(auto it=lines.begin(); it!=lines.end(); it++)
+		markDirty(m_lineSlot[*it]);
+}
+
+//---------------------------------------------------------------------------
+// Removes the vertex, its lines, and any neighbours left without lines.
+//---------------------------------------------------------------------------
+void CLineGraph::removeVertex( int id )
+{
+	if(!isVertex(id))
+		return;
+	while(isVertex(id) && !m_vertexLines[m_vertexSlot[id]].empty())
+		removeLine(m_vertexLines[m_vertexSlot[id]].back());
+	if(isVertex(id))
+		removeVertexSlot(id);
+}
+
+//---------------------------------------------------------------------------
+// Remove a vertex if no line uses it
+//---------------------------------------------------------------------------
+bool CLineGraph::collectVertex( int id )
+{
+	if(!isVertex(id) || !m_vertexLines[m_vertexSlot[id]].empty())
+		return false;
+	removeVertexSlot(id);
+	return true;
+}
+
+//---------------------------------------------------------------------------
+// Move the last vertex into the freed slot and repoint its lines.
+//---------------------------------------------------------------------------
+void CLineGraph::removeVertexSlot( int id )
+{
+	int slot = m_vertexSlot[id];
+	int last = m_vertexBuffer.size() - 1;
+	if(slot != last)
+	{
+		int lastId = m_vertexId[last];
+		m_vertexBuffer[slot] = m_vertexBuffer[last];
+		m_vertexId[slot] = lastId;
+		m_vertexSlot[lastId] = slot;
+		m_vertexLines[slot].swap(m_vertexLines[last]);
+
+		const vector<int>& lines = m_vertexLines[slot];
+		for(auto it=lines.begin(); it!=lines.end(); it++)
+		{
+			LineIndex& line = m_indexBuffer[m_lineSlot[*it]];
+			if(line.start == last)
+				line.start = slot;
+			if(line.end == last)
+				line.end = slot;
+		}
+	}
+	m_vertexBuffer.pop_back();
+	m_vertexId.pop_back();
+	m_vertexLines.pop_back();
+
+	m_vertexSlot[id] = -1;
+	m_freeVertexIds.push_back(id);
+	m_index.removeVertex(id);
+}
+
+//---------------------------------------------------------------------------
+// Lines
+//---------------------------------------------------------------------------
+int CLineGraph::addLine( int start, int end )
+{
+	if(!isVertex(start) || !isVertex(end))
+		return -1;
+
+	LineIndex line;
+	line.start = m_vertexSlot[start];
+	line.end = m_vertexSlot[end];
+	int slot = m_indexBuffer.size();
+	int id = allocId(&m_lineSlot, &m_freeLineIds, slot);
+	m_indexBuffer.push_back(line);
+	m_lineId.push_back(id);
+	markDirty(slot);
+
+	// Vertices are hit tested once they have a line
+	m_vertexLines[line.start].push_back(id);
+	if(end != start)
+		m_vertexLines[line.end].push_back(id);
+	const CvPoint2D32f& ptA = m_vertexBuffer[line.start];
+	const CvPoint2D32f& ptB = m_vertexBuffer[line.end];
+	m_index.insertVertex(start, ptA.x, ptA.y);
+	m_index.insertVertex(end, ptB.x, ptB.y);
+	return id;
+}
+
+//---------------------------------------------------------------------------
+// The lines after the removed line move down a slot, in order, so each
+// keeps its place relative to the others whatever order lines are removed
+// in. Endpoints left without lines are removed.
+//---------------------------------------------------------------------------
+void CLineGraph::removeLine( int id )
+{
+	if(id < 0 || id >= (int)m_lineSlot.size() || m_lineSlot[id] == -1)
+		return;
+
+	int slot = m_lineSlot[id];
+	LineIndex line = m_indexBuffer[slot];
+	int ends[2] = {m_vertexId[line.start], m_vertexId[line.end]};
+
+	m_indexBuffer.erase(m_indexBuffer.begin() + slot);
+	m_lineId.erase(m_lineId.begin() + slot);
+	for(int i=slot; i<(int)m_lineId.size(); i++)
+	{
+		m_lineSlot[m_lineId[i]] = i;
+		markDirty(i);
+	}
+	m_lineSlot[id] = -1;
+	m_freeLineIds.push_back(id);
+
+	for(int i=0; i<2; i++)
+	{
+		vector<int>& lines = m_vertexLines[m_vertexSlot[ends[i]]];
+		auto it = find(lines.begin(), lines.end(), id);
+		if(it != lines.end())
+		{
+			*it = lines.back();
+			lines.pop_back();
+		}
+	}
+	collectVertex(ends[0]);
+	collectVertex(ends[1]);
+}
+
+//---------------------------------------------------------------------------
+// Accessors
+//---------------------------------------------------------------------------
+bool CLineGraph::isVertex( int id )
+{
+	return id >= 0 && id < (int)m_vertexSlot.size() && m_vertexSlot[id] != -1;
+}
+
+const vector<CvPoint2D32f>& CLineGraph::getVertexBuffer()
+{
+	return m_vertexBuffer;
+}
+
+const vector<LineIndex>& CLineGraph::getIndexBuffer()
+{
+	return m_indexBuffer;
+}
+
+//---------------------------------------------------------------------------
+// Lines are packed as (start.x, start.y, end.x, end.y). Only the slots
+// changed since the last pack are rewritten; they are returned as
+// [begin, end), which is empty if nothing changed. Resizing keeps the
+// buffer's storage unless the lines outgrow it.
+//---------------------------------------------------------------------------
+void CLineGraph::packLines( vector<float>* packedLine, int* begin, int* end )
+{
+	int numLines = m_indexBuffer.size();
+	packedLine->resize(numLines * 4);
+	*begin = min(m_dirtyBegin, numLines);
+	*end = min(m_dirtyEnd, numLines);
+	for(int i=*begin; i<*end; i++)
+	{
+		const CvPoint2D32f& ptA = m_vertexBuffer[m_indexBuffer[i].start];
+		const CvPoint2D32f& ptB = m_vertexBuffer[m_indexBuffer[i].end];
+		float* packed = &(*packedLine)[i * 4];
+		packed[0] = ptA.x;
+		packed[1] = ptA.y;
+		packed[2] = ptB.x;
+		packed[3] = ptB.y;
+	}
+	m_dirtyBegin = m_dirtyEnd = 0;
+}
+
+void CLineGraph::markDirty( int slot )
+{
+	if(m_dirtyBegin == m_dirtyEnd)
+	{
+		m_dirtyBegin = slot;
+		m_dirtyEnd = slot + 1;
+		return;
+	}
+	m_dirtyBegin = min(m_dirtyBegin, slot);
+	m_dirtyEnd = max(m_dirtyEnd, slot + 1);
+}
+
+int CLineGraph::nearestVertex( float x, float y, float radius )
+{
+	return m_index.nearestVertex(x, y, radius);
+}
@@ -0,0 +1,73 @@
+/////////////////////////////////////////////////////////////////////////////
+// File: LineGraph.h
+//
+// Editable line set
+// CLineGraph stores the vertices and lines being edited as dense vertex
+// and index buffers, ready to be packed for GPU upload or saved, together
+// with the lines using each vertex. Vertices and lines are referred to by
+// IDs that stay valid until they are removed. A removed vertex's slot is
+// taken by the last vertex, costing O(1) plus its degree. Lines keep their
+// order, since the lines of the two images are paired by line number, so
+// the lines after a removed line each move down a slot. Vertices that
+// lose their last line are removed with it.
+//
+// A spatial index over the vertices that have lines is kept in step for
+// hit testing. The range of line slots changed since the lines were last
+// packed is tracked, so packing only rewrites that range.
+//
+// Author: Leon Ho
+/////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <vector>
+#include <cv.h>
+#include "line_io.h"
+#include "SpatialIndex.h"
+
+using namespace std;
+
+class CLineGraph
+{
+private:
+	vector<CvPoint2D32f> m_vertexBuffer;	// By vertex slot
+	vector<LineIndex> m_indexBuffer;		// By line slot, holding vertex slots
+	vector< vector<int> > m_vertexLines;	// IDs of the lines using each vertex slot
+
+	vector<int> m_vertexId, m_lineId;		// ID held in each slot
+	vector<int> m_vertexSlot, m_lineSlot;	// Slot of each ID, -1 if free
+	vector<int> m_freeVertexIds, m_freeLineIds;
+
+	CSpatialIndex m_index;
+	int m_dirtyBegin, m_dirtyEnd;			// Line slots changed since the last pack
+
+public:
+	void clear();
+	void setBuffers(const vector<CvPoint2D32f>& vertices, const vector<LineIndex>& lines);
+
+	int addVertex(float x, float y);
+	void moveVertex(int id, float x, float y);
+	void removeVertex(int id);
+	bool collectVertex(int id);
+
+	int addLine(int start, int end);
+	void removeLine(int id);
+
+	bool isVertex(int id);
+
+	// Buffers in slot order, for drawing, packing and saving
+	const vector<CvPoint2D32f>& getVertexBuffer();
+	const vector<LineIndex>& getIndexBuffer();
+	void packLines(vector<float>* packedLine, int* begin, int* end);
+
+	// Hit test, returning the ID of the nearest vertex with lines
+	int nearestVertex(float x, float y, float radius);
+
+	CLineGraph(float cellSize);
+	~CLineGraph(void);
+
+private:
+	int allocId(vector<int>* slots, vector<int>* freeIds, int slot);
+	void removeVertexSlot(int id);
+	void markDirty(int slot);
+};
@@ -0,0 +1,188 @@
+/////////////////////////////////////////////////////////////////////////////
+// File: LruCache.h
+//
+// Thread-safe LRU cache
+// CLruCache maps keys to values and evicts the least recently used
+// entries once the total size of its entries exceeds its capacity. Sizes
+// are given by the caller, e.g. in bytes. Values are copied in and out,
+// so large values should be held by shared_ptr to keep evicted entries
+// alive while they are still in use.
+//
+// Author: Leon Ho
+/////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <windows.h>
+#include <list>
+#include <map>
+
+using namespace std;
+
+template<class Key, class Value>
+class CLruCache
+{
+private:
+	struct Item
+	{
+		Value value;
+		size_t size;
+		typename list<Key>::iterator order;
+	};
+
+private:
+	map<Key, Item> m_itemList;
+	list<Key> m_order;			// Most recently used first
+	size_t m_capacity, m_size;
+	int m_hits, m_misses;
+	CRITICAL_SECTION m_lock;
+
+public:
+	bool find(const Key& key, Value* value);
+	void insert(const Key& key, const Value& value, size_t size);
+	void erase(const Key& key);
+	void clear();
+	void setCapacity(size_t capacity);
+
+	size_t getSize();
+	int getCount();
+	int getHits();
+	int getMisses();
+
+	CLruCache(size_t capacity);
+	~CLruCache(void);
+
+private:
+	void evict();
+};
+
+template<class Key, class Value>
+CLruCache<Key, Value>::CLruCache( size_t capacity )
+{
+	m_capacity = capacity;
+	m_size = 0;
+	m_hits = m_misses = 0;
+	InitializeCriticalSection(&m_lock);
+}
+
+template<class Key, class Value>
+CLruCache<Key, Value>::~CLruCache(void)
+{
+	DeleteCriticalSection(&m_lock);
+}
+
+template<class Key, class Value>
+bool CLruCache<Key, Value>::find( const Key& key, Value* value )
+{
+	EnterCriticalSection(&m_lock);
+	auto it = m_itemList.find(key);
+	if(it == m_itemList.end())
+	{
+		m_misses++;
+		LeaveCriticalSection(&m_lock);
+		return false;
+	}
+
+	// Move to the front of the usage list
+	m_order.splice(m_order.begin(), m_order, it->second.order);
+	*value = it->second.value;
+	m_hits++;
+	LeaveCriticalSection(&m_lock);
+	return true;
+}
+
+template<class Key, class Value>
+void CLruCache<Key, Value>::insert( const Key& key, const Value& value, size_t size )
+{
+	EnterCriticalSection(&m_lock);
+	auto it = m_itemList.find(key);
+	if(it != m_itemList.end())
+	{
+		m_size -= it->second.size;
+		m_order.erase(it->second.order);
+		m_itemList.erase(it);
+	}
+
+	m_order.push_front(key);
+	Item& item = m_itemList[key];
+	item.value = value;
+	item.size = size;
+	item.order = m_order.begin();
+	m_size += size;
+
+	evict();
+	LeaveCriticalSection(&m_lock);
+}
+
+template<class Key, class Value>
+void CLruCache<Key, Value>::erase( const Key& key )
+{
+	EnterCriticalSection(&m_lock);
+	auto it = m_itemList.find(key);
+	if(it != m_itemList.end())
+	{
+		m_size -= it->second.size;
+		m_order.erase(it->second.order);
+		m_itemList.erase(it);
+	}
+	LeaveCriticalSection(&m_lock);
+}
+
+template<class Key, class Value>
+void CLruCache<Key, Value>::clear()
+{
+	EnterCriticalSection(&m_lock);
+	m_itemList.clear();
+	m_order.clear();
+	m_size = 0;
+	LeaveCriticalSection(&m_lock);
+}
+
+template<class Key, class Value>
+void CLruCache<Key, Value>::setCapacity( size_t capacity )
+{
+	EnterCriticalSection(&m_lock);
+	m_capacity = capacity;
+	evict();
+	LeaveCriticalSection(&m_lock);
+}
+
+//---------------------------------------------------------------------------
+// The most recently inserted entry is always kept, even if it is larger
+// than the whole cache.
+//---------------------------------------------------------------------------
+template<class Key, class Value>
+void CLruCache<Key, Value>::evict()
+{
+	while(m_size > m_capacity && m_order.size() > 1)
+	{
+		auto it = m_itemList.find(m_order.back());
+		m_size -= it->second.size;
+		m_itemList.erase(it);
+		m_order.pop_back();
+	}
+}
+
+template<class Key, class Value>
+size_t CLruCache<Key, Value>::getSize()
+{
+	return m_size;
+}
+
+template<class Key, class Value>
+int CLruCache<Key, Value>::getCount()
+{
+	return m_itemList.size();
+}
+
+template<class Key, class Value>
+int CLruCache<Key, Value>::getHits()
+{
+	return m_hits;
+}
+
+template<class Key, class Value>
+int CLruCache<Key, Value>::getMisses()
+{
+	return m_misses;
+}
@@ -14,30 +14,54 @@
 #include "constants.h"
 #include <GL/glew.h>
 #include <GL/glut.h>
-#include "gltext.h"
 #include "shader_util.h"
 #include "GLUTWindow.h"
+#include "PointGrid.h"
+#include <algorithm>
+
+const float INDEX_CELL_SIZE = 16;	// Hit test grid cell size in image pixels
+const float HIT_RADIUS = 5;			// Hit test radius in window pixels
+const float SNAP_RADIUS = 8;		// Feature snapping radius in window pixels
+const float ZOOM_STEP = 1.25f;		// Zoom factor per key press or wheel step
+const float MAX_PIXEL_SCALE = 32;	// Most window pixels per image pixel
+const int MOUSE_WHEEL_UP = 3;		// Wheel steps are reported as buttons by freeglut
+const int MOUSE_WHEEL_DOWN = 4;
 
 CMarkUI::CMarkUI(CImageMorph *app, const char* filename)
+	: m_lines(INDEX_CELL_SIZE)
 {
 	m_app = app;
 	m_isModified = true;
+	m_isOverlayDirty = true;
+	m_uploadBegin = m_uploadEnd = 0;
 	m_prevVertex = -1;
 	m_dragPoint = -1;
+	m_zoom = 1;
 	m_imgScale = 1;
+	m_offsetX = m_offsetY = 0;
+	m_isPanning = false;
+	m_panX = m_panY = 0;
+	m_isSnapping = false;
 
 	strcpy(m_imgFilename, filename);
 	m_inImage = cvLoadImage(m_imgFilename, CV_LOAD_IMAGE_UNCHANGED);
+	m_imageHash = hashBytes(m_inImage->imageData, m_inImage->imageSize);
 	cvFlip(m_inImage);
 	m_imgWidth = m_inImage->width;
 	m_imgHeight = m_inImage->height;
+	m_viewX = m_imgWidth / 2.0f;
+	m_viewY = m_imgHeight / 2.0f;
 
 	string fn = filename;
-	string lineFilename = fn.substr(0, fn.find_last_of(".")).append(".mld");
+	string lineFilename = fn.substr(0, fn.find_last_of(".")).append(LINEFILE_BINARY_EXT);
 	strcpy(m_lineFilename, lineFilename.c_str());
 
 	initGLState();
-	initTexture();
+	m_pyramid.init(m_inImage);
+	m_tiles.init(&m_pyramid);
+	m_snap.init(m_inImage);
+	if(!m_overlay.init(GLUT_BITMAP_9_BY_15))
+		fprintf(stderr, "Error: Line numbers in %s are drawn without the glyph atlas\n", m_imgFilename);
 
 	loadLines();
 }
@@ -46,6 +70,10 @@ CMarkUI::~CMarkUI(void)
 {
 	saveLines();
 	cvReleaseImage(&m_inImage);
+
+	// The overlay frees its GL objects in this window's context
+	if(m_window != NULL)
+		glutSetWindow(m_window->getWindow());
 }
 
 void CMarkUI::initGLState()
@@ -63,47 +91,45 @@ void CMarkUI::initGLState()
 	glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
 }
 
-//---------------------------------------------------------------------------
-// Upload both face images and line information to GPU
-//---------------------------------------------------------------------------
-void CMarkUI::initTexture()
-{
-	// Create texture image
-	glGenTextures( 1, &m_image );
-	glBindTexture( GL_TEXTURE_2D, m_image );
-	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR );
-	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
-	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP );
-	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP );
-	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-	glTexImage2D( GL_TEXTURE_2D, 0, GL_RGB,
-		m_inImage->width, m_inImage->height, 0, GL_BGR, GL_UNSIGNED_BYTE, m_inImage->imageData);
-	printOpenGLError();
-
-	glBindTexture(GL_TEXTURE_2D, 0);
-};
-
 float* CMarkUI::getPackedLine()
 {
-	if(m_indexBuffer.size() <= 0)
+	if(m_lines.getIndexBuffer().size() <= 0)
 		return NULL;
 	if(!m_isModified)
 		return &m_packedLine[0];
 
-	// Pack lines for openGL upload
-	m_packedLine.clear();
-	for(auto it=m_indexBuffer.begin(); it!=m_indexBuffer.end(); it++)
+	// Pack changed lines for openGL upload
+	int begin, end;
+	m_lines.packLines(&m_packedLine, &begin, &end);
+	if(begin < end)
 	{
-		m_packedLine.push_back(m_vertexBuffer[it->start].x);
-		m_packedLine.push_back(m_vertexBuffer[it->start].y);
-		m_packedLine.push_back(m_vertexBuffer[it->end].x);
-		m_packedLine.push_back(m_vertexBuffer[it->end].y);
+		if(m_uploadBegin == m_uploadEnd)
+		{
+			m_uploadBegin = begin;
+			m_uploadEnd = end;
+		}
+		else
+		{
+			m_uploadBegin = min(m_uploadBegin, begin);
+			m_uploadEnd = max(m_uploadEnd, end);
+		}
 	}
 
 	m_isModified = false;
 	return &m_packedLine[0];
 }
 
+//---------------------------------------------------------------------------
+// Range of packed lines changed since this was last called, as
+// [begin, end). Call after getPackedLine.
+//---------------------------------------------------------------------------
+void CMarkUI::getDirtyLines( int* begin, int* end )
+{
+	*begin = min(m_uploadBegin, getNumLines());
+	*end = min(m_uploadEnd, getNumLines());
+	m_uploadBegin = m_uploadEnd = 0;
+}
+
 char* CMarkUI::getImageData()
 {
 	return m_inImage->imageData;
@@ -111,73 +137,125 @@ char* CMarkUI::getImageData()
 
 int CMarkUI::getNumLines()
 {
-	return m_indexBuffer.size();
+	return m_lines.getIndexBuffer().size();
 }
 
+//---------------------------------------------------------------------------
+// Lines are read from the binary line file if there is one, otherwise
+// from the legacy .mld file. They are always saved as binary. Loading
+// replaces any lines being edited.
+//---------------------------------------------------------------------------
 void CMarkUI::loadLines()
 {
-	float ax, ay, bx, by;
+	LineSet lineSet;
+	string lineFilename = getLineFilename(m_imgFilename);
+	if(!readLineSet(lineFilename.c_str(), &lineSet))
+		return;
+	if(lineSet.imageHash != 0 && lineSet.imageHash != m_imageHash)
+		fprintf(stderr, "Warning: %s was marked on a different image\n", lineFilename.c_str());
 
-	// Read image lines
-	FILE* lineFile = fopen(m_lineFilename, "r");
-	if(lineFile == NULL)
+	// Binary files hold the buffers as they were edited
+	if(lineFilename.compare(lineFilename.find_last_of("."), string::npos, LINEFILE_BINARY_EXT) == 0)
+	{
+		for(auto it=lineSet.vertices.begin(); it!=lineSet.vertices.end(); it++)
+			it->y = m_inImage->height - it->y;	// Inverts y dimension to match openGL format
+		m_lines.setBuffers(lineSet.vertices, lineSet.lines);
 		return;
-	while(fscanf(lineFile, "%f %f %f %f", &ax, &ay, &bx, &by) != EOF)
+	}
+
+	// Weld line ends to vertices within radius 1, searching the vertices of
+	// the lines added so far in the order they were added
+	vector<CvPoint2D32f> vertexBuffer;
+	vector<Line2D> indexBuffer;
+	CPointGrid grid(1);
+	for(auto it=lineSet.lines.begin(); it!=lineSet.lines.end(); it++)
 	{
-		ay = m_inImage->height - ay;	// Inverts y dimension to match openGL format
-		by = m_inImage->height - by;
-		int ptAIndex = searchPoint(ax, ay, 1);
-		if(ptAIndex <= -1)
+		float ax = lineSet.vertices[it->start].x;
+		float ay = m_inImage->height - lineSet.vertices[it->start].y;	// Inverts y dimension to match openGL format
+		float bx = lineSet.vertices[it->end].x;
+		float by = m_inImage->height - lineSet.vertices[it->end].y;
+		int ptAIndex = grid.searchPoint(ax, ay, 1);
+		bool isNewA = ptAIndex <= -1;
+		if(isNewA)
 		{
 			CvPoint2D32f pt; pt.x = ax; pt.y = ay;
-			m_vertexBuffer.push_back(pt);
-			ptAIndex = m_vertexBuffer.size() - 1;
+			vertexBuffer.push_back(pt);
+			ptAIndex = vertexBuffer.size() - 1;
 		}
-		int ptBIndex = searchPoint(bx, by, 1);
-		if(ptBIndex <= -1)
+		int ptBIndex = grid.searchPoint(bx, by, 1);
+		bool isNewB = ptBIndex <= -1;
+		if(isNewB)
 		{
 			CvPoint2D32f pt; pt.x = bx; pt.y = by;
-			m_vertexBuffer.push_back(pt);
-			ptBIndex = m_vertexBuffer.size() - 1;
+			vertexBuffer.push_back(pt);
+			ptBIndex = vertexBuffer.size() - 1;
 		}
 		Line2D line; line.start = ptAIndex; line.end = ptBIndex;
-		m_indexBuffer.push_back(line);
+		indexBuffer.push_back(line);
+
+		// New vertices become searchable once their line is added
+		if(isNewA)
+			grid.insert(ptAIndex, ax, ay);
+		if(isNewB)
+			grid.insert(ptBIndex, bx, by);
 	}
-	fclose(lineFile);
+	m_lines.setBuffers(vertexBuffer, indexBuffer);
 }
 
 void CMarkUI::saveLines()
 {
-	float ax, ay, bx, by;
-	FILE* lineFile = fopen(m_lineFilename, "w");
-	for(auto it=m_indexBuffer.begin(); it!=m_indexBuffer.end(); it++)
-	{
-		ax = m_vertexBuffer[it->start].x;
-		ay = m_inImage->height - m_vertexBuffer[it->start].y;
-		bx = m_vertexBuffer[it->end].x;
-		by = m_inImage->height - m_vertexBuffer[it->end].y;
-		fprintf(lineFile, "%f %f %f %f\n", ax, ay, bx, by);
-	}
-	fclose(lineFile);
+	LineSet lineSet;
+	lineSet.vertices = m_lines.getVertexBuffer();
+	for(auto it=lineSet.vertices.begin(); it!=lineSet.vertices.end(); it++)
+		it->y = m_inImage->height - it->y;
+	lineSet.lines = m_lines.getIndexBuffer();
+	lineSet.imageHash = m_imageHash;
+	lineSet.imageWidth = m_inImage->width;
+	lineSet.imageHeight = m_inImage->height;
+	writeLineSet(m_lineFilename, lineSet);
 }
 
 void CMarkUI::onMousePress( int button, int state, int x, int y )
 {
 	int currPtIndex;
-	vector<int> adjacentLines;
 
-	// Convert point to image space
-	int winWidth = m_window->getWidth();
-	int winHeight = m_window->getHeight();
-	int leftBorder = (m_window->getWidth() - m_imgScale * m_imgWidth) / 2.0f;
-	int bottomBorder = (m_window->getHeight() - m_imgScale * m_imgHeight) / 2.0f;
-	x = (x - leftBorder) / m_imgScale;
-	y = (y - bottomBorder) / m_imgScale;
-	y = m_imgHeight - y;
-
-	// Check if click is within image
-	if(x < 0 || x >= m_imgWidth || y < 0 || y >= m_imgHeight)
+	// Pan with the middle button and zoom with the wheel
+	if(button == GLUT_MIDDLE_BUTTON)
+	{
+		m_isPanning = state == GLUT_DOWN;
+		m_panX = x;
+		m_panY = y;
+		return;
+	}
+	if(button == MOUSE_WHEEL_UP || button == MOUSE_WHEEL_DOWN)
+	{
+		if(state == GLUT_DOWN)
+			zoomAt(x, y, button == MOUSE_WHEEL_UP ? ZOOM_STEP : 1 / ZOOM_STEP);
+		return;
+	}
+
+	// Convert point to image space. Points are placed to a fraction of a
+	// pixel when zoomed in, and hit tests cover the same window area at any
+	// zoom.
+	float imageX, imageY;
+	toImage(x, y, &imageX, &imageY);
+	float radius = HIT_RADIUS / m_imgScale;
+
+	// Check if click is within image. A drag released off the image still
+	// ends there, so its preview is committed.
+	if(imageX < 0 || imageX >= m_imgWidth || imageY < 0 || imageY >= m_imgHeight)
+	{
+		if(button == GLUT_LEFT_BUTTON && state == GLUT_UP)
+		{
+			m_isLeftMouseDown = false;
+			if(m_dragPoint != -1)
+			{
+				m_dragPoint = -1;
+				m_app->onLineUpdate();
+			}
+		}
 		return;
+	}
 
 	if(button == GLUT_LEFT_BUTTON && state == GLUT_UP)
 	{
@@ -187,142 +265,178 @@ void CMarkUI::onMousePress( int button, int state, int x, int y )
 		m_dragPoint = -1;
 
 		// Add new point if it is sufficiently far
-		currPtIndex = searchPoint(x, y, 5);
+		currPtIndex = searchPoint(imageX, imageY, radius);
 		if(currPtIndex == -1)
 		{
-			CvPoint2D32f pt; pt.x = x; pt.y = y;
-			m_vertexBuffer.push_back(pt);
-			currPtIndex = m_vertexBuffer.size() - 1;
+			snapPoint(&imageX, &imageY);
+			currPtIndex = m_lines.addVertex(imageX, imageY);
 		}
 
 		// Add line segment
 		if(currPtIndex == m_prevVertex)
 			return;
 		if(m_prevVertex != -1)
-		{
-			Line2D line; line.start = m_prevVertex, line.end = currPtIndex;
-			m_indexBuffer.push_back(line);
-		}
+			m_lines.addLine(m_prevVertex, currPtIndex);
 		m_prevVertex = currPtIndex;
 
 		// Inform app of line change
 		m_isModified = true;
+		m_isOverlayDirty = true;
 		m_app->onLineUpdate();
-		glutSetWindow(m_window->getWindow());
-		glutPostRedisplay();
+		m_window->postRedisplay();
 	} else if(button == GLUT_LEFT_BUTTON && state == GLUT_DOWN)
 	{
 		m_isLeftMouseDown = true;
-		m_dragPoint = searchPoint(x, y, 5);
+		m_dragPoint = searchPoint(imageX, imageY, radius);
 	} else if(button == GLUT_RIGHT_BUTTON && state == GLUT_UP)
 	{
-		// End line segment
+		// End line segment, dropping a starting point with no lines
 		if(m_prevVertex != -1)
 		{
+			m_lines.collectVertex(m_prevVertex);
 			m_prevVertex = -1;
+			m_isOverlayDirty = true;
+			m_window->postRedisplay();
 			return;
 		}
 
 		// Search for point to delete
-		currPtIndex = searchPoint(x, y, 5);
+		currPtIndex = searchPoint(imageX, imageY, radius);
 		if(currPtIndex == -1)
 			return;
 
-		// Remove adjacent lines
-		searchLines(currPtIndex, &adjacentLines);
-		for(auto it=adjacentLines.rbegin(); it!=adjacentLines.rend(); it++)
-		{
-			m_indexBuffer.erase(m_indexBuffer.begin() + *it);
-		}
+		// Remove the point with its lines
+		m_lines.removeVertex(currPtIndex);
 
 		// Inform app of line change
 		m_isModified = true;
+		m_isOverlayDirty = true;
 		m_app->onLineUpdate();
-		glutSetWindow(m_window->getWindow());
-		glutPostRedisplay();
+		m_window->postRedisplay();
 	}
 	
 }
 
+//---------------------------------------------------------------------------
+// Nearest vertex of a line within radius, or -1
+//---------------------------------------------------------------------------
 int CMarkUI::searchPoint( float x, float y, float radius )
 {
-	float minx = x - radius;
-	float maxx = x + radius;
-	float miny = y - radius;
-	float maxy = y + radius;
-
-	for(auto it=m_indexBuffer.begin(); it!=m_indexBuffer.end(); it++)
-	{
-		CvPoint2D32f start = m_vertexBuffer[it->start];
-		CvPoint2D32f end = m_vertexBuffer[it->end];
-		if(start.x >= minx && start.x <= maxx && start.y >= miny && start.y <= maxy)
-			return it->start;
-		if(end.x >= minx && end.x <= maxx && end.y >= miny && end.y <= maxy)
-			return it->end;
-	}
-	return -1;
+	return m_lines.nearestVertex(x, y, radius);
 }
 
-void CMarkUI::searchLines( int pointIndex, vector<int>* adjacentLines )
+IplImage* CMarkUI::getImage()
 {
-	for(int i=0; i<m_indexBuffer.size(); i++)
-	{
-		if(m_indexBuffer[i].start == pointIndex || m_indexBuffer[i].end == pointIndex)
-			adjacentLines->push_back(i);
-		if(adjacentLines->size() >= 2)
-			return;
-	}
-	return;
+	return m_inImage;
 }
 
-IplImage* CMarkUI::getImage()
+CImagePyramid* CMarkUI::getPyramid()
 {
-	return m_inImage;
+	return &m_pyramid;
 }
 
 void CMarkUI::onMouseMove( int x, int y )
 {
+	if(m_isPanning)
+	{
+		m_viewX -= (x - m_panX) / m_imgScale;
+		m_viewY += (y - m_panY) / m_imgScale;
+		m_panX = x;
+		m_panY = y;
+		updateView();
+		m_window->postRedisplay();
+		return;
+	}
 	if(!m_isLeftMouseDown || m_dragPoint == -1)
 		return;
 
 	// Convert point to image space
-	int winWidth = m_window->getWidth();
-	int winHeight = m_window->getHeight();
-	int leftBorder = (m_window->getWidth() - m_imgScale * m_imgWidth) / 2.0f;
-	int bottomBorder = (m_window->getHeight() - m_imgScale * m_imgHeight) / 2.0f;
-	x = (x - leftBorder) / m_imgScale;
-	y = (y - bottomBorder) / m_imgScale;
-	y = m_imgHeight - y;
+	float imageX, imageY;
+	toImage(x, y, &imageX, &imageY);
 
 	// End line segment
+	if(m_prevVertex != -1)
+		m_lines.collectVertex(m_prevVertex);
 	m_prevVertex = -1;
 
-	m_vertexBuffer[m_dragPoint].x = x;
-	m_vertexBuffer[m_dragPoint].y = y;
+	snapPoint(&imageX, &imageY);
+	m_lines.moveVertex(m_dragPoint, imageX, imageY);
 
-	// Inform app of line change
+	// Preview the change until the point is dropped
 	m_isModified = true;
-	//m_app->onLineUpdate();
-	glutPostRedisplay();
+	m_isOverlayDirty = true;
+	m_app->onLineDrag();
+	m_window->postRedisplay();
 }
 
 void CMarkUI::onResize( int width, int height )
+{
+	updateView();
+}
+
+//---------------------------------------------------------------------------
+// Work out the image scale and position from the zoom and view centre.
+// The view centre is kept on the image.
+//---------------------------------------------------------------------------
+void CMarkUI::updateView()
 {
 	int winWidth = m_window->getWidth();
 	int winHeight = m_window->getHeight();
 
-	// Determine image scale
-	m_imgScale = (float)winWidth / m_imgWidth;
-	if(winHeight < m_imgHeight * m_imgScale)
-		m_imgScale = (float)winHeight / m_imgHeight;
+	// Zoom 1 fits the image to the window
+	float fitScale = min((float)winWidth / m_imgWidth, (float)winHeight / m_imgHeight);
+	m_imgScale = fitScale * m_zoom;
+
+	m_viewX = min(max(m_viewX, 0.0f), (float)m_imgWidth);
+	m_viewY = min(max(m_viewY, 0.0f), (float)m_imgHeight);
+	m_offsetX = winWidth / 2.0f - m_viewX * m_imgScale;
+	m_offsetY = winHeight / 2.0f - m_viewY * m_imgScale;
+	m_isOverlayDirty = true;
+}
+
+//---------------------------------------------------------------------------
+// Zoom by factor, keeping the image point under window position (x, y)
+// in place
+//---------------------------------------------------------------------------
+void CMarkUI::zoomAt( int x, int y, float factor )
+{
+	float imageX, imageY;
+	toImage(x, y, &imageX, &imageY);
+
+	float fitScale = m_imgScale / m_zoom;
+	m_zoom = min(m_zoom * factor, max(MAX_PIXEL_SCALE / fitScale, 1.0f));
+	m_zoom = max(m_zoom, 1.0f);
+	m_imgScale = fitScale * m_zoom;
+
+	m_viewX = imageX - (x - m_window->getWidth() / 2.0f) / m_imgScale;
+	m_viewY = imageY - (m_window->getHeight() / 2.0f - y) / m_imgScale;
+	updateView();
+	m_window->postRedisplay();
+}
+
+//---------------------------------------------------------------------------
+// Convert a GLUT window position to image space, with y pointing up
+//---------------------------------------------------------------------------
+void CMarkUI::toImage( int x, int y, float* imageX, float* imageY )
+{
+	*imageX = (x - m_offsetX) / m_imgScale;
+	*imageY = (m_window->getHeight() - y - m_offsetY) / m_imgScale;
+}
+
+//---------------------------------------------------------------------------
+// Move a point onto a nearby corner or edge if snapping is on. The radius
+// covers the same window area at any zoom.
+//---------------------------------------------------------------------------
+void CMarkUI::snapPoint( float* x, float* y )
+{
+	if(m_isSnapping)
+		m_snap.snap(*x, *y, SNAP_RADIUS / m_imgScale, x, y);
 }
 
 void CMarkUI::onRender()
 {
 	int winWidth = m_window->getWidth();
 	int winHeight = m_window->getHeight();
-	int leftBorder = (m_window->getWidth() - m_imgScale * m_imgWidth) / 2.0f;
-	int bottomBorder = (m_window->getHeight() - m_imgScale * m_imgHeight) / 2.0f;
 
 	// Reset projection, modelview matrices and viewport.
 	glMatrixMode( GL_PROJECTION );
@@ -336,63 +450,53 @@ void CMarkUI::onRender()
 	glClearColor(0.243, 0.243, 0.243, 1);
 	glClear(GL_COLOR_BUFFER_BIT);
 
-	// Draw image
-	glBindTexture( GL_TEXTURE_2D, m_image);
-	glBegin( GL_QUADS );
-	glTexCoord2f(0, 0);
-	glVertex2f(leftBorder, bottomBorder);
-	glTexCoord2f(0, 1);
-	glVertex2f(leftBorder, bottomBorder + m_imgHeight * m_imgScale);
-	glTexCoord2f(1, 1);
-	glVertex2f(leftBorder + m_imgWidth * m_imgScale, bottomBorder + m_imgHeight * m_imgScale);
-	glTexCoord2f(1, 0);
-	glVertex2f(leftBorder + m_imgWidth * m_imgScale, bottomBorder);
-	glEnd();
-
-	glBindTexture( GL_TEXTURE_2D, 0);
-	
-	// Draw points
-	glColor3fv(MARKCOLOR);
-	glPointSize(CIRCLE_SIZE);
-	glBegin(GL_POINTS);
-	if(m_prevVertex != -1)
-	{
-		CvPoint2D32f first = m_vertexBuffer[m_prevVertex];
-		glVertex2f(leftBorder+first.x*m_imgScale, bottomBorder+first.y*m_imgScale);
-	}
-	for(int i=0; i<m_indexBuffer.size(); i++)
-	{
-		CvPoint2D32f start = m_vertexBuffer[m_indexBuffer[i].start];
-		CvPoint2D32f end = m_vertexBuffer[m_indexBuffer[i].end];
-		glVertex2f(leftBorder+start.x*m_imgScale, bottomBorder+start.y*m_imgScale);
-		glVertex2f(leftBorder+end.x*m_imgScale, bottomBorder+end.y*m_imgScale);
-	}
-	glEnd();
+	// Draw the visible tiles, redrawing until all of them are streamed in
+	if(!m_tiles.draw(m_imgScale, m_offsetX, m_offsetY, winWidth, winHeight))
+		m_window->postRedisplay();
 
-	// Draw lines
-	glBegin(GL_LINES);
-	for(int i=0; i<m_indexBuffer.size(); i++)
-	{
-		CvPoint2D32f start = m_vertexBuffer[m_indexBuffer[i].start];
-		CvPoint2D32f end = m_vertexBuffer[m_indexBuffer[i].end];
-		glVertex2f(leftBorder+start.x*m_imgScale, bottomBorder+start.y*m_imgScale);
-		glVertex2f(leftBorder+end.x*m_imgScale, bottomBorder+end.y*m_imgScale);
-	}
-	glEnd();
-	
-	// Draw line numbers
-	for(int i=0; i<m_indexBuffer.size(); i++)
+	// Draw points, lines and line numbers
+	if(m_isOverlayDirty)
 	{
-		CvPoint2D32f start = m_vertexBuffer[m_indexBuffer[i].start];
-		start.x = start.x * m_imgScale + leftBorder;
-		start.y = start.y * m_imgScale + bottomBorder;
-		gltext(start.x, start.y, "%d", i+1);
+		m_overlay.build(m_lines.getVertexBuffer(), m_lines.getIndexBuffer(),
+			m_imgScale, m_offsetX, m_offsetY);
+		m_isOverlayDirty = false;
 	}
+	m_overlay.draw(MARKCOLOR, CIRCLE_SIZE);
 
 	glutSwapBuffers();
 }
 
 void CMarkUI::onKeyPress( unsigned char key, int x, int y )
 {
-	m_app->forwardKeyPress(key, x, y);
+	switch ( key )
+	{
+	case '+':
+	case '=':
+		zoomAt(x, y, ZOOM_STEP);
+		break;
+
+	case '-':
+	case '_':
+		zoomAt(x, y, 1 / ZOOM_STEP);
+		break;
+
+	case 's':
+	case 'S':
+		m_isSnapping = !m_isSnapping;
+		printf("Snapping: %s\n", m_isSnapping ? "On" : "Off");
+		break;
+
+	case 'f':
+	case 'F':
+		m_zoom = 1;
+		m_viewX = m_imgWidth / 2.0f;
+		m_viewY = m_imgHeight / 2.0f;
+		updateView();
+		m_window->postRedisplay();
+		break;
+
+	default:
+		m_app->forwardKeyPress(key, x, y);
+		break;
+	}
 }
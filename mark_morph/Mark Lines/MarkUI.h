@@ -4,7 +4,7 @@
 // Edit window class
 // CMarkUI contains all states required for the editing windows
 // This class is also responsible for keeping a copy of the original input
-// image.
+// image and its pyramid.
 //
 // Author: Daniel Seah
 /////////////////////////////////////////////////////////////////////////////
@@ -17,6 +17,12 @@
 #include <GL/glew.h>
 #include <GL/glut.h>
 #include "IGLUTDelegate.h"
+#include "hash_util.h"
+#include "line_io.h"
+#include "LineGraph.h"
+#include "Overlay.h"
+#include "TiledImage.h"
+#include "FeatureSnap.h"
 
 using namespace std;
 
@@ -25,26 +31,38 @@ class CImageMorph;
 class CMarkUI : public IGLUTDelegate
 {
 private:
-	struct Line2D
-	{
-		int start, end;
-	};
+	// Same layout as the index buffer of a binary line file
+	typedef LineIndex Line2D;
 
 private:
-	vector<CvPoint2D32f> m_vertexBuffer;
-	vector<Line2D> m_indexBuffer;
+	CLineGraph m_lines;
 	vector<float> m_packedLine;
+	COverlay m_overlay;
+	bool m_isOverlayDirty;		// Lines or view changed since the overlay was built
 
 	char m_imgFilename[31];
 	char m_lineFilename[31];
 
 	IplImage* m_inImage;
-	float m_imgScale;
+	hash64 m_imageHash;
 	int m_imgWidth, m_imgHeight;
-	GLuint m_image;
+	CImagePyramid m_pyramid;	// Also paged by the renderer
+	CTiledImage m_tiles;
+	CFeatureSnap m_snap;
+	bool m_isSnapping;			// Snap new and dragged points to corners and edges
+
+	// View states. The view zooms about an image point kept at the window
+	// centre; zoom 1 fits the image to the window.
+	float m_zoom;
+	float m_viewX, m_viewY;
+	float m_imgScale;				// Window pixels per image pixel
+	float m_offsetX, m_offsetY;		// Window position of image pixel (0, 0)
+	bool m_isPanning;
+	int m_panX, m_panY;				// Last mouse position while panning
 
 	bool m_isModified;
-	int m_prevVertex;
+	int m_uploadBegin, m_uploadEnd;	// Packed lines changed since the last upload
+	int m_prevVertex;		// Vertex IDs in m_lines
 	int m_dragPoint;
 	bool m_isLeftMouseDown;
 
@@ -52,8 +70,10 @@ private:
 
 public:
 	float* getPackedLine();
+	void getDirtyLines(int* begin, int* end);
 	char* getImageData();
 	IplImage* getImage();
+	CImagePyramid* getPyramid();
 	int getNumLines();
 
 	void loadLines();
@@ -64,7 +84,6 @@ public:
 
 private:
 	int searchPoint(float x, float y, float radius);
-	void searchLines(int pointIndex, vector<int>* adjacentLines);
 
 	virtual void onMousePress(int button, int state, int x, int y);
 	virtual void onMouseMove(int x, int y);
@@ -73,6 +92,10 @@ private:
 	virtual void onKeyPress(unsigned char key, int x, int y);
 
 	void initGLState();
-	void initTexture();
+
+	void updateView();
+	void zoomAt(int x, int y, float factor);
+	void toImage(int x, int y, float* imageX, float* imageY);
+	void snapPoint(float* x, float* y);
 };
 
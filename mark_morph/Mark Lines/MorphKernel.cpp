@@ -0,0 +1,524 @@
+/////////////////////////////////////////////////////////////////////////////
+// File: MorphKernel.cpp
+//
+// CPU morph kernel
+// CMorphKernel is a CPU port of morph.frag. It warps both input images
+// with the Beier-Neely field-morphing equations and blends them, without
+// needing a GL context, so it can run on worker threads.
+//
+// render() only reads kernel state, so one kernel can be shared by
+// several threads rendering different frames.
+//
+// Images and lines may be in either y-up or y-down coordinates as long as
+// both use the same convention; the output has the same orientation.
+//
+// Author: Leon Ho
+/////////////////////////////////////////////////////////////////////////////
+
+#include "MorphKernel.h"
+#include "constants.h"
+#include <math.h>
+#include <algorithm>
+
+const float Epsilon = 0.0000001f;
+
+CMorphKernel::CMorphKernel(void)
+{
+	m_imageA = m_imageB = NULL;
+	m_ownedA = m_ownedB = 1;
+	m_width = m_height = 0;
+	m_numLines = 0;
+	m_a = WARP_A;
+	m_b = WARP_B;
+	m_p = WARP_P;
+	m_blendType = 0;
+}
+
+CMorphKernel::~CMorphKernel(void)
+{
+	releasePyramid(&m_levelsA, m_ownedA);
+	releasePyramid(&m_levelsB, m_ownedB);
+}
+
+//---------------------------------------------------------------------------
+// The images must outlive the kernel. Their pyramids are built here, so
+// setting the same images again costs nothing. Coarser levels the caller
+// already has, as a dataset pack does, are used in place of the first
+// levels built; they must outlive the kernel as well.
+//---------------------------------------------------------------------------
+void CMorphKernel::setImages( const IplImage* imageA, const IplImage* imageB,
+	const vector<IplImage*>* levelsA, const vector<IplImage*>* levelsB )
+{
+	if(imageA != m_imageA)
+		buildPyramid(imageA, levelsA, &m_levelsA, &m_ownedA);
+	if(imageB != m_imageB)
+		buildPyramid(imageB, levelsB, &m_levelsB, &m_ownedB);
+	m_imageA = imageA;
+	m_imageB = imageB;
+	m_width = imageA ? imageA->width : 0;
+	m_height = imageA ? imageA->height : 0;
+}
+
+//---------------------------------------------------------------------------
+// Size of images that are not held in memory, for rendering rectangles
+// from sources the caller provides
+//---------------------------------------------------------------------------
+void CMorphKernel::setImageSize( int width, int height )
+{
+	m_width = width;
+	m_height = height;
+}
+
+//---------------------------------------------------------------------------
+// Halve the image with cvPyrDown until a side is a single pixel. Given
+// levels are taken in order while they have the size cvPyrDown would
+// give, so a pyramid is the same whichever levels were given.
+//---------------------------------------------------------------------------
+void CMorphKernel::buildPyramid( const IplImage* image, const vector<IplImage*>* given,
+	vector<SourceLevel>* levels, int* firstOwned )
+{
+	releasePyramid(levels, *firstOwned);
+	*firstOwned = 1;
+	if(image == NULL)
+		return;
+
+	IplImage* src = const_cast<IplImage*>(image);
+	int givenCount = 0;
+	while(true)
+	{
+		SourceLevel level;
+		level.image = src;
+		level.scaleX = (float)src->width / image->width;
+		level.scaleY = (float)src->height / image->height;
+		level.originX = level.originY = 0;
+		levels->push_back(level);
+		if(src->width <= 1 || src->height <= 1)
+			break;
+
+		CvSize size = cvSize((src->width + 1) / 2, (src->height + 1) / 2);
+		IplImage* next = given != NULL && givenCount < (int)given->size() ? (*given)[givenCount] : NULL;
+		if(next != NULL && next->width == size.width && next->height == size.height &&
+			next->depth == src->depth && next->nChannels == src->nChannels)
+		{
+			src = next;
+			givenCount++;
+			continue;
+		}
+
+		// Levels built here are owned, so no given level may follow them
+		given = NULL;
+		IplImage* dst = cvCreateImage(size, src->depth, src->nChannels);
+		cvPyrDown(src, dst);
+		src = dst;
+	}
+	*firstOwned = givenCount + 1;
+}
+
+void CMorphKernel::releasePyramid( vector<SourceLevel>* levels, int firstOwned )
+{
+	for(int i=firstOwned; i<(int)levels->size(); i++)
+		cvReleaseImage((IplImage**)&(*levels)[i].image);
+	levels->clear();
+}
+
+//---------------------------------------------------------------------------
+// Lines are packed as (Px, Py, Qx, Qy) and must correspond by index.
+// Source line terms do not depend on t and are computed once here.
+//---------------------------------------------------------------------------
+void CMorphKernel::setLines( const float* linesA, const float* linesB, int numLines )
+{
+	m_numLines = numLines;
+	m_sourceA.resize(numLines);
+	m_sourceB.resize(numLines);
+
+	for(int i=0; i<numLines; i++)
+	{
+		const float* lines[2] = {linesA + i*4, linesB + i*4};
+		SourceLine* sources[2] = {&m_sourceA[i], &m_sourceB[i]};
+		for(int j=0; j<2; j++)
+		{
+			SourceLine* src = sources[j];
+			src->px = lines[j][0];
+			src->py = lines[j][1];
+			src->dx = lines[j][2] - lines[j][0];
+			src->dy = lines[j][3] - lines[j][1];
+			float len = sqrt(src->dx * src->dx + src->dy * src->dy);
+			src->nx = len > Epsilon ? -src->dy / len : 0;
+			src->ny = len > Epsilon ? src->dx / len : 0;
+		}
+	}
+}
+
+void CMorphKernel::setParameters( float a, float b, float p )
+{
+	m_a = a;
+	m_b = b;
+	m_p = p;
+}
+
+void CMorphKernel::setBlendType( int blendType )
+{
+	m_blendType = blendType;
+}
+
+int CMorphKernel::getWidth()
+{
+	return m_width;
+}
+
+int CMorphKernel::getHeight()
+{
+	return m_height;
+}
+
+void CMorphKernel::interpolateLines( float t, vector<MorphLine>* morphLines )
+{
+	morphLines->resize(m_numLines);
+	for(int i=0; i<m_numLines; i++)
+	{
+		const SourceLine& a = m_sourceA[i];
+		const SourceLine& b = m_sourceB[i];
+		MorphLine& line = (*morphLines)[i];
+
+		line.px = a.px * (1-t) + b.px * t;
+		line.py = a.py * (1-t) + b.py * t;
+		line.qx = (a.px + a.dx) * (1-t) + (b.px + b.dx) * t;
+		line.qy = (a.py + a.dy) * (1-t) + (b.py + b.dy) * t;
+		line.dx = line.qx - line.px;
+		line.dy = line.qy - line.py;
+
+		// Degenerate lines get no weight
+		float lenSq = line.dx * line.dx + line.dy * line.dy;
+		float len = sqrt(lenSq);
+		if(len <= Epsilon)
+		{
+			line.invLenSq = line.nx = line.ny = line.strength = 0;
+			continue;
+		}
+		line.invLenSq = 1 / lenSq;
+		line.nx = -line.dy / len;
+		line.ny = line.dx / len;
+		line.strength = pow(len, m_p);
+	}
+}
+
+//---------------------------------------------------------------------------
+// Bilinear sample with texel centres at half-integer coordinates, matching
+// GL_LINEAR on a rectangle texture. x and y are in image pixels. Taps
+// outside the level's pixels are clamped, so a partial level must hold
+// every pixel the clamped taps reach.
+//---------------------------------------------------------------------------
+void CMorphKernel::sample( const SourceLevel& level, float x, float y, float* pixel )
+{
+	const IplImage* image = level.image;
+	float fx = x * level.scaleX - 0.5f - level.originX;
+	float fy = y * level.scaleY - 0.5f - level.originY;
+	int x0 = (int)floor(fx);
+	int y0 = (int)floor(fy);
+	float wx = fx - x0;
+	float wy = fy - y0;
+
+	int x1 = min(max(x0 + 1, 0), image->width - 1);
+	int y1 = min(max(y0 + 1, 0), image->height - 1);
+	x0 = min(max(x0, 0), image->width - 1);
+	y0 = min(max(y0, 0), image->height - 1);
+
+	const unsigned char* row0 = (const unsigned char*)image->imageData + y0 * image->widthStep;
+	const unsigned char* row1 = (const unsigned char*)image->imageData + y1 * image->widthStep;
+	for(int c=0; c<3; c++)
+	{
+		float top = row0[x0*3+c] * (1-wx) + row0[x1*3+c] * wx;
+		float bottom = row1[x0*3+c] * (1-wx) + row1[x1*3+c] * wx;
+		pixel[c] = top * (1-wy) + bottom * wy;
+	}
+}
+
+//---------------------------------------------------------------------------
+// Sample a pyramid at level lod, in level 0 coordinates. Between levels the
+// two nearest are blended, as GL_LINEAR_MIPMAP_LINEAR does. At lod 0 and
+// below this is a plain bilinear sample of the image.
+//---------------------------------------------------------------------------
+void CMorphKernel::sampleLevel( const vector<SourceLevel>& levels, float x, float y, float lod, float* pixel )
+{
+	float weight;
+	int level = getLevel(lod, levels.size(), &weight);
+	sample(levels[level], x, y, pixel);
+	if(weight <= 0)
+		return;
+
+	float coarse[3];
+	sample(levels[level + 1], x, y, coarse);
+	for(int c=0; c<3; c++)
+		pixel[c] = pixel[c] * (1-weight) + coarse[c] * weight;
+}
+
+//---------------------------------------------------------------------------
+// Finer of the two levels sampled at lod, and the weight of the coarser
+//---------------------------------------------------------------------------
+int CMorphKernel::getLevel( float lod, int levelCount, float* weight )
+{
+	int last = levelCount - 1;
+	*weight = 0;
+	if(lod <= 0 || last <= 0)
+		return 0;
+
+	int level = min((int)lod, last);
+	if(level < last)
+		*weight = lod - level;
+	return level;
+}
+
+//---------------------------------------------------------------------------
+// Level of detail of a source position in the field: log2 of the longer
+// column of the Jacobian, i.e. of the larger distance in the source
+// between neighbouring output pixels. Derivatives are central differences,
+// one sided at the edges. prevField and nextField are the rows above and
+// below, rowSpan rows apart, or 0 for a single row image. The position at
+// the start of each pixel is used, so image B's are passed offset by 2.
+//---------------------------------------------------------------------------
+float CMorphKernel::getLod( const float* field, const float* prevField, const float* nextField, int x,
+	int width, float rowSpan )
+{
+	int left = max(x - 1, 0);
+	int right = min(x + 1, width - 1);
+	float dxx = 0, dxy = 0, dyx = 0, dyy = 0;
+	if(right > left)
+	{
+		dxx = (field[right*4] - field[left*4]) / (right - left);
+		dxy = (field[right*4+1] - field[left*4+1]) / (right - left);
+	}
+	if(rowSpan > 0)
+	{
+		dyx = (nextField[x*4] - prevField[x*4]) / rowSpan;
+		dyy = (nextField[x*4+1] - prevField[x*4+1]) / rowSpan;
+	}
+
+	float rhoSq = max(dxx * dxx + dxy * dxy, dyx * dyx + dyy * dyy);
+	return rhoSq > 1 ? 0.5f * log(rhoSq) / log(2.0f) : 0;
+}
+
+//---------------------------------------------------------------------------
+// Compute the source positions in both images for count pixels of a row
+// starting at x. Each pixel gets (XprimeAx, XprimeAy, XprimeBx, XprimeBy).
+//---------------------------------------------------------------------------
+void CMorphKernel::computeFieldRow( const vector<MorphLine>& morphLines, int x, int count, int y, float* field )
+{
+	int width = m_width;
+	int height = m_height;
+	float Xy = y + 0.5f;
+
+	for(int i=0; i<count; i++, field+=4)
+	{
+		float Xx = x + i + 0.5f;
+		float dsumAx = 0, dsumAy = 0, dsumBx = 0, dsumBy = 0;
+		float weightsum = 0;
+
+		for(int j=0; j<m_numLines; j++)
+		{
+			const MorphLine& line = morphLines[j];
+			const SourceLine& a = m_sourceA[j];
+			const SourceLine& b = m_sourceB[j];
+
+			float PXx = Xx - line.px;
+			float PXy = Xy - line.py;
+			float u = (PXx * line.dx + PXy * line.dy) * line.invLenSq;
+			float v = PXx * line.nx + PXy * line.ny;
+
+			float dist;
+			if(u > 1)
+				dist = sqrt((Xx - line.qx) * (Xx - line.qx) + (Xy - line.qy) * (Xy - line.qy));
+			else if(u < 0)
+				dist = sqrt(PXx * PXx + PXy * PXy);
+			else
+				dist = fabs(v);
+			float weight = pow(line.strength / (m_a + dist), m_b);
+
+			dsumAx += (a.px + a.dx * u + a.nx * v - Xx) * weight;
+			dsumAy += (a.py + a.dy * u + a.ny * v - Xy) * weight;
+			dsumBx += (b.px + b.dx * u + b.nx * v - Xx) * weight;
+			dsumBy += (b.py + b.dy * u + b.ny * v - Xy) * weight;
+			weightsum += weight;
+		}
+
+		float XprimeAx = Xx, XprimeAy = Xy, XprimeBx = Xx, XprimeBy = Xy;
+		if(weightsum > 0)
+		{
+			XprimeAx += dsumAx / weightsum;
+			XprimeAy += dsumAy / weightsum;
+			XprimeBx += dsumBx / weightsum;
+			XprimeBy += dsumBy / weightsum;
+		}
+
+		// Fall back to the unwarped pixel outside the image
+		if(XprimeAx < 0 || XprimeAx >= width || XprimeAy < 0 || XprimeAy >= height)
+		{
+			XprimeAx = Xx;
+			XprimeAy = Xy;
+		}
+		if(XprimeBx < 0 || XprimeBx >= width || XprimeBy < 0 || XprimeBy >= height)
+		{
+			XprimeBx = Xx;
+			XprimeBy = Xy;
+		}
+
+		field[0] = XprimeAx;
+		field[1] = XprimeAy;
+		field[2] = XprimeBx;
+		field[3] = XprimeBy;
+	}
+}
+
+//---------------------------------------------------------------------------
+// Sample both images at the source positions of pixels [begin, end) of a
+// field row fieldWidth pixels wide, and blend them. The neighbouring rows
+// and pixels of the field give the level each is sampled at.
+//---------------------------------------------------------------------------
+void CMorphKernel::blendRow( float t, const float* field, const float* prevField, const float* nextField,
+	float rowSpan, int fieldWidth, int begin, int end, const vector<SourceLevel>& levelsA,
+	const vector<SourceLevel>& levelsB, unsigned char* row )
+{
+	float startPixel[3], endPixel[3];
+	for(int x=begin; x<end; x++, row+=3)
+	{
+		float lodA = getLod(field, prevField, nextField, x, fieldWidth, rowSpan);
+		float lodB = getLod(field + 2, prevField + 2, nextField + 2, x, fieldWidth, rowSpan);
+		sampleLevel(levelsA, field[x*4], field[x*4+1], lodA, startPixel);
+		sampleLevel(levelsB, field[x*4+2], field[x*4+3], lodB, endPixel);
+
+		for(int c=0; c<3; c++)
+		{
+			float value;
+			if(m_blendType == 0)
+				value = startPixel[c] * (1-t) + endPixel[c] * t;
+			else if(m_blendType == 1)
+				value = startPixel[c];
+			else
+				value = endPixel[c];
+			row[c] = (unsigned char)min(value + 0.5f, 255.0f);
+		}
+	}
+}
+
+//---------------------------------------------------------------------------
+// Render the morph at time t into a BGR buffer with the given row step.
+// Three rows of the field are kept, the one being blended and its
+// neighbours for the Jacobian.
+//---------------------------------------------------------------------------
+void CMorphKernel::render( float t, char* data, int step )
+{
+	vector<MorphLine> morphLines;
+	interpolateLines(t, &morphLines);
+
+	int width = m_width;
+	int height = m_height;
+	vector<float> field(width * 4 * 3);
+	float* rows[3] = {&field[0], &field[width * 4], &field[width * 8]};
+	computeFieldRow(morphLines, 0, width, 0, rows[1]);
+	if(height > 1)
+		computeFieldRow(morphLines, 0, width, 1, rows[2]);
+
+	for(int y=0; y<height; y++)
+	{
+		int prevY = max(y - 1, 0);
+		int nextY = min(y + 1, height - 1);
+		const float* prevField = prevY < y ? rows[0] : rows[1];
+		const float* nextField = nextY > y ? rows[2] : rows[1];
+		blendRow(t, rows[1], prevField, nextField, (float)(nextY - prevY), width, 0, width,
+			m_levelsA, m_levelsB, (unsigned char*)data + y * step);
+
+		float* oldest = rows[0];
+		rows[0] = rows[1];
+		rows[1] = rows[2];
+		rows[2] = oldest;
+		if(y + 2 < height)
+			computeFieldRow(morphLines, 0, width, y + 2, rows[2]);
+	}
+}
+
+//---------------------------------------------------------------------------
+// Compute the displacement field at time t. The field holds four floats
+// per pixel, the source positions in image A and image B, and depends only
+// on the lines, the warp parameters and t, not on the images' pixels.
+//---------------------------------------------------------------------------
+void CMorphKernel::computeField( float t, float* field )
+{
+	vector<MorphLine> morphLines;
+	interpolateLines(t, &morphLines);
+
+	int rowSize = m_width * 4;
+	for(int y=0; y<m_height; y++)
+		computeFieldRow(morphLines, 0, m_width, y, field + y * rowSize);
+}
+
+//---------------------------------------------------------------------------
+// Render the morph at time t from a field made by computeField().
+//---------------------------------------------------------------------------
+void CMorphKernel::renderField( float t, const float* field, char* data, int step )
+{
+	int rowSize = m_width * 4;
+	for(int y=0; y<m_height; y++)
+	{
+		int prevY = max(y - 1, 0);
+		int nextY = min(y + 1, m_height - 1);
+		blendRow(t, field + y * rowSize, field + prevY * rowSize, field + nextY * rowSize,
+			(float)(nextY - prevY), m_width, 0, m_width, m_levelsA, m_levelsB, (unsigned char*)data + y * step);
+	}
+}
+
+int CMorphKernel::getFieldSize()
+{
+	return m_width * m_height * 4 * sizeof(float);
+}
+
+//---------------------------------------------------------------------------
+// Compute the displacement field of a rectangle of the image, laid out as
+// computeField() does with rect.width pixels per row.
+//---------------------------------------------------------------------------
+void CMorphKernel::computeFieldRect( float t, const CvRect& rect, float* field )
+{
+	vector<MorphLine> morphLines;
+	interpolateLines(t, &morphLines);
+
+	int rowSize = rect.width * 4;
+	for(int y=0; y<rect.height; y++)
+		computeFieldRow(morphLines, rect.x, rect.width, rect.y + y, field + y * rowSize);
+}
+
+//---------------------------------------------------------------------------
+// Compute the displacement field at cols x rows pixels spacing apart,
+// starting at (x, y), laid out as computeField() does with cols pixels per
+// row. Points may lie outside the image.
+//---------------------------------------------------------------------------
+void CMorphKernel::computeFieldGrid( float t, int x, int y, int cols, int rows, int spacing, float* field )
+{
+	vector<MorphLine> morphLines;
+	interpolateLines(t, &morphLines);
+
+	for(int j=0; j<rows; j++)
+	{
+		for(int i=0; i<cols; i++, field+=4)
+			computeFieldRow(morphLines, x + i * spacing, 1, y + j * spacing, field);
+	}
+}
+
+//---------------------------------------------------------------------------
+// Render rect of the morph at time t from the field of fieldRect, sampling
+// the given source levels. fieldRect should hold rect and the pixels
+// around it within the image, so levels are chosen exactly as render()
+// chooses them and tiles join without seams.
+//---------------------------------------------------------------------------
+void CMorphKernel::renderRect( float t, const float* field, const CvRect& fieldRect, const CvRect& rect,
+	const vector<SourceLevel>& levelsA, const vector<SourceLevel>& levelsB, char* data, int step )
+{
+	int rowSize = fieldRect.width * 4;
+	int lastY = fieldRect.y + fieldRect.height - 1;
+	int begin = rect.x - fieldRect.x;
+	for(int y=rect.y; y<rect.y+rect.height; y++)
+	{
+		int prevY = max(y - 1, fieldRect.y);
+		int nextY = min(y + 1, lastY);
+		blendRow(t, field + (y - fieldRect.y) * rowSize, field + (prevY - fieldRect.y) * rowSize,
+			field + (nextY - fieldRect.y) * rowSize, (float)(nextY - prevY), fieldRect.width,
+			begin, begin + rect.width, levelsA, levelsB, (unsigned char*)data + (y - rect.y) * step);
+	}
+}
@@ -0,0 +1,114 @@
+/////////////////////////////////////////////////////////////////////////////
+// File: MorphKernel.h
+//
+// CPU morph kernel
+// CMorphKernel is a CPU port of morph.frag. It warps both input images
+// with the Beier-Neely field-morphing equations and blends them, without
+// needing a GL context, so it can run on worker threads.
+//
+// render() only reads kernel state, so one kernel can be shared by
+// several threads rendering different frames.
+//
+// Images and lines may be in either y-up or y-down coordinates as long as
+// both use the same convention; the output has the same orientation.
+//
+// Where the warp compresses a source image, a single bilinear sample
+// aliases and its neighbours read far apart in memory. The size of each
+// output pixel in the source is estimated from the differences of the
+// displacement field, its Jacobian, and the sample is taken from a
+// prefiltered pyramid at the matching level, as mipmapping does on the
+// GPU.
+//
+// Images too large for memory are rendered a rectangle at a time with
+// computeFieldRect() and renderRect(), sampling source regions the caller
+// pages in, given only the size of the images.
+// computeFieldGrid() samples the field coarsely, for finding what a
+// rectangle samples without computing all of its field.
+//
+// Author: Leon Ho
+/////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <vector>
+#include <cv.h>
+
+using namespace std;
+
+class CMorphKernel
+{
+public:
+	// Part of a pyramid level, holding the pixels a render samples
+	struct SourceLevel
+	{
+		const IplImage* image;
+		float scaleX, scaleY;		// Level pixels per image pixel
+		int originX, originY;		// Level pixel at the image's first pixel
+	};
+
+private:
+	struct SourceLine
+	{
+		float px, py;			// Start point
+		float dx, dy;			// Q - P
+		float nx, ny;			// Perpendicular of Q - P over its length
+	};
+
+	struct MorphLine
+	{
+		float px, py, qx, qy;
+		float dx, dy;			// Q - P
+		float invLenSq;
+		float nx, ny;			// Perpendicular of Q - P over its length
+		float strength;			// length ^ p
+	};
+
+private:
+	const IplImage *m_imageA, *m_imageB;
+	vector<SourceLevel> m_levelsA, m_levelsB;	// Source pyramids; level 0 is the image itself
+	int m_ownedA, m_ownedB;		// First pyramid level built by the kernel
+	int m_width, m_height;
+	vector<SourceLine> m_sourceA, m_sourceB;
+	int m_numLines;
+
+	float m_a, m_b, m_p;
+	int m_blendType;
+
+public:
+	void setImages(const IplImage* imageA, const IplImage* imageB,
+		const vector<IplImage*>* levelsA = NULL, const vector<IplImage*>* levelsB = NULL);
+	void setImageSize(int width, int height);
+	void setLines(const float* linesA, const float* linesB, int numLines);
+	void setParameters(float a, float b, float p);
+	void setBlendType(int blendType);
+	int getWidth();
+	int getHeight();
+
+	void render(float t, char* data, int step);
+	void computeField(float t, float* field);
+	void renderField(float t, const float* field, char* data, int step);
+	int getFieldSize();
+
+	void computeFieldRect(float t, const CvRect& rect, float* field);
+	void computeFieldGrid(float t, int x, int y, int cols, int rows, int spacing, float* field);
+	void renderRect(float t, const float* field, const CvRect& fieldRect, const CvRect& rect,
+		const vector<SourceLevel>& levelsA, const vector<SourceLevel>& levelsB, char* data, int step);
+	static float getLod(const float* field, const float* prevField, const float* nextField, int x,
+		int width, float rowSpan);
+	static int getLevel(float lod, int levelCount, float* weight);
+
+	CMorphKernel(void);
+	~CMorphKernel(void);
+
+private:
+	void interpolateLines(float t, vector<MorphLine>* morphLines);
+	void computeFieldRow(const vector<MorphLine>& morphLines, int x, int count, int y, float* field);
+	void blendRow(float t, const float* field, const float* prevField, const float* nextField,
+		float rowSpan, int fieldWidth, int begin, int end, const vector<SourceLevel>& levelsA,
+		const vector<SourceLevel>& levelsB, unsigned char* row);
+	void sample(const SourceLevel& level, float x, float y, float* pixel);
+	void sampleLevel(const vector<SourceLevel>& levels, float x, float y, float lod, float* pixel);
+	static void buildPyramid(const IplImage* image, const vector<IplImage*>* given,
+		vector<SourceLevel>* levels, int* firstOwned);
+	static void releasePyramid(vector<SourceLevel>* levels, int firstOwned);
+};
@@ -0,0 +1,783 @@
+/////////////////////////////////////////////////////////////////////////////
+// File: MorphService.cpp
+//
+// Morph service
+// CMorphService runs as a long-lived process and accepts morph jobs over
+// a local named pipe. Decoded images, line sets and prepared kernels are
+// kept in LRU caches across jobs, so repeated pairs skip decoding and
+// line parsing. Files are cached by name, last write time and size, so
+// files edited between jobs are loaded again. Preview jobs are scheduled
+// ahead of batch jobs, and a running batch job yields its worker when a
+// preview job is waiting.
+//
+// Author: Leon Ho
+/////////////////////////////////////////////////////////////////////////////
+
+#include "MorphService.h"
+#include "constants.h"
+#include "line_io.h"
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <highgui.h>
+
+struct ClientParam
+{
+	CMorphService* service;
+	HANDLE pipe;
+};
+
+static void releaseImage(IplImage* image)
+{
+	cvReleaseImage(&image);
+}
+
+//---------------------------------------------------------------------------
+// Cache key of a file: its name, last write time and size, so a file that
+// is edited between jobs is loaded again instead of served stale.
+//---------------------------------------------------------------------------
+static string getFileKey(const string& filename)
+{
+	WIN32_FILE_ATTRIBUTE_DATA info;
+	if(!GetFileAttributesExA(filename.c_str(), GetFileExInfoStandard, &info))
+		return filename;
+
+	char stamp[64];
+	sprintf(stamp, "|%lx%08lx|%lx%08lx", info.ftLastWriteTime.dwHighDateTime,
+		info.ftLastWriteTime.dwLowDateTime, info.nFileSizeHigh, info.nFileSizeLow);
+	return filename + stamp;
+}
+
+static void splitRequest(const string& request, vector<string>* args)
+{
+	size_t start = request.find_first_not_of(" \t");
+	while(start != string::npos)
+	{
+		size_t end = request.find_first_of(" \t", start);
+		args->push_back(request.substr(start, end - start));
+		start = request.find_first_not_of(" \t", end);
+	}
+}
+
+CMorphService::CMorphService(void)
+	: m_imageCache((size_t)SERVICE_IMAGE_CACHE_MB << 20),
+	m_lineCache((size_t)SERVICE_LINE_CACHE_MB << 20),
+	m_kernelCache(SERVICE_KERNEL_CACHE)
+{
+	m_pipeName = SERVICE_PIPE;
+	m_cacheDir = RESULTCACHE_DIR;
+	m_isCachingFields = false;
+	m_isRunning = false;
+	m_nextJobId = 1;
+	m_numIdleWorkers = 0;
+
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	m_numWorkers = info.dwNumberOfProcessors;
+
+	InitializeCriticalSection(&m_lock);
+	InitializeConditionVariable(&m_jobQueued);
+	InitializeConditionVariable(&m_jobProgress);
+}
+
+CMorphService::~CMorphService(void)
+{
+	// Client and worker threads have been joined by run(). Jobs delete
+	// their stores as they are freed.
+	m_queue.clear();
+	m_jobList.clear();
+	DeleteCriticalSection(&m_lock);
+}
+
+bool CMorphService::parseArgs( int argc, char* argv[] )
+{
+	for(int i=2; i<argc; i++)
+	{
+		if(strcmp(argv[i], "-workers") == 0 && i+1 < argc)
+			m_numWorkers = max(atoi(argv[++i]), 1);
+		else if(strcmp(argv[i], "-pipe") == 0 && i+1 < argc)
+			m_pipeName = string("\\\\.\\pipe\\") + argv[++i];
+		else if(strcmp(argv[i], "-cache") == 0 && i+1 < argc)
+			m_cacheDir = argv[++i];
+		else if(strcmp(argv[i], "-fields") == 0)
+			m_isCachingFields = true;
+		else
+		{
+			printUsage();
+			return false;
+		}
+	}
+	return true;
+}
+
+void CMorphService::printUsage()
+{
+	fprintf(stderr, "Usage: -service [-workers n] [-pipe name] [-cache dir] [-fields]\n");
+}
+
+//---------------------------------------------------------------------------
+// Accept clients until a SHUTDOWN request is received. Each client is
+// served on its own thread.
+//---------------------------------------------------------------------------
+bool CMorphService::run()
+{
+	CreateDirectoryA(SERVICE_DIR, NULL);
+	m_resultCache.open(m_cacheDir.c_str(), (__int64)RESULTCACHE_RAM_MB << 20,
+		(__int64)RESULTCACHE_DISK_MB << 20, m_isCachingFields);
+	m_isRunning = true;
+
+	vector<HANDLE> workers;
+	list<HANDLE> clients;
+	for(int i=0; i<m_numWorkers; i++)
+		workers.push_back(CreateThread(NULL, 0, workerThread, this, 0, NULL));
+	printf("Morph service listening on %s with %d workers\n", m_pipeName.c_str(), m_numWorkers);
+
+	while(m_isRunning)
+	{
+		HANDLE pipe = CreateNamedPipeA(m_pipeName.c_str(), PIPE_ACCESS_DUPLEX,
+			PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT, PIPE_UNLIMITED_INSTANCES,
+			1 << 16, 1 << 16, 0, NULL);
+		if(pipe == INVALID_HANDLE_VALUE)
+		{
+			fprintf(stderr, "Error: Cannot create pipe %s\n", m_pipeName.c_str());
+			shutdown();
+			break;
+		}
+
+		bool isConnected = ConnectNamedPipe(pipe, NULL) || GetLastError() == ERROR_PIPE_CONNECTED;
+		if(!isConnected || !m_isRunning)
+		{
+			CloseHandle(pipe);
+			continue;
+		}
+
+		// Threads of clients that have disconnected are closed as we go
+		for(auto it=clients.begin(); it!=clients.end(); )
+		{
+			if(WaitForSingleObject(*it, 0) == WAIT_OBJECT_0)
+			{
+				CloseHandle(*it);
+				it = clients.erase(it);
+			}
+			else
+				it++;
+		}
+
+		ClientParam* param = new ClientParam;
+		param->service = this;
+		param->pipe = pipe;
+		clients.push_back(CreateThread(NULL, 0, clientThread, param, 0, NULL));
+	}
+
+	// Clients waiting for their next request are woken by cancelling the
+	// read, until they see the service has stopped
+	for(auto it=clients.begin(); it!=clients.end(); it++)
+	{
+		while(WaitForSingleObject(*it, 100) == WAIT_TIMEOUT)
+			CancelSynchronousIo(*it);
+		CloseHandle(*it);
+	}
+	for(auto it=workers.begin(); it!=workers.end(); it++)
+	{
+		WaitForSingleObject(*it, INFINITE);
+		CloseHandle(*it);
+	}
+	printf("Morph service stopped\n");
+	printf("Image cache: %d hits, %d misses\n", m_imageCache.getHits(), m_imageCache.getMisses());
+	printf("Kernel cache: %d hits, %d misses\n", m_kernelCache.getHits(), m_kernelCache.getMisses());
+	printf("Result cache: %d hits, %d misses\n", m_resultCache.getHits(), m_resultCache.getMisses());
+	return true;
+}
+
+void CMorphService::shutdown()
+{
+	EnterCriticalSection(&m_lock);
+	m_isRunning = false;
+	WakeAllConditionVariable(&m_jobQueued);
+	WakeAllConditionVariable(&m_jobProgress);
+	LeaveCriticalSection(&m_lock);
+
+	// Unblock the accept loop
+	HANDLE pipe = CreateFileA(m_pipeName.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL,
+		OPEN_EXISTING, 0, NULL);
+	if(pipe != INVALID_HANDLE_VALUE)
+		CloseHandle(pipe);
+}
+
+DWORD WINAPI CMorphService::clientThread( LPVOID param )
+{
+	ClientParam* client = (ClientParam*)param;
+	client->service->serveClient(client->pipe);
+	delete client;
+	return 0;
+}
+
+DWORD WINAPI CMorphService::workerThread( LPVOID param )
+{
+	((CMorphService*)param)->work();
+	return 0;
+}
+
+//---------------------------------------------------------------------------
+// Client requests
+//---------------------------------------------------------------------------
+void CMorphService::serveClient( HANDLE pipe )
+{
+	string request;
+	while(m_isRunning && readRequest(pipe, &request))
+	{
+		vector<string> args;
+		splitRequest(request, &args);
+		if(args.empty())
+			continue;
+
+		if(args[0] == "SUBMIT")
+			onSubmit(pipe, args);
+		else if(args[0] == "STATUS")
+			onStatus(pipe, args);
+		else if(args[0] == "WATCH")
+			onWatch(pipe, args);
+		else if(args[0] == "FETCH")
+			onFetch(pipe, args);
+		else if(args[0] == "CANCEL")
+			onCancel(pipe, args);
+		else if(args[0] == "RELEASE")
+			onRelease(pipe, args);
+		else if(args[0] == "SHUTDOWN")
+		{
+			writeResponse(pipe, "OK\n");
+			shutdown();
+			break;
+		}
+		else
+			writeResponse(pipe, "ERROR Unknown request %s\n", args[0].c_str());
+	}
+
+	FlushFileBuffers(pipe);
+	DisconnectNamedPipe(pipe);
+	CloseHandle(pipe);
+}
+
+bool CMorphService::readRequest( HANDLE pipe, string* request )
+{
+	request->clear();
+	char ch;
+	DWORD bytesRead;
+	while(ReadFile(pipe, &ch, 1, &bytesRead, NULL) && bytesRead == 1)
+	{
+		if(ch == '\n')
+			return true;
+		if(ch != '\r')
+			request->push_back(ch);
+	}
+	return false;
+}
+
+bool CMorphService::writeResponse( HANDLE pipe, const char* format, ... )
+{
+	char buffer[1024];
+	va_list args;
+	va_start(args, format);
+	int length = _vsnprintf(buffer, sizeof(buffer) - 1, format, args);
+	va_end(args);
+	if(length < 0)
+		length = sizeof(buffer) - 1;
+
+	DWORD written;
+	return WriteFile(pipe, buffer, length, &written, NULL) && written == (DWORD)length;
+}
+
+void CMorphService::onSubmit( HANDLE pipe, const vector<string>& args )
+{
+	Job* job = new Job;
+	job->priority = PRIORITY_BATCH;
+	job->frameCount = FRAMERATE*DURATION+1;
+	job->a = WARP_A;
+	job->b = WARP_B;
+	job->p = WARP_P;
+
+	for(size_t i=1; i<args.size(); i++)
+	{
+		size_t split = args[i].find('=');
+		string key = args[i].substr(0, split);
+		string value = split == string::npos ? "" : args[i].substr(split + 1);
+		if(key == "imageA")
+			job->imageFile[0] = value;
+		else if(key == "imageB")
+			job->imageFile[1] = value;
+		else if(key == "linesA")
+			job->lineFile[0] = value;
+		else if(key == "linesB")
+			job->lineFile[1] = value;
+		else if(key == "priority" && (value == "preview" || value == "batch"))
+			job->priority = value == "preview" ? PRIORITY_PREVIEW : PRIORITY_BATCH;
+		else if(key == "frames")
+			job->frameCount = atoi(value.c_str());
+		else if(key == "a")
+			job->a = (float)atof(value.c_str());
+		else if(key == "b")
+			job->b = (float)atof(value.c_str());
+		else if(key == "p")
+			job->p = (float)atof(value.c_str());
+		else
+		{
+			writeResponse(pipe, "ERROR Unknown argument %s\n", args[i].c_str());
+			delete job;
+			return;
+		}
+	}
+	if(job->imageFile[0].empty() || job->imageFile[1].empty() || job->frameCount < 2)
+	{
+		writeResponse(pipe, "ERROR Two images and at least 2 frames are required\n");
+		delete job;
+		return;
+	}
+
+	// Line files default to the image's .mlb or .mld file
+	for(int i=0; i<2; i++)
+		if(job->lineFile[i].empty())
+			job->lineFile[i] = getLineFilename(job->imageFile[i]);
+
+	job->state = JOB_QUEUED;
+	job->framesDone = 0;
+	job->isCancelled = false;
+	InitializeCriticalSection(&job->storeLock);
+	shared_ptr<Job> entry(job, releaseJob);
+
+	EnterCriticalSection(&m_lock);
+	job->id = m_nextJobId++;
+	m_jobList[job->id] = entry;
+	m_queue.push_back(entry);
+	retireJobs();
+	WakeConditionVariable(&m_jobQueued);
+	LeaveCriticalSection(&m_lock);
+
+	writeResponse(pipe, "OK %d\n", job->id);
+}
+
+void CMorphService::onStatus( HANDLE pipe, const vector<string>& args )
+{
+	shared_ptr<Job> job = findJob(args);
+	if(!job)
+	{
+		writeResponse(pipe, "ERROR Unknown job\n");
+		return;
+	}
+
+	EnterCriticalSection(&m_lock);
+	JobState state = job->state;
+	int framesDone = job->framesDone;
+	LeaveCriticalSection(&m_lock);
+
+	writeResponse(pipe, "OK %s %d %d\n", getStateName(state), framesDone, job->frameCount);
+}
+
+//---------------------------------------------------------------------------
+// Stream progress lines until the job finishes
+//---------------------------------------------------------------------------
+void CMorphService::onWatch( HANDLE pipe, const vector<string>& args )
+{
+	shared_ptr<Job> job = findJob(args);
+	if(!job)
+	{
+		writeResponse(pipe, "ERROR Unknown job\n");
+		return;
+	}
+
+	int reported = -1;
+	EnterCriticalSection(&m_lock);
+	while(true)
+	{
+		int framesDone = job->framesDone;
+		if(framesDone != reported)
+		{
+			LeaveCriticalSection(&m_lock);
+			if(!writeResponse(pipe, "PROGRESS %d %d\n", framesDone, job->frameCount))
+				return;
+			reported = framesDone;
+			EnterCriticalSection(&m_lock);
+			continue;
+		}
+		if(isFinished(job->state) || !m_isRunning)
+			break;
+		SleepConditionVariableCS(&m_jobProgress, &m_lock, INFINITE);
+	}
+	JobState state = job->state;
+	LeaveCriticalSection(&m_lock);
+
+	writeResponse(pipe, "OK %s\n", getStateName(state));
+}
+
+void CMorphService::onFetch( HANDLE pipe, const vector<string>& args )
+{
+	shared_ptr<Job> job = findJob(args);
+	if(!job || args.size() < 3)
+	{
+		writeResponse(pipe, "ERROR Unknown job\n");
+		return;
+	}
+
+	// Copy the frame out so the worker is not blocked while it is sent
+	int index = atoi(args[2].c_str());
+	vector<char> frame;
+	EnterCriticalSection(&job->storeLock);
+	const char* data = job->store.getFrame(index);
+	if(data != NULL)
+		frame.assign(data, data + job->store.getFrameSize());
+	LeaveCriticalSection(&job->storeLock);
+
+	if(frame.empty())
+	{
+		writeResponse(pipe, "ERROR Frame %d is not ready\n", index);
+		return;
+	}
+
+	if(!writeResponse(pipe, "OK %d %d %d\n", job->width, job->height, (int)frame.size()))
+		return;
+	DWORD written;
+	if(!WriteFile(pipe, &frame[0], frame.size(), &written, NULL) || written != frame.size())
+		fprintf(stderr, "Error: Cannot send frame %d of job %d\n", index, job->id);
+}
+
+void CMorphService::onCancel( HANDLE pipe, const vector<string>& args )
+{
+	shared_ptr<Job> job = findJob(args);
+	if(!job)
+	{
+		writeResponse(pipe, "ERROR Unknown job\n");
+		return;
+	}
+
+	EnterCriticalSection(&m_lock);
+	job->isCancelled = true;
+	if(job->state == JOB_QUEUED)
+	{
+		m_queue.remove(job);
+		job->state = JOB_CANCELLED;
+	}
+	WakeAllConditionVariable(&m_jobProgress);
+	LeaveCriticalSection(&m_lock);
+
+	writeResponse(pipe, "OK\n");
+}
+
+//---------------------------------------------------------------------------
+// Drop a job and its frames, cancelling it first if it has not finished.
+// A worker still rendering it frees it once it stops.
+//---------------------------------------------------------------------------
+void CMorphService::onRelease( HANDLE pipe, const vector<string>& args )
+{
+	shared_ptr<Job> job = findJob(args);
+	if(!job)
+	{
+		writeResponse(pipe, "ERROR Unknown job\n");
+		return;
+	}
+
+	EnterCriticalSection(&m_lock);
+	job->isCancelled = true;
+	if(job->state == JOB_QUEUED)
+	{
+		m_queue.remove(job);
+		job->state = JOB_CANCELLED;
+	}
+	m_jobList.erase(job->id);
+	WakeAllConditionVariable(&m_jobProgress);
+	LeaveCriticalSection(&m_lock);
+
+	writeResponse(pipe, "OK\n");
+}
+
+shared_ptr<CMorphService::Job> CMorphService::findJob( const vector<string>& args )
+{
+	shared_ptr<Job> job;
+	if(args.size() < 2)
+		return job;
+
+	EnterCriticalSection(&m_lock);
+	auto it = m_jobList.find(atoi(args[1].c_str()));
+	if(it != m_jobList.end())
+		job = it->second;
+	LeaveCriticalSection(&m_lock);
+	return job;
+}
+
+const char* CMorphService::getStateName( JobState state )
+{
+	switch(state)
+	{
+	case JOB_QUEUED:
+		return "queued";
+	case JOB_RUNNING:
+		return "running";
+	case JOB_DONE:
+		return "done";
+	case JOB_FAILED:
+		return "failed";
+	case JOB_CANCELLED:
+		return "cancelled";
+	}
+	return "unknown";
+}
+
+bool CMorphService::isFinished( JobState state )
+{
+	return state == JOB_DONE || state == JOB_FAILED || state == JOB_CANCELLED;
+}
+
+//---------------------------------------------------------------------------
+// Deleter of jobs. A retired job is freed once no client or worker holds
+// it any more, and its frame store is deleted with it.
+//---------------------------------------------------------------------------
+void CMorphService::releaseJob( Job* job )
+{
+	job->store.close();
+	if(!job->storeFile.empty())
+		DeleteFileA(job->storeFile.c_str());
+	DeleteCriticalSection(&job->storeLock);
+	delete job;
+}
+
+//---------------------------------------------------------------------------
+// Scheduling
+//---------------------------------------------------------------------------
+
+//---------------------------------------------------------------------------
+// Take the oldest job of the highest priority. Called with m_lock held.
+//---------------------------------------------------------------------------
+shared_ptr<CMorphService::Job> CMorphService::takeJob()
+{
+	auto next = m_queue.begin();
+	for(auto it=m_queue.begin(); it!=m_queue.end(); it++)
+	{
+		if((*it)->priority < (*next)->priority)
+			next = it;
+	}
+	shared_ptr<Job> job = *next;
+	m_queue.erase(next);
+	return job;
+}
+
+//---------------------------------------------------------------------------
+// True if a preview job is queued and no worker is free to take it.
+// Called with m_lock held.
+//---------------------------------------------------------------------------
+bool CMorphService::isPreviewWaiting()
+{
+	if(m_numIdleWorkers > 0)
+		return false;
+	for(auto it=m_queue.begin(); it!=m_queue.end(); it++)
+		if((*it)->priority == PRIORITY_PREVIEW)
+			return true;
+	return false;
+}
+
+//---------------------------------------------------------------------------
+// Retire all but the SERVICE_FINISHED_JOBS newest finished jobs, so a
+// long-running service does not keep every job's frames. Called with
+// m_lock held.
+//---------------------------------------------------------------------------
+void CMorphService::retireJobs()
+{
+	int finishedCount = 0;
+	auto it = m_jobList.end();
+	while(it != m_jobList.begin())
+	{
+		--it;
+		if(isFinished(it->second->state) && ++finishedCount > SERVICE_FINISHED_JOBS)
+			it = m_jobList.erase(it);
+	}
+}
+
+void CMorphService::work()
+{
+	while(true)
+	{
+		EnterCriticalSection(&m_lock);
+		m_numIdleWorkers++;
+		while(m_isRunning && m_queue.empty())
+			SleepConditionVariableCS(&m_jobQueued, &m_lock, INFINITE);
+		m_numIdleWorkers--;
+		if(!m_isRunning)
+		{
+			LeaveCriticalSection(&m_lock);
+			return;
+		}
+		shared_ptr<Job> job = takeJob();
+		job->state = JOB_RUNNING;
+		LeaveCriticalSection(&m_lock);
+
+		runJob(job);
+	}
+}
+
+//---------------------------------------------------------------------------
+// Render the missing frames of a job. A batch job gives up its worker
+// between frames when a preview job is waiting; the frames it already
+// rendered are kept in its store, so it resumes where it stopped.
+//---------------------------------------------------------------------------
+void CMorphService::runJob( const shared_ptr<Job>& job )
+{
+	shared_ptr<PreparedPair> pair = getPreparedPair(job.get());
+	bool isOpen = false;
+	if(pair)
+	{
+		job->width = pair->kernel.getWidth();
+		job->height = pair->kernel.getHeight();
+
+		char filename[64];
+		sprintf(filename, "%s\\job%d.frames", SERVICE_DIR, job->id);
+		EnterCriticalSection(&job->storeLock);
+		isOpen = job->store.getFrameCount() > 0;
+		if(!isOpen)
+		{
+			job->storeFile = filename;
+			isOpen = job->store.open(filename, job->width, job->height, job->frameCount,
+				(__int64)FRAMESTORE_DISK_MB << 20, ((__int64)FRAMESTORE_RAM_MB << 20) / m_numWorkers);
+
+			// Keyed by the job's inputs, so a store left by an earlier run
+			// under the same job id does not serve that job's frames
+			if(isOpen)
+				job->store.setInputHash(hashInt(job->frameCount, pair->inputHash));
+		}
+		LeaveCriticalSection(&job->storeLock);
+	}
+	if(!isOpen)
+	{
+		EnterCriticalSection(&m_lock);
+		job->state = JOB_FAILED;
+		WakeAllConditionVariable(&m_jobProgress);
+		LeaveCriticalSection(&m_lock);
+		return;
+	}
+
+	vector<char> frame(job->width * job->height * 3);
+	for(int i=0; i<job->frameCount; i++)
+	{
+		EnterCriticalSection(&m_lock);
+		if(job->isCancelled)
+		{
+			job->state = JOB_CANCELLED;
+			WakeAllConditionVariable(&m_jobProgress);
+			LeaveCriticalSection(&m_lock);
+			return;
+		}
+		if(job->priority == PRIORITY_BATCH && isPreviewWaiting())
+		{
+			job->state = JOB_QUEUED;
+			m_queue.push_front(job);
+			WakeConditionVariable(&m_jobQueued);
+			LeaveCriticalSection(&m_lock);
+			return;
+		}
+		LeaveCriticalSection(&m_lock);
+
+		EnterCriticalSection(&job->storeLock);
+		bool hasFrame = job->store.hasFrame(i);
+		LeaveCriticalSection(&job->storeLock);
+		if(hasFrame)
+			continue;
+
+		m_resultCache.render(&pair->kernel, pair->inputHash, pair->warpHash,
+			(float)i / (job->frameCount - 1), &frame[0]);
+
+		EnterCriticalSection(&job->storeLock);
+		job->store.writeFrame(i, &frame[0]);
+		LeaveCriticalSection(&job->storeLock);
+
+		EnterCriticalSection(&m_lock);
+		job->framesDone++;
+		WakeAllConditionVariable(&m_jobProgress);
+		LeaveCriticalSection(&m_lock);
+	}
+
+	EnterCriticalSection(&m_lock);
+	job->state = JOB_DONE;
+	WakeAllConditionVariable(&m_jobProgress);
+	LeaveCriticalSection(&m_lock);
+}
+
+//---------------------------------------------------------------------------
+// Caches
+//---------------------------------------------------------------------------
+shared_ptr<IplImage> CMorphService::getImage( const string& filename )
+{
+	shared_ptr<IplImage> image;
+	string key = getFileKey(filename);
+	if(m_imageCache.find(key, &image))
+		return image;
+
+	IplImage* loaded = cvLoadImage(filename.c_str(), CV_LOAD_IMAGE_COLOR);
+	if(loaded == NULL)
+	{
+		fprintf(stderr, "Error: Cannot load image %s\n", filename.c_str());
+		return image;
+	}
+	image = shared_ptr<IplImage>(loaded, releaseImage);
+	m_imageCache.insert(key, image, loaded->imageSize);
+	return image;
+}
+
+shared_ptr< vector<float> > CMorphService::getLines( const string& filename )
+{
+	shared_ptr< vector<float> > lines;
+	string key = getFileKey(filename);
+	if(m_lineCache.find(key, &lines))
+		return lines;
+
+	lines = shared_ptr< vector<float> >(new vector<float>);
+	if(!loadLineFile(filename.c_str(), lines.get()))
+	{
+		fprintf(stderr, "Error: Cannot load lines %s\n", filename.c_str());
+		return shared_ptr< vector<float> >();
+	}
+	m_lineCache.insert(key, lines, lines->size() * sizeof(float));
+	return lines;
+}
+
+shared_ptr<CMorphService::PreparedPair> CMorphService::getPreparedPair( Job* job )
+{
+	char params[64];
+	sprintf(params, "|%g|%g|%g", job->a, job->b, job->p);
+	string key = getFileKey(job->imageFile[0]) + "|" + getFileKey(job->lineFile[0]) + "|" +
+		getFileKey(job->imageFile[1]) + "|" + getFileKey(job->lineFile[1]) + params;
+
+	shared_ptr<PreparedPair> pair;
+	if(m_kernelCache.find(key, &pair))
+		return pair;
+
+	pair = shared_ptr<PreparedPair>(new PreparedPair);
+	pair->imageA = getImage(job->imageFile[0]);
+	pair->imageB = getImage(job->imageFile[1]);
+	pair->linesA = getLines(job->lineFile[0]);
+	pair->linesB = getLines(job->lineFile[1]);
+	if(!pair->imageA || !pair->imageB || !pair->linesA || !pair->linesB)
+		return shared_ptr<PreparedPair>();
+	if(pair->imageA->width != pair->imageB->width || pair->imageA->height != pair->imageB->height ||
+		pair->linesA->size() != pair->linesB->size())
+	{
+		fprintf(stderr, "Error: Job %d images or line sets do not match\n", job->id);
+		return shared_ptr<PreparedPair>();
+	}
+
+	int numLines = pair->linesA->size() / 4;
+	pair->kernel.setImages(pair->imageA.get(), pair->imageB.get());
+	if(numLines > 0)
+		pair->kernel.setLines(&(*pair->linesA)[0], &(*pair->linesB)[0], numLines);
+	pair->kernel.setParameters(job->a, job->b, job->p);
+
+	pair->warpHash = HASH_SEED;
+	if(numLines > 0)
+	{
+		pair->warpHash = hashBytes(&(*pair->linesA)[0], numLines * 4 * sizeof(float));
+		pair->warpHash = hashBytes(&(*pair->linesB)[0], numLines * 4 * sizeof(float), pair->warpHash);
+	}
+	pair->warpHash = hashFloat(job->a, pair->warpHash);
+	pair->warpHash = hashFloat(job->b, pair->warpHash);
+	pair->warpHash = hashFloat(job->p, pair->warpHash);
+	pair->inputHash = hashBytes(pair->imageA->imageData, pair->imageA->imageSize, pair->warpHash);
+	pair->inputHash = hashBytes(pair->imageB->imageData, pair->imageB->imageSize, pair->inputHash);
+	m_kernelCache.insert(key, pair, 1);
+	return pair;
+}
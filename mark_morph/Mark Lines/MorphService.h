@@ -0,0 +1,159 @@
+/////////////////////////////////////////////////////////////////////////////
+// File: MorphService.h
+//
+// Morph service
+// CMorphService runs as a long-lived process and accepts morph jobs over
+// a local named pipe. Decoded images, line sets and prepared kernels are
+// kept in LRU caches across jobs, so repeated pairs skip decoding and
+// line parsing. Files are cached by name, last write time and size, so
+// files edited between jobs are loaded again. Preview jobs are scheduled
+// ahead of batch jobs, and a running batch job yields its worker when a
+// preview job is waiting.
+//
+// Requests are single text lines, answered with a line starting with OK
+// or ERROR:
+//   SUBMIT imageA=<file> imageB=<file> [linesA=<file>] [linesB=<file>]
+//          [priority=preview|batch] [frames=n] [a=f] [b=f] [p=f]
+//                               -> OK <job>
+//   STATUS <job>                -> OK <state> <framesDone> <frameCount>
+//   WATCH <job>                 -> PROGRESS <framesDone> <frameCount> ...
+//                                  then OK <state>
+//   FETCH <job> <frame>         -> OK <width> <height> <bytes>, followed
+//                                  by the raw BGR frame
+//   CANCEL <job>                -> OK
+//   RELEASE <job>               -> OK, the job and its frames are dropped
+//   SHUTDOWN                    -> OK
+//
+// Jobs render through the same content-addressed result cache as batch
+// mode, so frames already rendered by any job or batch run are reused.
+// Each job's frames are kept in its own store until it is released, or
+// until SERVICE_FINISHED_JOBS newer jobs have finished.
+//
+// Usage: -service [-workers n] [-pipe name] [-cache dir] [-fields]
+//
+// Author: Leon Ho
+/////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <windows.h>
+#include <list>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cv.h>
+#include "FrameStore.h"
+#include "LruCache.h"
+#include "MorphKernel.h"
+#include "ResultCache.h"
+
+using namespace std;
+
+class CMorphService
+{
+private:
+	enum JobPriority
+	{
+		PRIORITY_PREVIEW,
+		PRIORITY_BATCH
+	};
+
+	enum JobState
+	{
+		JOB_QUEUED,
+		JOB_RUNNING,
+		JOB_DONE,
+		JOB_FAILED,
+		JOB_CANCELLED
+	};
+
+	// A kernel together with the cached inputs it points into
+	struct PreparedPair
+	{
+		shared_ptr<IplImage> imageA, imageB;
+		shared_ptr< vector<float> > linesA, linesB;
+		CMorphKernel kernel;
+		hash64 inputHash;		// Images, lines and warp parameters
+		hash64 warpHash;		// Lines and warp parameters only
+	};
+
+	struct Job
+	{
+		int id;
+		JobPriority priority;
+		string imageFile[2], lineFile[2];
+		float a, b, p;
+		int frameCount;
+		int width, height;
+
+		JobState state;
+		int framesDone;
+		bool isCancelled;
+
+		CFrameStore store;
+		string storeFile;
+		CRITICAL_SECTION storeLock;
+	};
+
+private:
+	string m_pipeName, m_cacheDir;
+	int m_numWorkers;
+	bool m_isCachingFields;
+	bool m_isRunning;
+
+	// Warm caches shared by all jobs
+	CLruCache< string, shared_ptr<IplImage> > m_imageCache;
+	CLruCache< string, shared_ptr< vector<float> > > m_lineCache;
+	CLruCache< string, shared_ptr<PreparedPair> > m_kernelCache;
+	CResultCache m_resultCache;
+
+	// Job state, guarded by m_lock
+	CRITICAL_SECTION m_lock;
+	CONDITION_VARIABLE m_jobQueued;
+	CONDITION_VARIABLE m_jobProgress;
+	map< int, shared_ptr<Job> > m_jobList;
+	list< shared_ptr<Job> > m_queue;
+	int m_nextJobId;
+	int m_numIdleWorkers;
+
+public:
+	bool parseArgs(int argc, char* argv[]);
+	bool run();
+
+	CMorphService(void);
+	~CMorphService(void);
+
+private:
+	// Client connections
+	void serveClient(HANDLE pipe);
+	bool readRequest(HANDLE pipe, string* request);
+	bool writeResponse(HANDLE pipe, const char* format, ...);
+	void onSubmit(HANDLE pipe, const vector<string>& args);
+	void onStatus(HANDLE pipe, const vector<string>& args);
+	void onWatch(HANDLE pipe, const vector<string>& args);
+	void onFetch(HANDLE pipe, const vector<string>& args);
+	void onCancel(HANDLE pipe, const vector<string>& args);
+	void onRelease(HANDLE pipe, const vector<string>& args);
+	void shutdown();
+
+	// Scheduling
+	shared_ptr<Job> findJob(const vector<string>& args);
+	shared_ptr<Job> takeJob();
+	bool isPreviewWaiting();
+	void retireJobs();
+	void work();
+	void runJob(const shared_ptr<Job>& job);
+
+	// Caches
+	shared_ptr<IplImage> getImage(const string& filename);
+	shared_ptr< vector<float> > getLines(const string& filename);
+	shared_ptr<PreparedPair> getPreparedPair(Job* job);
+
+	static DWORD WINAPI clientThread(LPVOID param);
+	static DWORD WINAPI workerThread(LPVOID param);
+	static const char* getStateName(JobState state);
+	static bool isFinished(JobState state);
+	static void releaseJob(Job* job);
+	void printUsage();
+};
@@ -0,0 +1,226 @@
+/////////////////////////////////////////////////////////////////////////////
+// File: Overlay.cpp
+//
+// Batched line overlay
+// COverlay draws the points, segments and line numbers of an edit window
+// from one vertex buffer with three draw calls. Line numbers are drawn as
+// textured quads from a glyph atlas baked once from a GLUT bitmap font,
+// instead of one glutBitmapCharacter call per digit. The buffer is only
+// rebuilt when the lines or the view change. If the atlas cannot be baked,
+// line numbers fall back to gltext.
+//
+// Author: Leon Ho
+/////////////////////////////////////////////////////////////////////////////
+
+#include "Overlay.h"
+#include "gltext.h"
+#include "shader_util.h"
+#include <stdio.h>
+
+const int GLYPH_DESCENT = 4;	// Room below the baseline in an atlas cell
+
+COverlay::COverlay(void)
+{
+	m_atlas = 0;
+	m_buffer = 0;
+	m_cellWidth = m_cellHeight = 0;
+	m_baseline = GLYPH_DESCENT;
+	m_numPoints = m_numLineVertices = m_numGlyphVertices = 0;
+}
+
+//---------------------------------------------------------------------------
+// The window's GL context must be current, as for init.
+//---------------------------------------------------------------------------
+COverlay::~COverlay(void)
+{
+	release();
+}
+
+void COverlay::release()
+{
+	if(m_atlas != 0)
+		glDeleteTextures( 1, &m_atlas );
+	if(m_buffer != 0)
+		glDeleteBuffers( 1, &m_buffer );
+	m_atlas = m_buffer = 0;
+	m_vertexList.clear();
+	m_labelList.clear();
+}
+
+//---------------------------------------------------------------------------
+// Bake the digits of a GLUT bitmap font into the atlas by drawing them into
+// an offscreen framebuffer, one cell per digit. Needs the window's GL
+// context to be current. Returns false if the atlas cannot be baked, in
+// which case the overlay still draws, with line numbers from gltext.
+//---------------------------------------------------------------------------
+bool COverlay::init( void* font )
+{
+	release();
+	glGenBuffers( 1, &m_buffer );
+
+	m_cellWidth = 0;
+	for(int i=0; i<10; i++)
+	{
+		m_glyphAdvance[i] = glutBitmapWidth(font, '0' + i);
+		if(m_glyphAdvance[i] > m_cellWidth)
+			m_cellWidth = m_glyphAdvance[i];
+	}
+	m_cellHeight = GetFontHeight(font) + GLYPH_DESCENT;
+	int atlasWidth = m_cellWidth * 10;
+
+	glGenTextures( 1, &m_atlas );
+	glBindTexture( GL_TEXTURE_2D, m_atlas );
+	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST );
+	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST );
+	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP );
+	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP );
+	glTexImage2D( GL_TEXTURE_2D, 0, GL_RGBA8,
+		atlasWidth, m_cellHeight, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL );
+	glBindTexture( GL_TEXTURE_2D, 0 );
+
+	GLuint fbo;
+	glGenFramebuffersEXT( 1, &fbo );
+	glBindFramebufferEXT( GL_FRAMEBUFFER_EXT, fbo );
+	glFramebufferTexture2DEXT( GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT,
+		GL_TEXTURE_2D, m_atlas, 0 );
+	if(glCheckFramebufferStatusEXT( GL_FRAMEBUFFER_EXT ) != GL_FRAMEBUFFER_COMPLETE_EXT)
+	{
+		fprintf(stderr, "Error: Cannot create glyph atlas\n");
+		glBindFramebufferEXT( GL_FRAMEBUFFER_EXT, 0 );
+		glDeleteFramebuffersEXT( 1, &fbo );
+		glDeleteTextures( 1, &m_atlas );
+		m_atlas = 0;
+		return false;
+	}
+
+	// Glyphs are drawn white on transparent, to be tinted when drawn
+	glPushAttrib( GL_VIEWPORT_BIT | GL_COLOR_BUFFER_BIT | GL_CURRENT_BIT | GL_ENABLE_BIT );
+	glMatrixMode( GL_PROJECTION );
+	glPushMatrix();
+	glLoadIdentity();
+	gluOrtho2D( 0, atlasWidth, 0, m_cellHeight );
+	glMatrixMode( GL_MODELVIEW );
+	glPushMatrix();
+	glLoadIdentity();
+	glViewport( 0, 0, atlasWidth, m_cellHeight );
+	glDisable( GL_TEXTURE_2D );
+	glClearColor( 0, 0, 0, 0 );
+	glClear( GL_COLOR_BUFFER_BIT );
+	glColor4f( 1, 1, 1, 1 );
+	for(int i=0; i<10; i++)
+	{
+		glRasterPos2i( i * m_cellWidth, m_baseline );
+		glutBitmapCharacter( font, '0' + i );
+	}
+	glMatrixMode( GL_PROJECTION );
+	glPopMatrix();
+	glMatrixMode( GL_MODELVIEW );
+	glPopMatrix();
+	glPopAttrib();
+
+	glBindFramebufferEXT( GL_FRAMEBUFFER_EXT, 0 );
+	glDeleteFramebuffersEXT( 1, &fbo );
+	printOpenGLError();
+	return true;
+}
+
+//---------------------------------------------------------------------------
+// Lay out every vertex as a point, every line as a segment and every line
+// number as glyph quads, in window coordinates, and upload them. Line
+// numbers sit at the start of their line like gltext would draw them.
+//---------------------------------------------------------------------------
+void COverlay::build( const vector<CvPoint2D32f>& vertices, const vector<LineIndex>& lines,
+	float scale, float offsetX, float offsetY )
+{
+	m_vertexList.clear();
+	for(auto it=vertices.begin(); it!=vertices.end(); it++)
+	{
+		Vertex vertex = {offsetX + it->x * scale, offsetY + it->y * scale, 0, 0};
+		m_vertexList.push_back(vertex);
+	}
+	m_numPoints = m_vertexList.size();
+
+	for(auto it=lines.begin(); it!=lines.end(); it++)
+	{
+		Vertex start = m_vertexList[it->start];
+		Vertex end = m_vertexList[it->end];
+		m_vertexList.push_back(start);
+		m_vertexList.push_back(end);
+	}
+	m_numLineVertices = m_vertexList.size() - m_numPoints;
+
+	char label[16];
+	m_labelList.clear();
+	for(int i=0; i<(int)lines.size(); i++)
+	{
+		const CvPoint2D32f& start = vertices[lines[i].start];
+		int x = (int)(start.x * scale + offsetX);
+		int y = (int)(start.y * scale + offsetY);
+		if(m_atlas == 0)
+		{
+			Label fallback = {x, y, i+1};
+			m_labelList.push_back(fallback);
+			continue;
+		}
+		sprintf(label, "%d", i+1);
+		for(char* c=label; *c; c++)
+		{
+			addGlyph(*c - '0', x, y);
+			x += m_glyphAdvance[*c - '0'];
+		}
+	}
+	m_numGlyphVertices = m_vertexList.size() - m_numPoints - m_numLineVertices;
+
+	glBindBuffer( GL_ARRAY_BUFFER, m_buffer );
+	glBufferData( GL_ARRAY_BUFFER, m_vertexList.size() * sizeof(Vertex),
+		m_vertexList.empty() ? NULL : &m_vertexList[0], GL_DYNAMIC_DRAW );
+	glBindBuffer( GL_ARRAY_BUFFER, 0 );
+}
+
+void COverlay::addGlyph( int digit, int x, int y )
+{
+	float u0 = (float)digit / 10;
+	float u1 = (float)(digit + 1) / 10;
+	float x0 = (float)x;
+	float y0 = (float)(y - m_baseline);
+	float x1 = x0 + m_cellWidth;
+	float y1 = y0 + m_cellHeight;
+	Vertex quad[4] = {{x0, y0, u0, 0}, {x0, y1, u0, 1}, {x1, y1, u1, 1}, {x1, y0, u1, 0}};
+	m_vertexList.insert(m_vertexList.end(), quad, quad + 4);
+}
+
+void COverlay::draw( const float* color, float pointSize )
+{
+	if(m_vertexList.empty())
+		return;
+
+	glBindBuffer( GL_ARRAY_BUFFER, m_buffer );
+	glEnableClientState( GL_VERTEX_ARRAY );
+	glVertexPointer( 2, GL_FLOAT, sizeof(Vertex), (void*)0 );
+	glColor3fv( color );
+
+	// Points and segments
+	glBindTexture( GL_TEXTURE_2D, 0 );
+	glPointSize( pointSize );
+	glDrawArrays( GL_POINTS, 0, m_numPoints );
+	glDrawArrays( GL_LINES, m_numPoints, m_numLineVertices );
+
+	// Line numbers, tinted with the overlay color
+	glEnableClientState( GL_TEXTURE_COORD_ARRAY );
+	glTexCoordPointer( 2, GL_FLOAT, sizeof(Vertex), (void*)(2 * sizeof(float)) );
+	glBindTexture( GL_TEXTURE_2D, m_atlas );
+	glTexEnvi( GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE );
+	glEnable( GL_BLEND );
+	glBlendFunc( GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA );
+	glDrawArrays( GL_QUADS, m_numPoints + m_numLineVertices, m_numGlyphVertices );
+	glDisable( GL_BLEND );
+	glTexEnvi( GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE );
+	glBindTexture( GL_TEXTURE_2D, 0 );
+
+	glDisableClientState( GL_TEXTURE_COORD_ARRAY );
+	glDisableClientState( GL_VERTEX_ARRAY );
+	glBindBuffer( GL_ARRAY_BUFFER, 0 );
+
+	for(auto it=m_labelList.begin(); it!=m_labelList.end(); it++)
+		gltext(it->x, it->y, "%d", it->number);
+}
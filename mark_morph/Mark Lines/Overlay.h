@@ -0,0 +1,62 @@
+/////////////////////////////////////////////////////////////////////////////
+// File: Overlay.h
+//
+// Batched line overlay
+// COverlay draws the points, segments and line numbers of an edit window
+// from one vertex buffer with three draw calls. Line numbers are drawn as
+// textured quads from a glyph atlas baked once from a GLUT bitmap font,
+// instead of one glutBitmapCharacter call per digit. The buffer is only
+// rebuilt when the lines or the view change. If the atlas cannot be baked,
+// line numbers fall back to gltext.
+//
+// Author: Leon Ho
+/////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <vector>
+#include <cv.h>
+#include <GL/glew.h>
+#include <GL/glut.h>
+#include "line_io.h"
+
+using namespace std;
+
+class COverlay
+{
+private:
+	struct Vertex
+	{
+		float x, y;
+		float u, v;
+	};
+
+	struct Label
+	{
+		int x, y;
+		int number;
+	};
+
+private:
+	GLuint m_atlas, m_buffer;
+	int m_cellWidth, m_cellHeight;	// Atlas cell of each digit in pixels
+	int m_glyphAdvance[10];
+	int m_baseline;					// Height of the baseline in a cell
+
+	vector<Vertex> m_vertexList;
+	int m_numPoints, m_numLineVertices, m_numGlyphVertices;
+	vector<Label> m_labelList;		// Line numbers drawn with gltext when there is no atlas
+
+public:
+	bool init(void* font);
+	void release();
+	void build(const vector<CvPoint2D32f>& vertices, const vector<LineIndex>& lines,
+		float scale, float offsetX, float offsetY);
+	void draw(const float* color, float pointSize);
+
+	COverlay(void);
+	~COverlay(void);
+
+private:
+	void addGlyph(int digit, int x, int y);
+};
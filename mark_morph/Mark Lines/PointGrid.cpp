@@ -0,0 +1,80 @@
+/////////////////////////////////////////////////////////////////////////////
+// File: PointGrid.cpp
+//
+// Uniform grid of points
+// CPointGrid buckets point IDs into square cells, so finding the points
+// near a position only looks at the few cells the search box overlaps
+// instead of every point.
+//
+// Author: Leon Ho
+/////////////////////////////////////////////////////////////////////////////
+
+#include "PointGrid.h"
+#include <math.h>
+
+CPointGrid::CPointGrid( float cellSize )
+{
+	m_cellSize = cellSize > 0 ? cellSize : 1;
+	m_count = 0;
+}
+
+CPointGrid::~CPointGrid(void)
+{
+}
+
+int CPointGrid::getCell( float value )
+{
+	return (int)floor(value / m_cellSize);
+}
+
+long long CPointGrid::getKey( int cellX, int cellY )
+{
+	return ((long long)cellX << 32) | (unsigned int)cellY;
+}
+
+void CPointGrid::insert( int id, float x, float y )
+{
+	Item item; item.id = id; item.order = m_count++; item.x = x; item.y = y;
+	m_cellList[getKey(getCell(x), getCell(y))].push_back(item);
+}
+
+void CPointGrid::clear()
+{
+	m_cellList.clear();
+	m_count = 0;
+}
+
+//---------------------------------------------------------------------------
+// The search box is the one .mld line ends have always been welded with.
+// With a radius no larger than the cell size it overlaps at most 3x3
+// cells. Inserting points in the order the index buffer lists them gives
+// the same result as scanning the index buffer.
+//---------------------------------------------------------------------------
+int CPointGrid::searchPoint( float x, float y, float radius )
+{
+	float minx = x - radius;
+	float maxx = x + radius;
+	float miny = y - radius;
+	float maxy = y + radius;
+
+	int found = -1, foundOrder = 0;
+	for(int cellX=getCell(minx); cellX<=getCell(maxx); cellX++)
+	{
+		for(int cellY=getCell(miny); cellY<=getCell(maxy); cellY++)
+		{
+			auto cell = m_cellList.find(getKey(cellX, cellY));
+			if(cell == m_cellList.end())
+				continue;
+			for(auto it=cell->second.begin(); it!=cell->second.end(); it++)
+			{
+				if(it->x >= minx && it->x <= maxx && it->y >= miny && it->y <= maxy &&
+					(found == -1 || it->order < foundOrder))
+				{
+					found = it->id;
+					foundOrder = it->order;
+				}
+			}
+		}
+	}
+	return found;
+}
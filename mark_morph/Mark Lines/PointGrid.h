@@ -0,0 +1,47 @@
+/////////////////////////////////////////////////////////////////////////////
+// File: PointGrid.h
+//
+// Uniform grid of points
+// CPointGrid buckets point IDs into square cells, so finding the points
+// near a position only looks at the few cells the search box overlaps
+// instead of every point.
+//
+// Author: Leon Ho
+/////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+class CPointGrid
+{
+private:
+	struct Item
+	{
+		int id;
+		int order;				// Insertion order
+		float x, y;
+	};
+
+private:
+	float m_cellSize;
+	int m_count;
+	unordered_map< long long, vector<Item> > m_cellList;
+
+public:
+	void insert(int id, float x, float y);
+	void clear();
+
+	// First inserted point within radius of (x, y) along both axes, or -1
+	int searchPoint(float x, float y, float radius);
+
+	CPointGrid(float cellSize);
+	~CPointGrid(void);
+
+private:
+	int getCell(float value);
+	long long getKey(int cellX, int cellY);
+};
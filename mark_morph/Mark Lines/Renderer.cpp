@@ -15,17 +15,37 @@
 #include "ImageMorph.h"
 #include "shader_util.h"
 #include "GLUTWindow.h"
+#include "FrameStore.h"
+#include "gltext.h"
+#include <algorithm>
+#include <float.h>
+#include <math.h>
 
 // Renderer defines
 extern const int FRAMERATE;
 extern const int DURATION;
 extern const int CODEC;
 
+const int LINE_TEXTURE_MIN_CAPACITY = 64;	// Lines the line textures start out holding
+
+// Steps and limits of the warp parameters when tuned from the keyboard
+struct WarpParamRange
+{
+	const char* name;
+	float step, minValue, maxValue;
+};
+const WarpParamRange WARP_PARAM_RANGE[] = {
+	{"a", 0.05f, 0.05f, 5.0f},
+	{"b", 0.25f, 0.0f, 8.0f},
+	{"p", 0.05f, 0.0f, 1.0f}
+};
+
 CRenderer::CRenderer(CImageMorph *app, CMarkUI* imgA, CMarkUI* imgB)
 {
 	m_app = app;
 	m_pImageA = imgA;
 	m_pImageB = imgB;
+	m_frameStore = NULL;
 	m_imgWidth = m_pImageA->getImage()->width;
 	m_imgHeight = m_pImageA->getImage()->height;
 
@@ -37,11 +57,37 @@ CRenderer::CRenderer(CImageMorph *app, CMarkUI* imgA, CMarkUI* imgB)
 	m_isPlaying = false;
 	m_playDirection = 1;
 	m_showDebugLines = false;
+	m_warpSelected = 0;
+	m_showWarpPanel = false;
+	m_isTuning = false;
+	m_lineCapacity = 0;
+	m_numLines = 0;
+	m_tileSize = 0;
+	m_tilesX = m_tilesY = 0;
+	m_renderScale = 1;
+	m_inputVersion = 0;
+	m_texVersion = -1;
+	m_storeVersion = -1;
+	m_texStep = 0;
+	m_isRefining = false;
+	m_refineTime = 0;
+	m_isFilling = false;
+	m_fillTime = 0;
+
+	// Init preview states
+	m_isPreviewing = false;
+	m_isPreviewPending = false;
+	m_previewScale = 1;
+	m_dragTime = -1;
+	m_lastDragTime = m_lastPreviewTime = 0;
+	m_fullRenderTime = 0;
+	m_previewCount = m_previewLatencySum = m_previewLatencyMax = 0;
 
 	// Initialise renderer
 	initGLState();
 	initShader();
 	initTexture();
+	setWarpParameters(WARP_A, WARP_B, WARP_P);
 }
 
 CRenderer::~CRenderer(void)
@@ -95,63 +141,52 @@ void CRenderer::initShader()
 //---------------------------------------------------------------------------
 void CRenderer::initTexture()
 {
-	// Create texture A.
-	glActiveTexture( GL_TEXTURE0 );
-	glGenTextures( 1, &m_texA );
-	glBindTexture( GL_TEXTURE_RECTANGLE_ARB, m_texA );
-	glTexParameteri( GL_TEXTURE_RECTANGLE_ARB, GL_TEXTURE_MIN_FILTER, GL_LINEAR );
-	glTexParameteri( GL_TEXTURE_RECTANGLE_ARB, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
-	glTexParameteri( GL_TEXTURE_RECTANGLE_ARB, GL_TEXTURE_WRAP_S, GL_CLAMP );
-	glTexParameteri( GL_TEXTURE_RECTANGLE_ARB, GL_TEXTURE_WRAP_T, GL_CLAMP );
-	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-	glTexImage2D( GL_TEXTURE_RECTANGLE_ARB, 0, GL_RGB,
-		m_imgWidth, m_imgHeight, 0, GL_BGR, GL_UNSIGNED_BYTE, m_pImageA->getImageData());
-	printOpenGLError();
-
-	// Create texture B.
-	glGenTextures( 1, &m_texB );
-	glBindTexture( GL_TEXTURE_RECTANGLE_ARB, m_texB );
-	glTexParameteri( GL_TEXTURE_RECTANGLE_ARB, GL_TEXTURE_MIN_FILTER, GL_LINEAR );
-	glTexParameteri( GL_TEXTURE_RECTANGLE_ARB, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
-	glTexParameteri( GL_TEXTURE_RECTANGLE_ARB, GL_TEXTURE_WRAP_S, GL_CLAMP );
-	glTexParameteri( GL_TEXTURE_RECTANGLE_ARB, GL_TEXTURE_WRAP_T, GL_CLAMP );
-	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-	glTexImage2D( GL_TEXTURE_RECTANGLE_ARB, 0, GL_RGB,
-		m_imgWidth, m_imgHeight, 0, GL_BGR, GL_UNSIGNED_BYTE, m_pImageB->getImageData());
-	printOpenGLError();
+	// Faces are paged in through virtual textures, so they are not limited
+	// to the largest texture the driver takes
+	GLint maxTextureSize;
+	glGetIntegerv( GL_MAX_TEXTURE_SIZE, &maxTextureSize );
+	int atlasSize = min((int)maxTextureSize, VTEX_ATLAS_SIZE);
+	if(!m_pagesA.init(m_pImageA->getPyramid(), atlasSize) || !m_pagesB.init(m_pImageB->getPyramid(), atlasSize))
+	{
+		fprintf( stderr, "Error: Cannot create face textures.\n" );
+		char ch; scanf( "%c", &ch ); // Prevents the console window from closing.
+		exit( 1 );
+	}
+	m_pageKernel.setImageSize(m_imgWidth, m_imgHeight);
 
 	// Set image parameters in shader
-	GLint uniTexA = glGetUniformLocation( m_morphProg, "TexA" );
-	glUniform1i( uniTexA, 0 );
-	GLint uniTexB = glGetUniformLocation( m_morphProg, "TexB" );
-	glUniform1i( uniTexB, 1 );
+	GLint uniPagesA = glGetUniformLocation( m_morphProg, "PagesA" );
+	glUniform1i( uniPagesA, 0 );
+	GLint uniPagesB = glGetUniformLocation( m_morphProg, "PagesB" );
+	glUniform1i( uniPagesB, 1 );
+	GLint uniPageTableA = glGetUniformLocation( m_morphProg, "PageTableA" );
+	glUniform1i( uniPageTableA, 4 );
+	GLint uniPageTableB = glGetUniformLocation( m_morphProg, "PageTableB" );
+	glUniform1i( uniPageTableB, 5 );
+	GLint uniLevelCount = glGetUniformLocation( m_morphProg, "LevelCount" );
+	glUniform1f( uniLevelCount, (float)m_pagesA.getLevelCount() );
 	GLint uniTexWidthLoc = glGetUniformLocation( m_morphProg, "TexWidth" );
 	glUniform1f( uniTexWidthLoc, (float)m_imgWidth );
 	GLint uniTexHeightLoc = glGetUniformLocation( m_morphProg, "TexHeight" );
 	glUniform1f( uniTexHeightLoc, (float)m_imgHeight );
+	GLint uniPixelScale = glGetUniformLocation( m_morphProg, "PixelScale" );
+	glUniform1f( uniPixelScale, 1.0f );
 
-	// Upload line A to GPU
+	// Create line textures. Lines are uploaded by setLines.
 	glGenTextures( 1, &m_texLineA );
 	glBindTexture( GL_TEXTURE_RECTANGLE_ARB, m_texLineA );
 	glTexParameteri( GL_TEXTURE_RECTANGLE_ARB, GL_TEXTURE_MIN_FILTER, GL_NEAREST );
 	glTexParameteri( GL_TEXTURE_RECTANGLE_ARB, GL_TEXTURE_MAG_FILTER, GL_NEAREST );
 	glTexParameteri( GL_TEXTURE_RECTANGLE_ARB, GL_TEXTURE_WRAP_S, GL_CLAMP );
 	glTexParameteri( GL_TEXTURE_RECTANGLE_ARB, GL_TEXTURE_WRAP_T, GL_CLAMP );
-	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-	glTexImage2D( GL_TEXTURE_RECTANGLE_ARB, 0, GL_RGBA32F_ARB,
-		m_pImageA->getNumLines(), 1, 0, GL_RGBA, GL_FLOAT, m_pImageA->getPackedLine());
-	printOpenGLError();
 
-	// Upload line B to GPU
 	glGenTextures( 1, &m_texLineB );
 	glBindTexture( GL_TEXTURE_RECTANGLE_ARB, m_texLineB );
 	glTexParameteri( GL_TEXTURE_RECTANGLE_ARB, GL_TEXTURE_MIN_FILTER, GL_NEAREST );
 	glTexParameteri( GL_TEXTURE_RECTANGLE_ARB, GL_TEXTURE_MAG_FILTER, GL_NEAREST );
 	glTexParameteri( GL_TEXTURE_RECTANGLE_ARB, GL_TEXTURE_WRAP_S, GL_CLAMP );
 	glTexParameteri( GL_TEXTURE_RECTANGLE_ARB, GL_TEXTURE_WRAP_T, GL_CLAMP );
-	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-	glTexImage2D( GL_TEXTURE_RECTANGLE_ARB, 0, GL_RGBA32F_ARB,
-		m_pImageB->getNumLines(), 1, 0, GL_RGBA, GL_FLOAT, m_pImageB->getPackedLine() );
+	allocLineTextures(LINE_TEXTURE_MIN_CAPACITY);
 	printOpenGLError();
 
 	// Set line parameters in shader
@@ -160,53 +195,72 @@ void CRenderer::initTexture()
 	GLint uniLineB = glGetUniformLocation( m_morphProg, "BLines" );
 	glUniform1i( uniLineB, 3 );
 	GLint uniLineCount = glGetUniformLocation( m_morphProg, "LineCount" );
-	glUniform1f( uniLineCount, (float)m_pImageB->getNumLines() );
-
-	// Create image output texture
-	glGenTextures( 1, &m_morphedTexObj );
-	glBindTexture( GL_TEXTURE_2D, m_morphedTexObj );
-	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT );
-	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT );
-	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
-	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR );
-	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-	glTexImage2D( GL_TEXTURE_2D, 0, GL_RGB8,
-		m_imgWidth, m_imgHeight, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL );
+	glUniform1f( uniLineCount, (float)m_numLines );
+
+	// Create image output tiles. The output is split into tiles no larger
+	// than the driver takes, rendered one at a time.
+	m_tileSize = VTEX_OUTPUT_TILE;
+	while(m_tileSize > maxTextureSize)
+		m_tileSize /= 2;
+	m_tilesX = (m_imgWidth + m_tileSize - 1) / m_tileSize;
+	m_tilesY = (m_imgHeight + m_tileSize - 1) / m_tileSize;
+	m_outputTiles.resize(m_tilesX * m_tilesY);
+	glGenTextures( m_outputTiles.size(), &m_outputTiles[0] );
+	for(int ty=0; ty<m_tilesY; ty++)
+	{
+		for(int tx=0; tx<m_tilesX; tx++)
+		{
+			glBindTexture( GL_TEXTURE_2D, m_outputTiles[ty * m_tilesX + tx] );
+			glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE );
+			glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE );
+			glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
+			glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR );
+			glTexImage2D( GL_TEXTURE_2D, 0, GL_RGB8, min(m_tileSize, m_imgWidth - tx * m_tileSize),
+				min(m_tileSize, m_imgHeight - ty * m_tileSize), 0, GL_RGB, GL_UNSIGNED_BYTE, NULL );
+		}
+	}
 	printOpenGLError();
 
 	//-----------------------------------------------------------------------------
-	// Attach the output texture to a FBO
+	// Attach the first output tile to a FBO. Each tile is attached in turn
+	// when rendering.
 	//-----------------------------------------------------------------------------
 	glGenFramebuffersEXT( 1, &m_fbo ); 
 	glBindFramebufferEXT( GL_FRAMEBUFFER_EXT, m_fbo );
 	glFramebufferTexture2DEXT( GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT, 
-		GL_TEXTURE_2D, m_morphedTexObj, 0 );
+		GL_TEXTURE_2D, m_outputTiles[0], 0 );
 	checkFramebufferStatus();
+	glBindFramebufferEXT( GL_FRAMEBUFFER_EXT, 0 );
 	printOpenGLError();
 
 	glBindTexture(GL_TEXTURE_2D, 0);
 };
 
-void CRenderer::makeMorphImage(float t)
+//---------------------------------------------------------------------------
+// Render the morph at t into the output tiles. Scales above 1 render a
+// reduced resolution image into the lower left corner of each tile, one
+// pixel for every scale x scale image pixels.
+//---------------------------------------------------------------------------
+void CRenderer::makeMorphImage(float t, int scale)
 {
 	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, m_fbo);
+	m_renderScale = scale;
+	m_texVersion = m_inputVersion;
+	m_texStep = t;
 
-	// Set up projection, modelview matrices and viewport.
+	// Set up projection and modelview matrices. Each draw covers its
+	// viewport with a unit quad.
 	glMatrixMode( GL_PROJECTION );
 	glLoadIdentity();
-	gluOrtho2D( 0, m_imgWidth, 0, m_imgHeight );
+	gluOrtho2D( 0, 1, 0, 1 );
 	glMatrixMode( GL_MODELVIEW );
 	glLoadIdentity();
-	glViewport( 0, 0, m_imgWidth, m_imgHeight );
 
 	// Enable morphing shader
 	glUseProgram( m_morphProg );
 
-	// Bind texture to texture units
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_RECTANGLE_ARB, m_texA);
-	glActiveTexture(GL_TEXTURE1);
-	glBindTexture(GL_TEXTURE_RECTANGLE_ARB, m_texB);
+	// Bind line textures to texture units. The face pages are bound for
+	// each draw, after loading the pages it needs.
 	glActiveTexture(GL_TEXTURE2);
 	glBindTexture(GL_TEXTURE_RECTANGLE_ARB, m_texLineA);
 	glActiveTexture(GL_TEXTURE3);
@@ -216,27 +270,178 @@ void CRenderer::makeMorphImage(float t)
 	GLint uniStep = glGetUniformLocation( m_morphProg, "Step" );
 	glUniform1f( uniStep, t );
 	GLint uniLineCount = glGetUniformLocation( m_morphProg, "LineCount" );
-	glUniform1f( uniLineCount, (float)m_pImageA->getNumLines() );
+	glUniform1f( uniLineCount, (float)m_numLines );
+	GLint uniPixelScale = glGetUniformLocation( m_morphProg, "PixelScale" );
+	glUniform1f( uniPixelScale, (float)scale );
+	GLint uniTileOrigin = glGetUniformLocation( m_morphProg, "TileOrigin" );
 
-	// Render quads
-	glBegin( GL_QUADS );
-	glVertex2f( 0, 0 );
-	glVertex2f( 0, m_imgHeight );
-	glVertex2f( m_imgWidth, m_imgHeight );
-	glVertex2f( m_imgWidth, 0 );
-	glEnd();
+	// Render tiles
+	for(int ty=0; ty<m_tilesY; ty++)
+	{
+		for(int tx=0; tx<m_tilesX; tx++)
+		{
+			int originX = tx * m_tileSize;
+			int originY = ty * m_tileSize;
+			glFramebufferTexture2DEXT( GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT,
+				GL_TEXTURE_2D, m_outputTiles[ty * m_tilesX + tx], 0 );
+			glUniform2f( uniTileOrigin, (float)originX, (float)originY );
+			renderTileRect(t, scale, originX, originY, 0, 0,
+				(min(m_tileSize, m_imgWidth - originX) + scale - 1) / scale,
+				(min(m_tileSize, m_imgHeight - originY) + scale - 1) / scale);
+		}
+	}
 
 	// Restore output framebuffer
 	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
 
 	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_RECTANGLE_ARB, 0);
+	glBindTexture(GL_TEXTURE_2D, 0);
 	glActiveTexture(GL_TEXTURE1);
-	glBindTexture(GL_TEXTURE_RECTANGLE_ARB, 0);
+	glBindTexture(GL_TEXTURE_2D, 0);
 	glActiveTexture(GL_TEXTURE2);
 	glBindTexture(GL_TEXTURE_RECTANGLE_ARB, 0);
 	glActiveTexture(GL_TEXTURE3);
 	glBindTexture(GL_TEXTURE_RECTANGLE_ARB, 0);
+	glActiveTexture(GL_TEXTURE4);
+	glBindTexture(GL_TEXTURE_RECTANGLE_ARB, 0);
+	glActiveTexture(GL_TEXTURE5);
+	glBindTexture(GL_TEXTURE_RECTANGLE_ARB, 0);
+	glActiveTexture(GL_TEXTURE0);
+}
+
+//---------------------------------------------------------------------------
+// Render a rectangle of the attached tile, in output pixels from the
+// tile's corner. The source pages the rectangle samples are loaded first;
+// while they do not all fit in the atlases, the rectangle is split in four.
+// Rectangles that cannot be split are drawn with the pages that fit, the
+// shader falling back to coarser levels for the rest.
+//---------------------------------------------------------------------------
+void CRenderer::renderTileRect( float t, int scale, int originX, int originY, int x, int y,
+	int width, int height )
+{
+	m_pagesA.clearRequests();
+	m_pagesB.clearRequests();
+	if(!m_pagesA.isAllResident() || !m_pagesB.isAllResident())
+	{
+		int imageX = originX + x * scale;
+		int imageY = originY + y * scale;
+		requestPages(t, scale, cvRect(imageX, imageY,
+			min(width * scale, m_imgWidth - imageX), min(height * scale, m_imgHeight - imageY)));
+	}
+
+	bool isSplittable = width > VTEX_MIN_TILE || height > VTEX_MIN_TILE;
+	if(isSplittable && (!m_pagesA.isRequestFitting() || !m_pagesB.isRequestFitting()))
+	{
+		int partWidth = width > VTEX_MIN_TILE ? (width + 1) / 2 : width;
+		int partHeight = height > VTEX_MIN_TILE ? (height + 1) / 2 : height;
+		for(int py=y; py<y+height; py+=partHeight)
+		{
+			for(int px=x; px<x+width; px+=partWidth)
+				renderTileRect(t, scale, originX, originY, px, py,
+					min(partWidth, x + width - px), min(partHeight, y + height - py));
+		}
+		return;
+	}
+
+	m_pagesA.loadRequests();
+	m_pagesB.loadRequests();
+	m_pagesA.bind(0, 4);
+	m_pagesB.bind(1, 5);
+
+	glViewport( x, y, width, height );
+	glBegin( GL_QUADS );
+	glVertex2f( 0, 0 );
+	glVertex2f( 0, 1 );
+	glVertex2f( 1, 1 );
+	glVertex2f( 1, 0 );
+	glEnd();
+}
+
+//---------------------------------------------------------------------------
+// Request the source pages a rectangle of the image samples. The field is
+// computed on a grid VTEX_GRID output pixels apart, and each grid cell
+// requests the region its corners map to, grown by half its size for the
+// warp's curvature in between, at the levels its corners' levels of detail
+// span. Cells where the warp may fall back to the unwarped pixel, at or
+// near the image's edges, also request their own region, and every
+// coarser level, as the jump to the unwarped pixel raises the level of
+// detail the shader finds there.
+//---------------------------------------------------------------------------
+void CRenderer::requestPages( float t, int scale, const CvRect& rect )
+{
+	int spacing = VTEX_GRID * scale;
+	int cols = (rect.width + spacing - 1) / spacing + 1;
+	int rows = (rect.height + spacing - 1) / spacing + 1;
+	m_pageField.resize(cols * rows * 4);
+	m_pageKernel.computeFieldGrid(t, rect.x, rect.y, cols, rows, spacing, &m_pageField[0]);
+
+	// getLod measures the field per grid step rather than per output pixel
+	int levelCount = m_pagesA.getLevelCount();
+	float lodOffset = log((float)VTEX_GRID) / log(2.0f);
+	vector<float> lods(cols * rows * 2);
+	for(int j=0; j<rows; j++)
+	{
+		int prevJ = max(j - 1, 0);
+		int nextJ = min(j + 1, rows - 1);
+		for(int i=0; i<cols; i++)
+		{
+			for(int k=0; k<2; k++)
+			{
+				lods[(j * cols + i) * 2 + k] = CMorphKernel::getLod(&m_pageField[j * cols * 4 + k * 2],
+					&m_pageField[prevJ * cols * 4 + k * 2], &m_pageField[nextJ * cols * 4 + k * 2], i, cols,
+					(float)(nextJ - prevJ)) - lodOffset;
+			}
+		}
+	}
+
+	CVirtualTexture* pages[2] = {&m_pagesA, &m_pagesB};
+	for(int j=0; j+1<rows; j++)
+	{
+		for(int i=0; i+1<cols; i++)
+		{
+			int corners[4] = {j * cols + i, j * cols + i + 1, (j + 1) * cols + i, (j + 1) * cols + i + 1};
+			float cellX0 = (float)(rect.x + i * spacing);
+			float cellY0 = (float)(rect.y + j * spacing);
+
+			for(int k=0; k<2; k++)
+			{
+				float x0 = FLT_MAX, y0 = FLT_MAX, x1 = -FLT_MAX, y1 = -FLT_MAX;
+				float minLod = FLT_MAX, maxLod = -FLT_MAX;
+				bool isFallback = false;
+				for(int c=0; c<4; c++)
+				{
+					const float* position = &m_pageField[corners[c] * 4 + k * 2];
+					float lod = lods[corners[c] * 2 + k];
+					x0 = min(x0, position[0]);
+					y0 = min(y0, position[1]);
+					x1 = max(x1, position[0]);
+					y1 = max(y1, position[1]);
+					minLod = min(minLod, lod);
+					maxLod = max(maxLod, lod);
+
+					int corner = corners[c];
+					float pixelX = rect.x + corner % cols * spacing + 0.5f;
+					float pixelY = rect.y + corner / cols * spacing + 0.5f;
+					isFallback = isFallback || (position[0] == pixelX && position[1] == pixelY);
+				}
+				float pad = max(x1 - x0, y1 - y0) * 0.5f;
+				isFallback = isFallback || x0 - pad < 0 || y0 - pad < 0 ||
+					x1 + pad >= m_imgWidth || y1 + pad >= m_imgHeight;
+
+				float weight;
+				int firstLevel = CMorphKernel::getLevel(minLod - VTEX_LOD_MARGIN, levelCount, &weight);
+				int lastLevel = CMorphKernel::getLevel(maxLod + VTEX_LOD_MARGIN, levelCount, &weight);
+				if(weight > 0 || isFallback)
+					lastLevel = isFallback ? levelCount - 1 : lastLevel + 1;
+				for(int level=firstLevel; level<=lastLevel; level++)
+				{
+					pages[k]->requestRegion(level, x0 - pad, y0 - pad, x1 + pad, y1 + pad);
+					if(isFallback)
+						pages[k]->requestRegion(level, cellX0, cellY0, cellX0 + spacing, cellY0 + spacing);
+				}
+			}
+		}
+	}
 }
 
 //---------------------------------------------------------------------------
@@ -276,6 +481,10 @@ bool CRenderer::checkFramebufferStatus()
 	return false;
 }
 
+//---------------------------------------------------------------------------
+// Upload the lines changed since the last call. The line textures are only
+// reallocated when the lines outgrow them, doubling their capacity.
+//---------------------------------------------------------------------------
 void CRenderer::setLines()
 {
 	glutSetWindow(m_window->getWindow());
@@ -283,39 +492,226 @@ void CRenderer::setLines()
 	float *b = m_pImageB->getPackedLine();
 	int numLines = m_pImageA->getNumLines();
 
-	// Upload line A to GPU
+	int beginA, endA, beginB, endB;
+	m_pImageA->getDirtyLines(&beginA, &endA);
+	m_pImageB->getDirtyLines(&beginB, &endB);
+
+	// Storage is undefined after reallocating, so everything is uploaded
+	if(numLines > m_lineCapacity)
+	{
+		int capacity = m_lineCapacity;
+		while(capacity < numLines)
+			capacity *= 2;
+		allocLineTextures(capacity);
+		beginA = beginB = 0;
+		endA = endB = numLines;
+	}
+
+	// A copy of the uploaded lines is kept, since frames are keyed by the
+	// lines they were rendered from and the lines being edited can change
+	// first. Like the textures, only the changed range is copied.
+	m_numLines = numLines;
+	m_linesA.resize(numLines * 4);
+	m_linesB.resize(numLines * 4);
+	if(beginA < endA)
+		copy(a + beginA * 4, a + endA * 4, m_linesA.begin() + beginA * 4);
+	if(beginB < endB)
+		copy(b + beginB * 4, b + endB * 4, m_linesB.begin() + beginB * 4);
+	m_inputVersion++;
+	m_pageKernel.setLines(a, b, numLines);
+
+	glActiveTexture( GL_TEXTURE0 );
+	uploadLines(m_texLineA, a, beginA, endA);
+	uploadLines(m_texLineB, b, beginB, endB);
+	glBindTexture( GL_TEXTURE_RECTANGLE_ARB, 0 );
+
+	m_window->postRedisplay();
+}
+
+int CRenderer::getNumLines()
+{
+	return m_numLines;
+}
+
+//---------------------------------------------------------------------------
+// Packed lines last uploaded by setLines, which the output is rendered
+// from. They can differ from the lines being edited until the next upload,
+// and are NULL while there are no lines.
+//---------------------------------------------------------------------------
+void CRenderer::getUploadedLines( const float** linesA, const float** linesB )
+{
+	*linesA = m_numLines > 0 ? &m_linesA[0] : NULL;
+	*linesB = m_numLines > 0 ? &m_linesB[0] : NULL;
+}
+
+//---------------------------------------------------------------------------
+// Copy of the uploaded lines for work done on other threads
+//---------------------------------------------------------------------------
+void CRenderer::getLineSnapshot( shared_ptr< const vector<float> >* linesA, shared_ptr< const vector<float> >* linesB )
+{
+	linesA->reset(new vector<float>(m_linesA));
+	linesB->reset(new vector<float>(m_linesB));
+}
+
+void CRenderer::allocLineTextures( int capacity )
+{
 	glActiveTexture( GL_TEXTURE0 );
 	glBindTexture( GL_TEXTURE_RECTANGLE_ARB, m_texLineA );
-	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
 	glTexImage2D( GL_TEXTURE_RECTANGLE_ARB, 0, GL_RGBA32F_ARB,
-		numLines, 1, 0, GL_RGBA, GL_FLOAT, a);
-
-	// Upload line B to GPU
+		capacity, 1, 0, GL_RGBA, GL_FLOAT, NULL);
 	glBindTexture( GL_TEXTURE_RECTANGLE_ARB, m_texLineB );
-	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
 	glTexImage2D( GL_TEXTURE_RECTANGLE_ARB, 0, GL_RGBA32F_ARB,
-		numLines, 1, 0, GL_RGBA, GL_FLOAT, b);
-
+		capacity, 1, 0, GL_RGBA, GL_FLOAT, NULL);
 	glBindTexture( GL_TEXTURE_RECTANGLE_ARB, 0 );
+	m_lineCapacity = capacity;
+}
 
-	glutPostRedisplay();
+//---------------------------------------------------------------------------
+// Upload packed lines [begin, end) into texels of the same index
+//---------------------------------------------------------------------------
+void CRenderer::uploadLines( GLuint texLine, const float* lines, int begin, int end )
+{
+	if(begin >= end)
+		return;
+	glBindTexture( GL_TEXTURE_RECTANGLE_ARB, texLine );
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexSubImage2D( GL_TEXTURE_RECTANGLE_ARB, 0, begin, 0,
+		end - begin, 1, GL_RGBA, GL_FLOAT, lines + begin * 4);
 }
 
+//---------------------------------------------------------------------------
+// Read the output tiles back into one image, each tile into its place
+//---------------------------------------------------------------------------
 void CRenderer::getRender(char* data)
 {
 	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, m_morphedTexObj);
 	glPixelStorei( GL_PACK_ALIGNMENT, 1 );
-	glGetTexImage(GL_TEXTURE_2D, 0, GL_BGR, GL_UNSIGNED_BYTE, data);
+	glPixelStorei( GL_PACK_ROW_LENGTH, m_imgWidth );
+	for(int ty=0; ty<m_tilesY; ty++)
+	{
+		for(int tx=0; tx<m_tilesX; tx++)
+		{
+			glPixelStorei( GL_PACK_SKIP_PIXELS, tx * m_tileSize );
+			glPixelStorei( GL_PACK_SKIP_ROWS, ty * m_tileSize );
+			glBindTexture(GL_TEXTURE_2D, m_outputTiles[ty * m_tilesX + tx]);
+			glGetTexImage(GL_TEXTURE_2D, 0, GL_BGR, GL_UNSIGNED_BYTE, data);
+		}
+	}
+	glPixelStorei( GL_PACK_ROW_LENGTH, 0 );
+	glPixelStorei( GL_PACK_SKIP_PIXELS, 0 );
+	glPixelStorei( GL_PACK_SKIP_ROWS, 0 );
 
 	glBindTexture(GL_TEXTURE_2D, 0);
 }
 
+void CRenderer::setFrameStore( CFrameStore* frameStore )
+{
+	m_frameStore = frameStore;
+}
+
+//---------------------------------------------------------------------------
+// Upload a stored frame into the output tiles in place of rendering it
+//---------------------------------------------------------------------------
+void CRenderer::loadFrame( const char* data )
+{
+	glActiveTexture(GL_TEXTURE0);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, m_imgWidth);
+	for(int ty=0; ty<m_tilesY; ty++)
+	{
+		for(int tx=0; tx<m_tilesX; tx++)
+		{
+			int x = tx * m_tileSize;
+			int y = ty * m_tileSize;
+			glPixelStorei(GL_UNPACK_SKIP_PIXELS, x);
+			glPixelStorei(GL_UNPACK_SKIP_ROWS, y);
+			glBindTexture(GL_TEXTURE_2D, m_outputTiles[ty * m_tilesX + tx]);
+			glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, min(m_tileSize, m_imgWidth - x),
+				min(m_tileSize, m_imgHeight - y), GL_BGR, GL_UNSIGNED_BYTE, data);
+		}
+	}
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+	glPixelStorei(GL_UNPACK_SKIP_PIXELS, 0);
+	glPixelStorei(GL_UNPACK_SKIP_ROWS, 0);
+	m_renderScale = 1;
+
+	glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+//---------------------------------------------------------------------------
+// Frames are only stored while the inputs are those the store's input hash
+// was taken from. Lines uploaded for a preview, or while A and B differ in
+// line count, are not what the key describes.
+//---------------------------------------------------------------------------
+void CRenderer::storeFrame( int frameNumber )
+{
+	if(m_frameStore == NULL || m_storeVersion != m_inputVersion)
+		return;
+
+	char* frame = m_frameStore->beginFrame(frameNumber);
+	if(frame == NULL)
+		return;
+	getRender(frame);
+	m_frameStore->commitFrame(frameNumber);
+}
+
 void CRenderer::setBlendType(int blendType)
 {
 	glUseProgram(m_morphProg);
 	GLint uniBlendType = glGetUniformLocation( m_morphProg, "BlendType" );
 	glUniform1f( uniBlendType, (float)blendType );
+	m_inputVersion++;
+}
+
+int CRenderer::getBlendType()
+{
+	return m_blendType;
+}
+
+void CRenderer::setWarpParameters(float a, float b, float p)
+{
+	m_warpParams[0] = a;
+	m_warpParams[1] = b;
+	m_warpParams[2] = p;
+
+	glUseProgram(m_morphProg);
+	glUniform1f( glGetUniformLocation( m_morphProg, "WarpA" ), a );
+	glUniform1f( glGetUniformLocation( m_morphProg, "WarpB" ), b );
+	glUniform1f( glGetUniformLocation( m_morphProg, "WarpP" ), p );
+	m_pageKernel.setParameters(a, b, p);
+	m_inputVersion++;
+}
+
+void CRenderer::getWarpParameters(float* a, float* b, float* p)
+{
+	*a = m_warpParams[0];
+	*b = m_warpParams[1];
+	*p = m_warpParams[2];
+}
+
+//---------------------------------------------------------------------------
+// Step the selected warp parameter. Changes are previewed like a drag, at
+// a reduced resolution while the key is held, and committed once it has
+// been released for PREVIEW_REFINE_MS.
+//---------------------------------------------------------------------------
+void CRenderer::adjustWarpParameter(int direction)
+{
+	const WarpParamRange& range = WARP_PARAM_RANGE[m_warpSelected];
+	float value = m_warpParams[m_warpSelected] + direction * range.step;
+
+	// Snap to the step so repeated adjustments do not drift
+	value = floor(value / range.step + 0.5f) * range.step;
+	value = min(max(value, range.minValue), range.maxValue);
+	if(value == m_warpParams[m_warpSelected])
+		return;
+
+	float params[3] = {m_warpParams[0], m_warpParams[1], m_warpParams[2]};
+	params[m_warpSelected] = value;
+	setWarpParameters(params[0], params[1], params[2]);
+	printf("Warp %s: %.2f\n", range.name, value);
+
+	m_isTuning = true;
+	requestPreview();
 }
 
 void CRenderer::onKeyPress( unsigned char key, int x, int y )
@@ -329,6 +725,24 @@ void CRenderer::onKeyPress( unsigned char key, int x, int y )
 		m_isPlaying = !m_isPlaying;
 		m_showDebugLines = false;
 		m_app->writeVideo();
+		m_window->scheduleUpdate(EXPORT_POLL_MS);
+		if(m_isPlaying)
+		{
+			m_lastTime = glutGet(GLUT_ELAPSED_TIME);
+			m_window->scheduleUpdate(getFrameDelay(0));
+		}
+		break;
+
+	case 'v':
+	case 'V':
+		m_showDebugLines = false;
+		m_app->writeVideo(true);
+		m_window->scheduleUpdate(EXPORT_POLL_MS);
+		break;
+
+	case 'c':
+	case 'C':
+		m_app->cancelExport();
 		break;
 
 	case 't':
@@ -339,6 +753,8 @@ void CRenderer::onKeyPress( unsigned char key, int x, int y )
 			m_playDirection = 1;
 		else if(m_frameNumber >= m_frameTotal)
 			m_playDirection = -1;
+		if(m_isPlaying)
+			m_window->scheduleUpdate(getFrameDelay(0));
 		break;
 
 	case 'x':
@@ -351,7 +767,8 @@ void CRenderer::onKeyPress( unsigned char key, int x, int y )
 		else
 			printf("Blend Mode: Destination only\n");
 		setBlendType(m_blendType);
-		glutPostRedisplay();
+		m_app->onRenderUpdate();
+		m_window->postRedisplay();
 		break;
 
 	case 'a':
@@ -359,7 +776,7 @@ void CRenderer::onKeyPress( unsigned char key, int x, int y )
 		m_frameNumber--;
 		if(m_frameNumber < 0)
 			m_frameNumber = 0;
-		glutPostRedisplay();
+		m_window->postRedisplay();
 		break;
 
 	case 'd':
@@ -367,13 +784,43 @@ void CRenderer::onKeyPress( unsigned char key, int x, int y )
 		m_frameNumber++;
 		if(m_frameNumber > m_frameTotal)
 			m_frameNumber = m_frameTotal;
-		glutPostRedisplay();
+		m_window->postRedisplay();
 		break;
 
 	case 'l':
 	case 'L':
 		m_showDebugLines = !m_showDebugLines;
-		glutPostRedisplay();
+		m_window->postRedisplay();
+		break;
+
+		// Select the next warp parameter, hiding the panel after the last
+	case 'p':
+	case 'P':
+		if(!m_showWarpPanel)
+		{
+			m_showWarpPanel = true;
+			m_warpSelected = 0;
+		}
+		else if(++m_warpSelected == 3)
+		{
+			m_showWarpPanel = false;
+			m_warpSelected = 0;
+		}
+		m_window->postRedisplay();
+		break;
+
+	case '[':
+	case '{':
+		m_showWarpPanel = true;
+		adjustWarpParameter(-1);
+		m_window->postRedisplay();
+		break;
+
+	case ']':
+	case '}':
+		m_showWarpPanel = true;
+		adjustWarpParameter(1);
+		m_window->postRedisplay();
 		break;
 
 	case '0':
@@ -387,7 +834,7 @@ void CRenderer::onKeyPress( unsigned char key, int x, int y )
 	case '8':
 	case '9':
 		m_frameNumber = (key - '0') / 10.0f * m_frameTotal;
-		glutPostRedisplay();
+		m_window->postRedisplay();
 		break;
 
 		// Quit program.
@@ -415,7 +862,11 @@ void CRenderer::onRender()
 	// Calculate t
 	float t = (float)m_frameNumber / m_frameTotal;
 
-	makeMorphImage(t);
+	// The morph pass is skipped when the output texture already holds
+	// this frame, e.g. when the window was only exposed or resized
+	if(!isOutputCurrent(t))
+		updateOutput(t);
+	m_isRefining = false;
 
 	// Reset projection, modelview matrices and viewport.
 	int winWidth = m_window->getWidth();
@@ -439,14 +890,56 @@ void CRenderer::onRender()
 	if(m_showDebugLines)
 		drawLines(t);
 
+	if(m_showWarpPanel)
+		drawWarpPanel();
+
 	glutSwapBuffers();
+
+	// Latency is measured from the first drag the preview shows to the
+	// preview reaching the screen
+	if(m_isPreviewing && m_dragTime != -1)
+	{
+		glFinish();
+		int latency = glutGet(GLUT_ELAPSED_TIME) - m_dragTime;
+		m_previewCount++;
+		m_previewLatencySum += latency;
+		m_previewLatencyMax = max(m_previewLatencyMax, latency);
+		m_dragTime = -1;
+	}
+}
+
+//---------------------------------------------------------------------------
+// Warp parameters in the top left corner, the selected one highlighted
+//---------------------------------------------------------------------------
+void CRenderer::drawWarpPanel()
+{
+	void* font = GLUT_BITMAP_8_BY_13;
+	int rowHeight = GetFontHeight(font) + 2;
+	int top = m_window->getHeight() - 4;
+
+	glColor3f(0.1f, 0.1f, 0.1f);
+	glRecti(4, top - rowHeight * 4 - 4, 164, top);
+
+	SetCurrentFont(font);
+	for(int i=0; i<3; i++)
+	{
+		if(i == m_warpSelected)
+			glColor3fv(MARKCOLOR);
+		else
+			glColor3f(0.7f, 0.7f, 0.7f);
+		gltext(10, top - rowHeight * (i + 1), "%s %c %.2f", WARP_PARAM_RANGE[i].name,
+			i == m_warpSelected ? '>' : ' ', m_warpParams[i]);
+	}
+	glColor3f(0.5f, 0.5f, 0.5f);
+	gltext(10, top - rowHeight * 4, "P next  [ ] adjust");
 }
 
 void CRenderer::drawLines(float t)
 {
-	float* lineA = m_pImageA->getPackedLine();
-	float* lineB = m_pImageB->getPackedLine();
-	int numLines = m_pImageA->getNumLines();
+	// Drawn from the uploaded lines, which A and B have the same number of
+	const float *lineA, *lineB;
+	getUploadedLines(&lineA, &lineB);
+	int numLines = m_numLines;
 	int leftBorder = (m_window->getWidth() - m_imgScale * m_imgWidth) / 2.0f;
 	int bottomBorder = (m_window->getHeight() - m_imgScale * m_imgHeight) / 2.0f;
 	float ax, ay, bx, by;
@@ -470,31 +963,227 @@ void CRenderer::drawMorphImage()
 	int leftBorder = (m_window->getWidth() - m_imgScale * m_imgWidth) / 2.0f;
 	int bottomBorder = (m_window->getHeight() - m_imgScale * m_imgHeight) / 2.0f;
 
+	// Reduced resolution renders only fill part of each tile
+	float texScale = 1.0f / m_renderScale;
+
 	glActiveTexture( GL_TEXTURE0 );
-	glBindTexture( GL_TEXTURE_2D, m_morphedTexObj);
-	glBegin( GL_QUADS );
-	glTexCoord2f(0, 0);
-	glVertex2f(leftBorder, bottomBorder);
-	glTexCoord2f(0, 1);
-	glVertex2f(leftBorder, bottomBorder + m_imgHeight * m_imgScale);
-	glTexCoord2f(1, 1);
-	glVertex2f(leftBorder + m_imgWidth * m_imgScale, bottomBorder + m_imgHeight * m_imgScale);
-	glTexCoord2f(1, 0);
-	glVertex2f(leftBorder + m_imgWidth * m_imgScale, bottomBorder);
-	glEnd();
+	for(int ty=0; ty<m_tilesY; ty++)
+	{
+		for(int tx=0; tx<m_tilesX; tx++)
+		{
+			int x0 = tx * m_tileSize;
+			int y0 = ty * m_tileSize;
+			int x1 = min(x0 + m_tileSize, m_imgWidth);
+			int y1 = min(y0 + m_tileSize, m_imgHeight);
+			float left = leftBorder + x0 * m_imgScale;
+			float right = leftBorder + x1 * m_imgScale;
+			float bottom = bottomBorder + y0 * m_imgScale;
+			float top = bottomBorder + y1 * m_imgScale;
+
+			glBindTexture( GL_TEXTURE_2D, m_outputTiles[ty * m_tilesX + tx]);
+			glBegin( GL_QUADS );
+			glTexCoord2f(0, 0);
+			glVertex2f(left, bottom);
+			glTexCoord2f(0, texScale);
+			glVertex2f(left, top);
+			glTexCoord2f(texScale, texScale);
+			glVertex2f(right, top);
+			glTexCoord2f(texScale, 0);
+			glVertex2f(right, bottom);
+			glEnd();
+		}
+	}
 
 	glBindTexture( GL_TEXTURE_2D, 0);
 }
 
+//---------------------------------------------------------------------------
+// Drag preview
+// Each drag marks the preview pending. Pending previews are shown at most
+// PREVIEW_RATE times a second, so drags arriving faster are coalesced into
+// one upload and render. When a full resolution render would not fit the
+// PREVIEW_LATENCY_MS budget, a reduced resolution one is shown instead and
+// refined once the mouse has been still for PREVIEW_REFINE_MS.
+//---------------------------------------------------------------------------
+void CRenderer::requestPreview()
+{
+	int currentTime = glutGet(GLUT_ELAPSED_TIME);
+	if(!m_isPreviewing)
+	{
+		m_isPreviewing = true;
+		m_previewCount = m_previewLatencySum = m_previewLatencyMax = 0;
+	}
+	if(m_dragTime == -1)
+		m_dragTime = currentTime;
+	m_lastDragTime = currentTime;
+	m_isPreviewPending = true;
+	m_window->scheduleUpdate(m_lastPreviewTime + 1000 / PREVIEW_RATE - currentTime);
+}
+
+//---------------------------------------------------------------------------
+// Called when the lines are committed. The next render is a full one.
+//---------------------------------------------------------------------------
+void CRenderer::endPreview()
+{
+	if(!m_isPreviewing)
+		return;
+	if(m_previewCount > 0)
+		printf("Preview: %d frames, latency %d ms average, %d ms worst\n", m_previewCount,
+			m_previewLatencySum / m_previewCount, m_previewLatencyMax);
+	m_isPreviewing = false;
+	m_isPreviewPending = false;
+	m_isTuning = false;
+	m_dragTime = -1;
+}
+
+void CRenderer::updatePreview()
+{
+	int currentTime = glutGet(GLUT_ELAPSED_TIME);
+	if(m_isPreviewPending)
+	{
+		int wait = m_lastPreviewTime + 1000 / PREVIEW_RATE - currentTime;
+		if(wait > 0)
+		{
+			m_window->scheduleUpdate(wait);
+			return;
+		}
+		m_isPreviewPending = false;
+		m_lastPreviewTime = currentTime;
+		m_previewScale = getRenderScale(PREVIEW_LATENCY_MS);
+		setLines();
+		if(m_previewScale > 1 || m_isTuning)
+			m_window->scheduleUpdate(PREVIEW_REFINE_MS);
+	}
+	else if(m_isTuning)
+	{
+		// Warp parameters have no release to end the preview, so it ends
+		// when they have been left alone long enough to refine
+		int wait = m_lastDragTime + PREVIEW_REFINE_MS - currentTime;
+		if(wait > 0)
+		{
+			m_window->scheduleUpdate(wait);
+			return;
+		}
+		endPreview();
+		m_app->onWarpUpdate();
+		m_window->postRedisplay();
+	}
+	else if(m_previewScale > 1)
+	{
+		int wait = m_lastDragTime + PREVIEW_REFINE_MS - currentTime;
+		if(wait > 0)
+		{
+			m_window->scheduleUpdate(wait);
+			return;
+		}
+		m_previewScale = 1;
+		m_window->postRedisplay();
+	}
+}
+
+//---------------------------------------------------------------------------
+// Previews are rendered from lines still being dragged, so they are never
+// stored. Otherwise reuse the stored frame if there is one.
+//---------------------------------------------------------------------------
+void CRenderer::updateOutput( float t )
+{
+	const char* frame = m_frameStore && !m_isPreviewing ? m_frameStore->getFrame(m_frameNumber) : NULL;
+	if(m_isPreviewing)
+		renderScaled(t, m_previewScale);
+	else if(frame != NULL)
+	{
+		loadFrame(frame);
+		m_texVersion = m_inputVersion;
+		m_texStep = t;
+	}
+	else
+	{
+		// Frames not in the store are first rendered at the resolution the
+		// window shows, or lower if that would miss the frame time. Only
+		// full resolution frames are stored.
+		int budget = m_isPlaying ? 1000 / FRAMERATE : PREVIEW_LATENCY_MS;
+		int scale = m_isRefining ? 1 : getRenderScale(budget);
+		renderScaled(t, scale);
+		if(scale == 1)
+			storeFrame(m_frameNumber);
+		else
+		{
+			m_refineTime = glutGet(GLUT_ELAPSED_TIME) + PREVIEW_REFINE_MS;
+			m_window->scheduleUpdate(PREVIEW_REFINE_MS);
+		}
+	}
+}
+
+//---------------------------------------------------------------------------
+// Whether the output texture already holds the frame at t for the current
+// inputs, at a resolution that does not need to be rendered again
+//---------------------------------------------------------------------------
+bool CRenderer::isOutputCurrent( float t )
+{
+	if(m_texVersion != m_inputVersion || m_texStep != t)
+		return false;
+	if(m_renderScale == 1)
+		return true;
+	if(m_isPreviewing)
+		return m_renderScale <= m_previewScale;
+	return !m_isRefining;
+}
+
+//---------------------------------------------------------------------------
+// Render at the given scale, timing the render to estimate what a full
+// resolution one costs
+//---------------------------------------------------------------------------
+void CRenderer::renderScaled( float t, int scale )
+{
+	int startTime = glutGet(GLUT_ELAPSED_TIME);
+	makeMorphImage(t, scale);
+	glFinish();
+	int renderTime = (glutGet(GLUT_ELAPSED_TIME) - startTime) * scale * scale;
+	m_fullRenderTime = m_fullRenderTime > 0 ? (m_fullRenderTime + renderTime) / 2 : renderTime;
+}
+
+//---------------------------------------------------------------------------
+// Coarsest scale that still has a pixel for every window pixel the morph
+// is drawn to, made coarser while its estimated render time exceeds
+// budget ms. Render time falls with the square of the scale.
+//---------------------------------------------------------------------------
+int CRenderer::getRenderScale( int budget )
+{
+	int scale = 1;
+	while(scale < PREVIEW_MAX_SCALE && scale * 2 * m_imgScale <= 1)
+		scale *= 2;
+	while(scale < PREVIEW_MAX_SCALE && m_fullRenderTime / (scale * scale) > budget)
+		scale *= 2;
+	return scale;
+}
+
+//---------------------------------------------------------------------------
+// Playback advances on frame deadlines scheduled from here. Reduced
+// resolution frames are refined when the timeline is idle.
+//---------------------------------------------------------------------------
 void CRenderer::onUpdate()
 {
+	// Export progress is polled while an export runs
+	if(m_app->updateExport())
+		m_window->scheduleUpdate(EXPORT_POLL_MS);
+
+	if(m_isPreviewing)
+		updatePreview();
+	else if(!m_isPlaying && m_renderScale > 1)
+		updateRefine();
+	if(m_isFilling && !m_isPreviewing)
+		updateFill();
+
 	if(!m_isPlaying)
 		return;
 
 	int currentTime = glutGet(GLUT_ELAPSED_TIME);
 	int elapsed = currentTime - m_lastTime;
 	if(elapsed < 1000.0f / FRAMERATE)
+	{
+		m_window->scheduleUpdate(getFrameDelay(elapsed));
 		return;
+	}
 	m_lastTime = currentTime;
 
 	m_frameNumber += elapsed / 1000.0f * m_playDirection *FRAMERATE;
@@ -508,5 +1197,114 @@ void CRenderer::onUpdate()
 		m_frameNumber = m_frameTotal;
 		m_isPlaying = false;
 	}
-	glutPostRedisplay();
+	if(m_isPlaying)
+		m_window->scheduleUpdate(getFrameDelay(0));
+	m_window->postRedisplay();
+}
+
+//---------------------------------------------------------------------------
+// Once the timeline has been idle for PREVIEW_REFINE_MS, a reduced
+// resolution frame is rendered again at full resolution and stored, so
+// returning to it later loads the refined frame.
+//---------------------------------------------------------------------------
+void CRenderer::updateRefine()
+{
+	int wait = m_refineTime - glutGet(GLUT_ELAPSED_TIME);
+	if(wait > 0)
+	{
+		m_window->scheduleUpdate(wait);
+		return;
+	}
+	m_isRefining = true;
+	m_window->postRedisplay();
+}
+
+//---------------------------------------------------------------------------
+// Background fill
+// Once the lines have settled, every frame missing from the store is
+// rendered at full resolution, FRAMESTORE_FILL_MS at a time so input and
+// playback are still handled in between. Playback in either direction
+// then only uploads stored frames. Filling restarts whenever the inputs
+// change; frames of the new inputs already in the store are kept.
+//
+// Called once the store's input hash has been set for the current inputs.
+//---------------------------------------------------------------------------
+void CRenderer::startFill()
+{
+	if(m_frameStore == NULL)
+		return;
+	m_storeVersion = m_inputVersion;
+	m_isFilling = true;
+	m_fillTime = glutGet(GLUT_ELAPSED_TIME) + PREVIEW_REFINE_MS;
+	m_window->scheduleUpdate(PREVIEW_REFINE_MS);
+}
+
+void CRenderer::updateFill()
+{
+	int currentTime = glutGet(GLUT_ELAPSED_TIME);
+	if(currentTime < m_fillTime)
+	{
+		m_window->scheduleUpdate(m_fillTime - currentTime);
+		return;
+	}
+
+	// The output texture is overwritten, so the frame shown is redrawn
+	// if it was one of the frames rendered
+	bool isShownFrame = false;
+	while(glutGet(GLUT_ELAPSED_TIME) - currentTime < FRAMESTORE_FILL_MS)
+	{
+		// Inputs changed since the key was taken; the next startFill resumes
+		if(m_storeVersion != m_inputVersion)
+		{
+			m_isFilling = false;
+			break;
+		}
+		int frameNumber = getFillFrame();
+		if(frameNumber == -1)
+		{
+			m_isFilling = false;
+			break;
+		}
+		makeMorphImage((float)frameNumber / m_frameTotal);
+		storeFrame(frameNumber);
+		if(!m_frameStore->hasFrame(frameNumber))
+		{
+			fprintf(stderr, "Error: Cannot store frame %d\n", frameNumber);
+			m_isFilling = false;
+			break;
+		}
+		isShownFrame = isShownFrame || frameNumber == m_frameNumber;
+	}
+
+	if(isShownFrame)
+		m_window->postRedisplay();
+	if(m_isFilling)
+		m_window->scheduleUpdate(0);
+}
+
+//---------------------------------------------------------------------------
+// Missing frame nearest the current one, looking in the play direction
+// first, or -1 if all frames are stored
+//---------------------------------------------------------------------------
+int CRenderer::getFillFrame()
+{
+	int direction = m_playDirection < 0 ? -1 : 1;
+	for(int i=0; i<=m_frameTotal; i++)
+	{
+		int ahead = m_frameNumber + i * direction;
+		if(ahead >= 0 && ahead <= m_frameTotal && !m_frameStore->hasFrame(ahead))
+			return ahead;
+		int behind = m_frameNumber - i * direction;
+		if(behind >= 0 && behind <= m_frameTotal && !m_frameStore->hasFrame(behind))
+			return behind;
+	}
+	return -1;
+}
+
+//---------------------------------------------------------------------------
+// Time left until the next frame is due, elapsed ms after the last one
+//---------------------------------------------------------------------------
+int CRenderer::getFrameDelay( int elapsed )
+{
+	return (int)ceil(1000.0f / FRAMERATE - elapsed);
 }
@@ -11,24 +11,39 @@
 
 #pragma once
 #include <stdlib.h>
+#include <memory>
+#include <vector>
 #include <GL/glew.h>
 #include <GL/glut.h>
 #include "IGLUTDelegate.h"
+#include "MorphKernel.h"
+#include "VirtualTexture.h"
 
 class CMarkUI;
 class CImageMorph;
+class CFrameStore;
 
 class CRenderer : public IGLUTDelegate
 {
 private:
 	CImageMorph *m_app;
 	CMarkUI *m_pImageA, *m_pImageB;
+	CFrameStore *m_frameStore;
 	int m_imgWidth, m_imgHeight;
 	float m_imgScale;
 
 	GLuint m_morphProg;
-	GLuint m_texA, m_texB, m_texLineA, m_texLineB, m_morphedTexObj;
+	CVirtualTexture m_pagesA, m_pagesB;
+	GLuint m_texLineA, m_texLineB;
+	vector<GLuint> m_outputTiles;	// Output textures, row by row from the bottom left
+	int m_tileSize;					// Image pixels per output tile side
+	int m_tilesX, m_tilesY;
 	GLuint m_fbo;
+	CMorphKernel m_pageKernel;		// Finds the source pages an output tile samples
+	vector<float> m_pageField;
+	int m_lineCapacity;		// Width of the line textures
+	int m_numLines;			// Lines last uploaded
+	vector<float> m_linesA, m_linesB;	// Packed lines last uploaded
 
 	int m_lastTime;
 	int m_frameNumber, m_frameTotal;
@@ -36,19 +51,67 @@ private:
 	float m_playDirection;
 	int m_blendType;
 	bool m_showDebugLines;
+	float m_warpParams[3];		// a, b and p of the warp
+	int m_warpSelected;			// Parameter adjusted by '[' and ']'
+	bool m_showWarpPanel;
+	bool m_isTuning;			// Warp parameters changed and not yet committed
+	int m_renderScale;			// Image pixels per pixel of the output texture
+	int m_inputVersion;			// Bumped whenever lines, blend type or parameters change
+	int m_texVersion;			// Input version the output texture was rendered from
+	float m_texStep;			// Step the output texture was rendered at
+	bool m_isRefining;			// Next render is at full resolution
+	int m_refineTime;			// When a reduced resolution frame may be refined
+	int m_storeVersion;			// Input version the frame store's input hash was taken for
+	bool m_isFilling;			// Rendering missing frames in the background
+	int m_fillTime;				// When background rendering may start
+
+	// Drag preview states
+	bool m_isPreviewing, m_isPreviewPending;
+	int m_previewScale;
+	int m_dragTime;				// Oldest drag not yet shown, or -1
+	int m_lastDragTime, m_lastPreviewTime;
+	int m_fullRenderTime;		// Estimated full resolution render time in ms
+	int m_previewCount, m_previewLatencySum, m_previewLatencyMax;
 
 private:
 	void initGLState();
 	void initShader();
 	void initTexture();
+	void allocLineTextures(int capacity);
+	void uploadLines(GLuint texLine, const float* lines, int begin, int end);
 	void drawLines(float t);
 	void drawMorphImage();
+	void renderTileRect(float t, int scale, int originX, int originY, int x, int y, int width, int height);
+	void requestPages(float t, int scale, const CvRect& rect);
+	void drawWarpPanel();
+	void adjustWarpParameter(int direction);
+	void loadFrame(const char* data);
+	void storeFrame(int frameNumber);
 	bool checkFramebufferStatus();
+	void updatePreview();
+	void updateRefine();
+	void updateFill();
+	int getFillFrame();
+	bool isOutputCurrent(float t);
+	void updateOutput(float t);
+	void renderScaled(float t, int scale);
+	int getRenderScale(int budget);
+	int getFrameDelay(int elapsed);
 
 public:
 	void setLines();
+	int getNumLines();
+	void getUploadedLines(const float** linesA, const float** linesB);
+	void getLineSnapshot(shared_ptr< const vector<float> >* linesA, shared_ptr< const vector<float> >* linesB);
+	void setFrameStore(CFrameStore* frameStore);
 	void setBlendType(int blendType);
-	void makeMorphImage(float t);
+	int getBlendType();
+	void setWarpParameters(float a, float b, float p);
+	void getWarpParameters(float* a, float* b, float* p);
+	void makeMorphImage(float t, int scale = 1);
+	void requestPreview();
+	void endPreview();
+	void startFill();
 	void getRender(char* data);
 
 	CRenderer(CImageMorph *app, CMarkUI* imgA, CMarkUI* imgB);
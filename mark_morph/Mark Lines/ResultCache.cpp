@@ -0,0 +1,269 @@
+/////////////////////////////////////////////////////////////////////////////
+// File: ResultCache.cpp
+//
+// Content-addressed result cache
+// CResultCache stores rendered frames, and optionally the displacement
+// fields they were sampled with, keyed by a hash of everything that
+// affects them: the decoded images, the packed lines, the warp parameters,
+// t and the resolution. Identical renders from different jobs or runs are
+// therefore served from the cache, whatever file names they came from.
+//
+// Results are kept in a size-bounded LRU cache in memory, backed by one
+// file per result in a cache directory, which is also bounded in size and
+// evicted in LRU order. A lookup is a map search, so it is cheap enough
+// to do for every frame.
+//
+// Author: Leon Ho
+/////////////////////////////////////////////////////////////////////////////
+
+#include "ResultCache.h"
+#include "MorphKernel.h"
+#include <stdio.h>
+#include <string.h>
+
+// Result types, hashed into the keys so frames and fields never collide
+const int RESULT_FRAME = 0;
+const int RESULT_FIELD = 1;
+
+// Hashed into frame keys and bumped when the kernel's sampling changes, so
+// frames sampled the old way are no longer served
+const int RESULT_SAMPLING = 2;
+
+CResultCache::CResultCache(void)
+	: m_memory(0)
+{
+	m_isOpen = false;
+	m_isCachingFields = false;
+	m_diskBudget = m_diskSize = 0;
+	m_useCounter = 0;
+	m_hits = m_misses = 0;
+	InitializeCriticalSection(&m_diskLock);
+}
+
+CResultCache::~CResultCache(void)
+{
+	DeleteCriticalSection(&m_diskLock);
+}
+
+//---------------------------------------------------------------------------
+// Open the cache directory and index the results already in it. Budgets
+// are in bytes; a disk budget of 0 keeps results in memory only.
+//---------------------------------------------------------------------------
+bool CResultCache::open( const char* directory, __int64 ramBudget, __int64 diskBudget, bool isCachingFields )
+{
+	m_directory = directory;
+	m_memory.setCapacity((size_t)ramBudget);
+	m_diskBudget = diskBudget;
+	m_isCachingFields = isCachingFields;
+	m_isOpen = true;
+	if(diskBudget <= 0)
+		return true;
+
+	CreateDirectoryA(directory, NULL);
+
+	WIN32_FIND_DATAA data;
+	HANDLE find = FindFirstFileA((m_directory + "\\*.res").c_str(), &data);
+	if(find != INVALID_HANDLE_VALUE)
+	{
+		do
+		{
+			hash64 key;
+			if(sscanf(data.cFileName, "%16llx.res", &key) != 1)
+				continue;
+			DiskEntry entry;
+			entry.size = data.nFileSizeLow;
+			entry.lastUse = 0;
+			m_diskIndex[key] = entry;
+			m_diskSize += entry.size;
+		}
+		while(FindNextFileA(find, &data));
+		FindClose(find);
+	}
+
+	vector<hash64> evicted;
+	evictDisk(&evicted);
+	for(auto it=evicted.begin(); it!=evicted.end(); it++)
+		DeleteFileA(getFilename(*it).c_str());
+	return true;
+}
+
+//---------------------------------------------------------------------------
+// Copy the result for key into data. Fails if it is not cached or was
+// stored with a different size.
+//---------------------------------------------------------------------------
+bool CResultCache::find( hash64 key, char* data, size_t size )
+{
+	if(!m_isOpen)
+		return false;
+
+	shared_ptr< vector<char> > result;
+	if(m_memory.find(key, &result) && result->size() == size)
+	{
+		memcpy(data, &(*result)[0], size);
+		InterlockedIncrement(&m_hits);
+		return true;
+	}
+
+	if(readResult(key, data, size))
+	{
+		result = shared_ptr< vector<char> >(new vector<char>(data, data + size));
+		m_memory.insert(key, result, size);
+		InterlockedIncrement(&m_hits);
+		return true;
+	}
+
+	InterlockedIncrement(&m_misses);
+	return false;
+}
+
+void CResultCache::insert( hash64 key, const char* data, size_t size )
+{
+	if(!m_isOpen || size == 0)
+		return;
+
+	shared_ptr< vector<char> > result(new vector<char>(data, data + size));
+	m_memory.insert(key, result, size);
+
+	if(m_diskBudget > 0 && (__int64)size <= m_diskBudget)
+		writeResult(key, data, size);
+}
+
+//---------------------------------------------------------------------------
+// A frame is looked up first, then the field it is sampled with. A new
+// field is only kept if field caching is on, since fields take four floats
+// per pixel.
+//---------------------------------------------------------------------------
+bool CResultCache::render( CMorphKernel* kernel, hash64 inputHash, hash64 warpHash, float t, char* data )
+{
+	int width = kernel->getWidth();
+	int height = kernel->getHeight();
+	size_t frameSize = width * height * 3;
+
+	hash64 frameKey = hashInt(RESULT_FRAME, inputHash);
+	frameKey = hashInt(RESULT_SAMPLING, frameKey);
+	frameKey = hashFloat(t, frameKey);
+	frameKey = hashInt(width, frameKey);
+	frameKey = hashInt(height, frameKey);
+	if(find(frameKey, data, frameSize))
+		return true;
+
+	if(!m_isCachingFields)
+	{
+		kernel->render(t, data, width * 3);
+		insert(frameKey, data, frameSize);
+		return false;
+	}
+
+	hash64 fieldKey = hashInt(RESULT_FIELD, warpHash);
+	fieldKey = hashFloat(t, fieldKey);
+	fieldKey = hashInt(width, fieldKey);
+	fieldKey = hashInt(height, fieldKey);
+
+	vector<float> field(width * height * 4);
+	size_t fieldSize = kernel->getFieldSize();
+	if(!find(fieldKey, (char*)&field[0], fieldSize))
+	{
+		kernel->computeField(t, &field[0]);
+		insert(fieldKey, (const char*)&field[0], fieldSize);
+	}
+	kernel->renderField(t, &field[0], data, width * 3);
+	insert(frameKey, data, frameSize);
+	return false;
+}
+
+int CResultCache::getHits()
+{
+	return m_hits;
+}
+
+int CResultCache::getMisses()
+{
+	return m_misses;
+}
+
+string CResultCache::getFilename( hash64 key )
+{
+	char name[32];
+	sprintf(name, "\\%016llx.res", key);
+	return m_directory + name;
+}
+
+bool CResultCache::readResult( hash64 key, char* data, size_t size )
+{
+	EnterCriticalSection(&m_diskLock);
+	auto it = m_diskIndex.find(key);
+	bool isFound = it != m_diskIndex.end() && it->second.size == size;
+	if(isFound)
+		it->second.lastUse = ++m_useCounter;
+	LeaveCriticalSection(&m_diskLock);
+	if(!isFound)
+		return false;
+
+	// The file may have been evicted since the index was checked
+	FILE* file = fopen(getFilename(key).c_str(), "rb");
+	if(file == NULL)
+		return false;
+	bool isRead = fread(data, 1, size, file) == size;
+	fclose(file);
+	return isRead;
+}
+
+//---------------------------------------------------------------------------
+// Results are written to a temporary file and renamed into place, so a
+// reader never sees a partly written result.
+//---------------------------------------------------------------------------
+bool CResultCache::writeResult( hash64 key, const char* data, size_t size )
+{
+	string filename = getFilename(key);
+	char suffix[32];
+	sprintf(suffix, ".%lu.tmp", GetCurrentThreadId());
+	string tempname = filename + suffix;
+
+	FILE* file = fopen(tempname.c_str(), "wb");
+	if(file == NULL)
+	{
+		fprintf(stderr, "Error: Cannot write cache file %s\n", tempname.c_str());
+		return false;
+	}
+	bool isWritten = fwrite(data, 1, size, file) == size;
+	isWritten = fclose(file) == 0 && isWritten;
+	if(!isWritten || !MoveFileExA(tempname.c_str(), filename.c_str(), MOVEFILE_REPLACE_EXISTING))
+	{
+		DeleteFileA(tempname.c_str());
+		return false;
+	}
+
+	vector<hash64> evicted;
+	EnterCriticalSection(&m_diskLock);
+	auto it = m_diskIndex.find(key);
+	if(it != m_diskIndex.end())
+		m_diskSize -= it->second.size;
+	DiskEntry& entry = m_diskIndex[key];
+	entry.size = size;
+	entry.lastUse = ++m_useCounter;
+	m_diskSize += size;
+	evictDisk(&evicted);
+	LeaveCriticalSection(&m_diskLock);
+
+	for(auto it=evicted.begin(); it!=evicted.end(); it++)
+		DeleteFileA(getFilename(*it).c_str());
+	return true;
+}
+
+//---------------------------------------------------------------------------
+// Drop the least recently used results until the disk budget is met. The
+// files are deleted by the caller, outside the lock.
+//---------------------------------------------------------------------------
+void CResultCache::evictDisk( vector<hash64>* evicted )
+{
+	while(m_diskSize > m_diskBudget && !m_diskIndex.empty())
+	{
+		auto oldest = m_diskIndex.begin();
+		for(auto it=m_diskIndex.begin(); it!=m_diskIndex.end(); it++)
+			if(it->second.lastUse < oldest->second.lastUse)
+				oldest = it;
+		m_diskSize -= oldest->second.size;
+		evicted->push_back(oldest->first);
+		m_diskIndex.erase(oldest);
+	}
+}
@@ -0,0 +1,80 @@
+/////////////////////////////////////////////////////////////////////////////
+// File: ResultCache.h
+//
+// Content-addressed result cache
+// CResultCache stores rendered frames, and optionally the displacement
+// fields they were sampled with, keyed by a hash of everything that
+// affects them: the decoded images, the packed lines, the warp parameters,
+// t and the resolution. Identical renders from different jobs or runs are
+// therefore served from the cache, whatever file names they came from.
+//
+// Results are kept in a size-bounded LRU cache in memory, backed by one
+// file per result in a cache directory, which is also bounded in size and
+// evicted in LRU order. A lookup is a map search, so it is cheap enough
+// to do for every frame.
+//
+// Author: Leon Ho
+/////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <windows.h>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include "hash_util.h"
+#include "LruCache.h"
+
+using namespace std;
+
+class CMorphKernel;
+
+class CResultCache
+{
+private:
+	struct DiskEntry
+	{
+		size_t size;
+		unsigned int lastUse;
+	};
+
+private:
+	string m_directory;
+	bool m_isOpen;
+	bool m_isCachingFields;
+
+	CLruCache< hash64, shared_ptr< vector<char> > > m_memory;
+
+	// Results on disk, guarded by m_diskLock
+	CRITICAL_SECTION m_diskLock;
+	map<hash64, DiskEntry> m_diskIndex;
+	__int64 m_diskBudget, m_diskSize;
+	unsigned int m_useCounter;
+
+	volatile LONG m_hits, m_misses;
+
+public:
+	bool open(const char* directory, __int64 ramBudget, __int64 diskBudget, bool isCachingFields);
+
+	bool find(hash64 key, char* data, size_t size);
+	void insert(hash64 key, const char* data, size_t size);
+
+	// Render frame t into a packed BGR buffer, going through the cache.
+	// inputHash covers the images, lines, warp parameters and blend type;
+	// warpHash covers only the lines and warp parameters. Returns true if
+	// the frame came from the cache.
+	bool render(CMorphKernel* kernel, hash64 inputHash, hash64 warpHash, float t, char* data);
+
+	int getHits();
+	int getMisses();
+
+	CResultCache(void);
+	~CResultCache(void);
+
+private:
+	string getFilename(hash64 key);
+	bool readResult(hash64 key, char* data, size_t size);
+	bool writeResult(hash64 key, const char* data, size_t size);
+	void evictDisk(vector<hash64>* evicted);
+};
@@ -0,0 +1,132 @@
+/////////////////////////////////////////////////////////////////////////////
+// File: SpatialIndex.cpp
+//
+// Editor spatial index
+// CSpatialIndex keeps the vertices being edited in a uniform grid, so hit
+// tests only look at the cells around the cursor instead of every vertex.
+//
+// Vertices are identified by the caller's IDs, and only the vertices the
+// caller inserts are found. CLineGraph inserts the vertices that have
+// lines, and keeps the lines using each vertex itself.
+//
+// Author: Leon Ho
+/////////////////////////////////////////////////////////////////////////////
+
+#include "SpatialIndex.h"
+#include <math.h>
+#include <algorithm>
+
+CSpatialIndex::CSpatialIndex( float cellSize )
+{
+	m_cellSize = cellSize > 0 ? cellSize : 1;
+}
+
+CSpatialIndex::~CSpatialIndex(void)
+{
+}
+
+void CSpatialIndex::clear()
+{
+	m_vertexList.clear();
+	m_vertexCells.clear();
+}
+
+int CSpatialIndex::getCell( float value )
+{
+	return (int)floor(value / m_cellSize);
+}
+
+long long CSpatialIndex::getKey( int cellX, int cellY )
+{
+	return ((long long)cellX << 32) | (unsigned int)cellY;
+}
+
+void CSpatialIndex::addToCell( long long key, int id )
+{
+	m_vertexCells[key].push_back(id);
+}
+
+void CSpatialIndex::removeFromCell( long long key, int id )
+{
+	auto cell = m_vertexCells.find(key);
+	if(cell == m_vertexCells.end())
+		return;
+	vector<int>& ids = cell->second;
+	auto it = find(ids.begin(), ids.end(), id);
+	if(it != ids.end())
+	{
+		*it = ids.back();
+		ids.pop_back();
+	}
+	if(ids.empty())
+		m_vertexCells.erase(cell);
+}
+
+//---------------------------------------------------------------------------
+// Vertices
+//---------------------------------------------------------------------------
+void CSpatialIndex::insertVertex( int id, float x, float y )
+{
+	if(id >= (int)m_vertexList.size())
+	{
+		Vertex empty; empty.x = empty.y = 0; empty.isValid = false;
+		m_vertexList.resize(id + 1, empty);
+	}
+	Vertex& vertex = m_vertexList[id];
+	if(vertex.isValid)
+		removeFromCell(getKey(getCell(vertex.x), getCell(vertex.y)), id);
+	vertex.x = x;
+	vertex.y = y;
+	vertex.isValid = true;
+	addToCell(getKey(getCell(x), getCell(y)), id);
+}
+
+//---------------------------------------------------------------------------
+// Vertices not in the index are left out of it
+//---------------------------------------------------------------------------
+void CSpatialIndex::moveVertex( int id, float x, float y )
+{
+	if(id < 0 || id >= (int)m_vertexList.size() || !m_vertexList[id].isValid)
+		return;
+	insertVertex(id, x, y);
+}
+
+void CSpatialIndex::removeVertex( int id )
+{
+	if(id < 0 || id >= (int)m_vertexList.size() || !m_vertexList[id].isValid)
+		return;
+	Vertex& vertex = m_vertexList[id];
+	removeFromCell(getKey(getCell(vertex.x), getCell(vertex.y)), id);
+	vertex.isValid = false;
+}
+
+//---------------------------------------------------------------------------
+// Queries
+//---------------------------------------------------------------------------
+int CSpatialIndex::nearestVertex( float x, float y, float radius )
+{
+	int nearest = -1;
+	float nearestDistSq = radius * radius;
+	for(int cellX=getCell(x - radius); cellX<=getCell(x + radius); cellX++)
+	{
+		for(int cellY=getCell(y - radius); cellY<=getCell(y + radius); cellY++)
+		{
+			auto cell = m_vertexCells.find(getKey(cellX, cellY));
+			if(cell == m_vertexCells.end())
+				continue;
+			for(auto it=cell->second.begin(); it!=cell->second.end(); it++)
+			{
+				const Vertex& vertex = m_vertexList[*it];
+				float distSq = (vertex.x - x) * (vertex.x - x) + (vertex.y - y) * (vertex.y - y);
+				if(distSq > nearestDistSq)
+					continue;
+				if(nearest == -1 || distSq < nearestDistSq || (distSq == nearestDistSq && *it < nearest))
+				{
+					nearest = *it;
+					nearestDistSq = distSq;
+				}
+			}
+		}
+	}
+	return nearest;
+}
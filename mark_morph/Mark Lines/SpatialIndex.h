@@ -0,0 +1,57 @@
+/////////////////////////////////////////////////////////////////////////////
+// File: SpatialIndex.h
+//
+// Editor spatial index
+// CSpatialIndex keeps the vertices being edited in a uniform grid, so hit
+// tests only look at the cells around the cursor instead of every vertex.
+//
+// Vertices are identified by the caller's IDs, and only the vertices the
+// caller inserts are found. CLineGraph inserts the vertices that have
+// lines, and keeps the lines using each vertex itself.
+//
+// Author: Leon Ho
+/////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+class CSpatialIndex
+{
+private:
+	struct Vertex
+	{
+		float x, y;
+		bool isValid;
+	};
+
+	typedef unordered_map< long long, vector<int> > CellMap;
+
+private:
+	float m_cellSize;
+	vector<Vertex> m_vertexList;
+	CellMap m_vertexCells;
+
+public:
+	void clear();
+
+	// Inserting a vertex already in the index moves it
+	void insertVertex(int id, float x, float y);
+	void moveVertex(int id, float x, float y);
+	void removeVertex(int id);
+
+	// Returns -1 if nothing is within radius
+	int nearestVertex(float x, float y, float radius);
+
+	CSpatialIndex(float cellSize);
+	~CSpatialIndex(void);
+
+private:
+	int getCell(float value);
+	long long getKey(int cellX, int cellY);
+	void addToCell(long long key, int id);
+	void removeFromCell(long long key, int id);
+};
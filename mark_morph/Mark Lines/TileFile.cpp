@@ -0,0 +1,259 @@
+/////////////////////////////////////////////////////////////////////////////
+// File: TileFile.cpp
+//
+// Tiled image file
+// CTileFile stores an image and its pyramid as fixed-size square tiles of
+// BGR pixels, so any part of any level is read with a few positioned
+// reads instead of decoding the whole image. Tiles past the right and
+// bottom edges of a level repeat the edge pixels. Levels are halved with
+// cvPyrDown, as the CPU kernel builds its pyramids, down to a single
+// pixel row or column.
+//
+// Images are stored as decoded, with y pointing down.
+//
+// Author: Leon Ho
+/////////////////////////////////////////////////////////////////////////////
+
+#include "TileFile.h"
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include <cv.h>
+#include <highgui.h>
+
+using namespace std;
+
+const char TILEFILE_MAGIC[] = "MTF";
+const int TILEFILE_VERSION = 1;
+const int TILEFILE_TILE = 256;		// Tile size in pixels
+
+CTileFile::CTileFile(void)
+{
+	m_file = INVALID_HANDLE_VALUE;
+	memset(&m_header, 0, sizeof(m_header));
+}
+
+CTileFile::~CTileFile(void)
+{
+	close();
+}
+
+bool CTileFile::open( const char* filename )
+{
+	close();
+
+	m_file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL,
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	DWORD bytesRead = 0;
+	bool isRead = m_file != INVALID_HANDLE_VALUE &&
+		ReadFile(m_file, &m_header, sizeof(m_header), &bytesRead, NULL) && bytesRead == sizeof(m_header);
+	if(!isRead)
+	{
+		fprintf(stderr, "Error: Cannot open tile file %s\n", filename);
+		close();
+		return false;
+	}
+
+	LARGE_INTEGER fileSize;
+	if(memcmp(m_header.magic, TILEFILE_MAGIC, sizeof(m_header.magic)) != 0 ||
+		m_header.version != TILEFILE_VERSION || m_header.tileSize != TILEFILE_TILE ||
+		m_header.levelCount <= 0 || m_header.levelCount > TILEFILE_MAX_LEVELS ||
+		!ReadFile(m_file, m_level, m_header.levelCount * sizeof(Level), &bytesRead, NULL) ||
+		bytesRead != m_header.levelCount * sizeof(Level) || !GetFileSizeEx(m_file, &fileSize))
+	{
+		fprintf(stderr, "Error: %s is not a valid tile file\n", filename);
+		close();
+		return false;
+	}
+
+	// Tiles are read at offsets from the level table, so it is checked
+	// against the image size and the file once here
+	for(int i=0; i<m_header.levelCount; i++)
+	{
+		if(!isValidLevel(i, fileSize.QuadPart))
+		{
+			fprintf(stderr, "Error: %s has an invalid or truncated level %d\n", filename, i);
+			close();
+			return false;
+		}
+	}
+	return true;
+}
+
+//---------------------------------------------------------------------------
+// True if the level has the size build gives it, the tile counts covering
+// that size, and all its tiles past the level table and inside the file.
+//---------------------------------------------------------------------------
+bool CTileFile::isValidLevel( int level, __int64 fileSize )
+{
+	const Level& lv = m_level[level];
+	int width = m_header.width;
+	int height = m_header.height;
+	if(level > 0)
+	{
+		width = (m_level[level-1].width + 1) / 2;
+		height = (m_level[level-1].height + 1) / 2;
+	}
+	if(width <= 0 || height <= 0 || lv.width != width || lv.height != height)
+		return false;
+
+	int tileSize = m_header.tileSize;
+	__int64 tileBytes = (__int64)tileSize * tileSize * 3;
+	__int64 tableEnd = sizeof(Header) + sizeof(Level) * TILEFILE_MAX_LEVELS;
+	return lv.tilesX == (width + tileSize - 1) / tileSize && lv.tilesY == (height + tileSize - 1) / tileSize &&
+		lv.offset >= tableEnd && lv.offset + (__int64)lv.tilesX * lv.tilesY * tileBytes <= fileSize;
+}
+
+void CTileFile::close()
+{
+	if(m_file != INVALID_HANDLE_VALUE)
+		CloseHandle(m_file);
+	m_file = INVALID_HANDLE_VALUE;
+	memset(&m_header, 0, sizeof(m_header));
+}
+
+bool CTileFile::isOpen()
+{
+	return m_file != INVALID_HANDLE_VALUE;
+}
+
+int CTileFile::getWidth()
+{
+	return m_header.width;
+}
+
+int CTileFile::getHeight()
+{
+	return m_header.height;
+}
+
+int CTileFile::getLevelCount()
+{
+	return m_header.levelCount;
+}
+
+int CTileFile::getLevelWidth( int level )
+{
+	return m_level[level].width;
+}
+
+int CTileFile::getLevelHeight( int level )
+{
+	return m_level[level].height;
+}
+
+int CTileFile::getTileSize()
+{
+	return m_header.tileSize;
+}
+
+//---------------------------------------------------------------------------
+// Reads are positioned with an OVERLAPPED offset, so they do not share a
+// file pointer between threads.
+//---------------------------------------------------------------------------
+bool CTileFile::readTile( int level, int tileX, int tileY, char* data )
+{
+	const Level& lv = m_level[level];
+	DWORD tileBytes = m_header.tileSize * m_header.tileSize * 3;
+	__int64 offset = lv.offset + ((__int64)tileY * lv.tilesX + tileX) * tileBytes;
+
+	OVERLAPPED overlapped;
+	memset(&overlapped, 0, sizeof(overlapped));
+	overlapped.Offset = (DWORD)offset;
+	overlapped.OffsetHigh = (DWORD)(offset >> 32);
+	DWORD bytesRead = 0;
+	if(!ReadFile(m_file, data, tileBytes, &bytesRead, &overlapped) || bytesRead != tileBytes)
+	{
+		fprintf(stderr, "Error: Cannot read tile %d,%d of level %d\n", tileX, tileY, level);
+		return false;
+	}
+	return true;
+}
+
+//---------------------------------------------------------------------------
+// The header and level table are written last, once the level offsets are
+// known. Only the current level and the next are held in memory besides
+// the decoded image.
+//---------------------------------------------------------------------------
+bool CTileFile::build( const char* imageFilename, const char* filename )
+{
+	IplImage *image = cvLoadImage(imageFilename, CV_LOAD_IMAGE_COLOR);
+	if(image == NULL)
+	{
+		fprintf(stderr, "Error: Cannot load %s\n", imageFilename);
+		return false;
+	}
+
+	FILE *file = fopen(filename, "wb");
+	if(file == NULL)
+	{
+		fprintf(stderr, "Error: Cannot write %s\n", filename);
+		cvReleaseImage(&image);
+		return false;
+	}
+
+	Header header;
+	memcpy(header.magic, TILEFILE_MAGIC, sizeof(header.magic));
+	header.version = TILEFILE_VERSION;
+	header.width = image->width;
+	header.height = image->height;
+	header.tileSize = TILEFILE_TILE;
+	header.levelCount = 0;
+	Level levels[TILEFILE_MAX_LEVELS];
+	memset(levels, 0, sizeof(levels));
+	fwrite(&header, sizeof(header), 1, file);
+	fwrite(levels, sizeof(levels), 1, file);
+
+	vector<char> tile(TILEFILE_TILE * TILEFILE_TILE * 3);
+	IplImage *src = image;
+	bool isWritten = true;
+	while(isWritten && header.levelCount < TILEFILE_MAX_LEVELS)
+	{
+		Level& level = levels[header.levelCount++];
+		level.offset = _ftelli64(file);
+		level.width = src->width;
+		level.height = src->height;
+		level.tilesX = (src->width + TILEFILE_TILE - 1) / TILEFILE_TILE;
+		level.tilesY = (src->height + TILEFILE_TILE - 1) / TILEFILE_TILE;
+
+		for(int ty=0; ty<level.tilesY && isWritten; ty++)
+		{
+			for(int tx=0; tx<level.tilesX && isWritten; tx++)
+			{
+				int x0 = tx * TILEFILE_TILE;
+				int copyWidth = min(TILEFILE_TILE, src->width - x0);
+				for(int r=0; r<TILEFILE_TILE; r++)
+				{
+					int sy = min(ty * TILEFILE_TILE + r, src->height - 1);
+					const char* row = src->imageData + sy * src->widthStep + x0 * 3;
+					char* dst = &tile[r * TILEFILE_TILE * 3];
+					memcpy(dst, row, copyWidth * 3);
+					for(int c=copyWidth; c<TILEFILE_TILE; c++)
+						memcpy(dst + c*3, row + (copyWidth-1)*3, 3);
+				}
+				isWritten = fwrite(&tile[0], tile.size(), 1, file) == 1;
+			}
+		}
+
+		if(src->width <= 1 || src->height <= 1)
+			break;
+		IplImage *dst = cvCreateImage(cvSize((src->width + 1) / 2, (src->height + 1) / 2),
+			src->depth, src->nChannels);
+		cvPyrDown(src, dst);
+		cvReleaseImage(&src);
+		src = dst;
+	}
+	cvReleaseImage(&src);
+
+	_fseeki64(file, 0, SEEK_SET);
+	isWritten = isWritten && fwrite(&header, sizeof(header), 1, file) == 1 &&
+		fwrite(levels, sizeof(levels), 1, file) == 1;
+	if(fclose(file) != 0)
+		isWritten = false;
+	if(!isWritten)
+	{
+		fprintf(stderr, "Error: Cannot write %s\n", filename);
+		DeleteFileA(filename);
+	}
+	return isWritten;
+}
@@ -0,0 +1,71 @@
+/////////////////////////////////////////////////////////////////////////////
+// File: TileFile.h
+//
+// Tiled image file
+// CTileFile stores an image and its pyramid as fixed-size square tiles of
+// BGR pixels, so any part of any level is read with a few positioned
+// reads instead of decoding the whole image. Tiles past the right and
+// bottom edges of a level repeat the edge pixels. Levels are halved with
+// cvPyrDown, as the CPU kernel builds its pyramids, down to a single
+// pixel row or column.
+//
+// Images are stored as decoded, with y pointing down.
+//
+// Author: Leon Ho
+/////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <windows.h>
+
+const int TILEFILE_MAX_LEVELS = 32;
+
+class CTileFile
+{
+private:
+	struct Header
+	{
+		char magic[4];
+		int version;
+		int width, height;
+		int tileSize;
+		int levelCount;
+	};
+
+	struct Level
+	{
+		__int64 offset;
+		int width, height;
+		int tilesX, tilesY;
+	};
+
+private:
+	HANDLE m_file;
+	Header m_header;
+	Level m_level[TILEFILE_MAX_LEVELS];
+
+public:
+	bool open(const char* filename);
+	void close();
+	bool isOpen();
+
+	int getWidth();
+	int getHeight();
+	int getLevelCount();
+	int getLevelWidth(int level);
+	int getLevelHeight(int level);
+	int getTileSize();
+
+	// Read a tile of tileSize rows of tileSize*3 bytes. Safe to call from
+	// several threads.
+	bool readTile(int level, int tileX, int tileY, char* data);
+
+	// Decode an image once and write it as a tile file
+	static bool build(const char* imageFilename, const char* filename);
+
+	CTileFile(void);
+	~CTileFile(void);
+
+private:
+	bool isValidLevel(int level, __int64 fileSize);
+};
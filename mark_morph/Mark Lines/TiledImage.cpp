@@ -0,0 +1,258 @@
+/////////////////////////////////////////////////////////////////////////////
+// File: TiledImage.cpp
+//
+// Tiled image pyramid
+// CTiledImage draws a large image at any zoom from its CImagePyramid, kept
+// in system memory. Each level is split into fixed-size tiles, and only the
+// tiles of the level matching the zoom that cover the window are uploaded
+// as textures. Uploads per frame are bounded, and resident tiles beyond a
+// few screens' worth are evicted least recently used first, so texture
+// memory and upload cost follow what is on screen rather than the image
+// size.
+//
+// The coarsest level fits in one tile and is drawn first, so tiles still
+// streaming in show a blurred image instead of a hole.
+//
+// Author: Leon Ho
+/////////////////////////////////////////////////////////////////////////////
+
+#include "TiledImage.h"
+#include "shader_util.h"
+#include <math.h>
+
+const int TILE_TEXELS = 256;				// Tile texture size
+const int TILE_STEP = TILE_TEXELS - 2;		// Image pixels per tile; the rest is a border for filtering
+const int TILE_UPLOADS = 8;					// Most tiles uploaded per frame
+const int TILE_POOL_SCREENS = 3;			// Resident tiles kept, in multiples of those on screen
+
+CTiledImage::CTiledImage(void)
+{
+	m_pyramid = NULL;
+	m_frame = 0;
+	m_uploadBudget = 0;
+	m_staging.resize(TILE_TEXELS * TILE_TEXELS * 3);
+}
+
+CTiledImage::~CTiledImage(void)
+{
+}
+
+//---------------------------------------------------------------------------
+// Tile a pyramid's levels down to the first that fits in one tile. The
+// pyramid must outlive this object.
+//---------------------------------------------------------------------------
+bool CTiledImage::init( CImagePyramid* pyramid )
+{
+	release();
+	if(pyramid == NULL || pyramid->getLevelCount() == 0)
+		return false;
+	m_pyramid = pyramid;
+
+	const IplImage* image = pyramid->getLevel(0);
+	for(int i=0; i<pyramid->getLevelCount(); i++)
+	{
+		const IplImage* src = pyramid->getLevel(i);
+		Level level;
+		level.image = src;
+		level.scaleX = (float)image->width / src->width;
+		level.scaleY = (float)image->height / src->height;
+		level.tilesX = (src->width + TILE_STEP - 1) / TILE_STEP;
+		level.tilesY = (src->height + TILE_STEP - 1) / TILE_STEP;
+		m_levelList.push_back(level);
+		if(src->width <= TILE_STEP && src->height <= TILE_STEP)
+			break;
+	}
+	return true;
+}
+
+//---------------------------------------------------------------------------
+// Free the textures. Needs the window's GL context.
+//---------------------------------------------------------------------------
+void CTiledImage::release()
+{
+	for(auto it=m_tileList.begin(); it!=m_tileList.end(); it++)
+		m_freeTextures.push_back(it->second.texture);
+	m_tileList.clear();
+	if(!m_freeTextures.empty())
+		glDeleteTextures(m_freeTextures.size(), &m_freeTextures[0]);
+	m_freeTextures.clear();
+	m_levelList.clear();
+	m_pyramid = NULL;
+}
+
+int CTiledImage::getLevelCount()
+{
+	return m_levelList.size();
+}
+
+//---------------------------------------------------------------------------
+// Draw the part of the image inside the window, with image pixel (x, y) at
+// window position (offsetX + x*scale, offsetY + y*scale). Returns false if
+// some tiles are still to be streamed in, in which case the caller should
+// draw again.
+//---------------------------------------------------------------------------
+bool CTiledImage::draw( float scale, float offsetX, float offsetY, int winWidth, int winHeight )
+{
+	if(m_levelList.empty())
+		return true;
+
+	m_frame++;
+	m_uploadBudget = TILE_UPLOADS;
+	int tilesUsed = 0;
+	int coarsest = m_levelList.size() - 1;
+	int level = getLevel(scale);
+
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	drawLevel(coarsest, scale, offsetX, offsetY, winWidth, winHeight, &tilesUsed);
+	bool isComplete = level == coarsest ||
+		drawLevel(level, scale, offsetX, offsetY, winWidth, winHeight, &tilesUsed);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	evictTiles(tilesUsed * TILE_POOL_SCREENS);
+	return isComplete;
+}
+
+//---------------------------------------------------------------------------
+// Coarsest level whose pixels are no larger than a window pixel
+//---------------------------------------------------------------------------
+int CTiledImage::getLevel( float scale )
+{
+	int level = 0;
+	while(level + 1 < (int)m_levelList.size() && m_levelList[level + 1].scaleX * scale <= 1)
+		level++;
+	return level;
+}
+
+//---------------------------------------------------------------------------
+// Draw the visible tiles of a level, uploading missing ones while the frame's
+// upload budget lasts. The coarsest level ignores the budget. Returns false
+// if any visible tile was skipped.
+//---------------------------------------------------------------------------
+bool CTiledImage::drawLevel( int level, float scale, float offsetX, float offsetY, int winWidth, int winHeight,
+	int* tilesUsed )
+{
+	const Level& lv = m_levelList[level];
+	bool isCoarsest = level == (int)m_levelList.size() - 1;
+
+	// Visible region in level pixels
+	float x0 = max(-offsetX / scale, 0.0f) / lv.scaleX;
+	float y0 = max(-offsetY / scale, 0.0f) / lv.scaleY;
+	float x1 = min((winWidth - offsetX) / scale / lv.scaleX, (float)lv.image->width);
+	float y1 = min((winHeight - offsetY) / scale / lv.scaleY, (float)lv.image->height);
+	if(x0 >= x1 || y0 >= y1)
+		return true;
+
+	int tileX0 = (int)(x0 / TILE_STEP);
+	int tileY0 = (int)(y0 / TILE_STEP);
+	int tileX1 = min((int)ceil(x1 / TILE_STEP), lv.tilesX);
+	int tileY1 = min((int)ceil(y1 / TILE_STEP), lv.tilesY);
+
+	bool isComplete = true;
+	for(int ty=tileY0; ty<tileY1; ty++)
+	{
+		for(int tx=tileX0; tx<tileX1; tx++)
+		{
+			GLuint texture;
+			auto it = m_tileList.find(CImagePyramid::getKey(level, tx, ty));
+			if(it != m_tileList.end())
+			{
+				it->second.lastUse = m_frame;
+				texture = it->second.texture;
+			}
+			else if(isCoarsest || m_uploadBudget > 0)
+			{
+				texture = loadTile(level, tx, ty);
+				m_uploadBudget--;
+			}
+			else
+			{
+				isComplete = false;
+				continue;
+			}
+			(*tilesUsed)++;
+
+			// Tile pixels past its one pixel border, in level pixels
+			int px = tx * TILE_STEP;
+			int py = ty * TILE_STEP;
+			int width = min(TILE_STEP, lv.image->width - px);
+			int height = min(TILE_STEP, lv.image->height - py);
+			float u0 = 1.0f / TILE_TEXELS, u1 = (1.0f + width) / TILE_TEXELS;
+			float v0 = 1.0f / TILE_TEXELS, v1 = (1.0f + height) / TILE_TEXELS;
+			float left = offsetX + px * lv.scaleX * scale;
+			float right = offsetX + (px + width) * lv.scaleX * scale;
+			float bottom = offsetY + py * lv.scaleY * scale;
+			float top = offsetY + (py + height) * lv.scaleY * scale;
+
+			glBindTexture(GL_TEXTURE_2D, texture);
+			glBegin(GL_QUADS);
+			glTexCoord2f(u0, v0); glVertex2f(left, bottom);
+			glTexCoord2f(u0, v1); glVertex2f(left, top);
+			glTexCoord2f(u1, v1); glVertex2f(right, top);
+			glTexCoord2f(u1, v0); glVertex2f(right, bottom);
+			glEnd();
+		}
+	}
+	return isComplete;
+}
+
+//---------------------------------------------------------------------------
+// Upload a tile, reusing an evicted texture if there is one
+//---------------------------------------------------------------------------
+GLuint CTiledImage::loadTile( int level, int tileX, int tileY )
+{
+	GLuint texture;
+	if(!m_freeTextures.empty())
+	{
+		texture = m_freeTextures.back();
+		m_freeTextures.pop_back();
+		glBindTexture(GL_TEXTURE_2D, texture);
+	}
+	else
+	{
+		glGenTextures(1, &texture);
+		glBindTexture(GL_TEXTURE_2D, texture);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, TILE_TEXELS, TILE_TEXELS, 0, GL_BGR, GL_UNSIGNED_BYTE, NULL);
+	}
+
+	// Tiles start a pixel early for their border
+	m_pyramid->copyBlock(level, tileX * TILE_STEP - 1, tileY * TILE_STEP - 1, TILE_TEXELS, &m_staging[0]);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, TILE_TEXELS, TILE_TEXELS, GL_BGR, GL_UNSIGNED_BYTE, &m_staging[0]);
+	printOpenGLError();
+
+	Tile tile;
+	tile.texture = texture;
+	tile.lastUse = m_frame;
+	m_tileList[CImagePyramid::getKey(level, tileX, tileY)] = tile;
+	return texture;
+}
+
+//---------------------------------------------------------------------------
+// Evict tiles not drawn this frame, least recently used first, until at
+// most capacity textures remain, counting those kept for reuse.
+//---------------------------------------------------------------------------
+void CTiledImage::evictTiles( int capacity )
+{
+	while((int)m_tileList.size() > capacity)
+	{
+		auto lru = m_tileList.end();
+		for(auto it=m_tileList.begin(); it!=m_tileList.end(); it++)
+		{
+			if(it->second.lastUse != m_frame && (lru == m_tileList.end() || it->second.lastUse < lru->second.lastUse))
+				lru = it;
+		}
+		if(lru == m_tileList.end())
+			break;
+		m_freeTextures.push_back(lru->second.texture);
+		m_tileList.erase(lru);
+	}
+
+	while(!m_freeTextures.empty() && (int)(m_tileList.size() + m_freeTextures.size()) > capacity)
+	{
+		glDeleteTextures(1, &m_freeTextures.back());
+		m_freeTextures.pop_back();
+	}
+}
@@ -0,0 +1,69 @@
+/////////////////////////////////////////////////////////////////////////////
+// File: TiledImage.h
+//
+// Tiled image pyramid
+// CTiledImage draws a large image at any zoom from its CImagePyramid, kept
+// in system memory. Each level is split into fixed-size tiles, and only the
+// tiles of the level matching the zoom that cover the window are uploaded
+// as textures. Uploads per frame are bounded, and resident tiles beyond a
+// few screens' worth are evicted least recently used first, so texture
+// memory and upload cost follow what is on screen rather than the image
+// size.
+//
+// The coarsest level fits in one tile and is drawn first, so tiles still
+// streaming in show a blurred image instead of a hole.
+//
+// Author: Leon Ho
+/////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <map>
+#include <vector>
+#include <cv.h>
+#include <GL/glew.h>
+#include "ImagePyramid.h"
+
+using namespace std;
+
+class CTiledImage
+{
+private:
+	struct Level
+	{
+		const IplImage* image;
+		float scaleX, scaleY;		// Base image pixels per level pixel
+		int tilesX, tilesY;
+	};
+
+	struct Tile
+	{
+		GLuint texture;
+		unsigned int lastUse;
+	};
+
+private:
+	CImagePyramid* m_pyramid;
+	vector<Level> m_levelList;		// Pyramid levels down to the first that fits in one tile
+	map<long long, Tile> m_tileList;	// Resident tiles keyed by level and position
+	vector<GLuint> m_freeTextures;
+	vector<unsigned char> m_staging;
+	unsigned int m_frame;
+	int m_uploadBudget;				// Uploads left this frame
+
+public:
+	bool init(CImagePyramid* pyramid);
+	void release();
+	bool draw(float scale, float offsetX, float offsetY, int winWidth, int winHeight);
+	int getLevelCount();
+
+	CTiledImage(void);
+	~CTiledImage(void);
+
+private:
+	int getLevel(float scale);
+	bool drawLevel(int level, float scale, float offsetX, float offsetY, int winWidth, int winHeight,
+		int* tilesUsed);
+	GLuint loadTile(int level, int tileX, int tileY);
+	void evictTiles(int capacity);
+};
@@ -0,0 +1,424 @@
+/////////////////////////////////////////////////////////////////////////////
+// File: TiledMorph.cpp
+//
+// Out-of-core morph driver
+// CTiledMorph renders one frame of a morph between images too large to
+// hold in memory, such as print resolution scans. Each image is converted
+// once into a tile file holding its pyramid. The output is rendered in
+// tiles: the displacement field of a tile gives the source pixels it
+// samples at each pyramid level, only the source tiles covering those are
+// paged in, and the finished tile is written straight to the output file.
+//
+// Source tiles are kept in an LRU cache, so neighbouring output tiles
+// share what they read. Memory is bounded by a budget split between the
+// cache, the source regions of the tile being rendered and its field.
+// Output tiles whose sources do not fit are split until they do, down to
+// single pixels if need be; the render fails rather than go over budget.
+//
+// Usage: -tiled <imageA> <imageB> <out.ppm> [-t step] [-budget MB]
+//
+// Author: Leon Ho
+/////////////////////////////////////////////////////////////////////////////
+
+#include "TiledMorph.h"
+#include "constants.h"
+#include "line_io.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+
+CTiledMorph::CTiledMorph(void)
+	: m_tileCache(0)
+{
+	m_step = 0.5f;
+	m_budgetMB = OUTOFCORE_BUDGET_MB;
+	m_regionBudget = 0;
+	m_tileSize = OUTOFCORE_TILE;
+	m_width = m_height = 0;
+	m_output = NULL;
+	m_outputOffset = 0;
+	m_tilesRendered = m_tilesSplit = 0;
+	m_sourceReads = 0;
+	m_peakRegion = 0;
+}
+
+CTiledMorph::~CTiledMorph(void)
+{
+	if(m_output != NULL)
+		fclose(m_output);
+}
+
+bool CTiledMorph::parseArgs( int argc, char* argv[] )
+{
+	if(argc < 5)
+	{
+		printUsage();
+		return false;
+	}
+	m_imageFile[0] = argv[2];
+	m_imageFile[1] = argv[3];
+	m_outputFile = argv[4];
+
+	for(int i=5; i<argc; i++)
+	{
+		if(strcmp(argv[i], "-t") == 0 && i+1 < argc)
+		{
+			float step = (float)atof(argv[++i]);
+			m_step = min(max(step, 0.0f), 1.0f);
+		}
+		else if(strcmp(argv[i], "-budget") == 0 && i+1 < argc)
+		{
+			int budget = atoi(argv[++i]);
+			m_budgetMB = max(budget, 16);
+		}
+		else
+		{
+			printUsage();
+			return false;
+		}
+	}
+	return true;
+}
+
+void CTiledMorph::printUsage()
+{
+	fprintf(stderr, "Usage: -tiled <imageA> <imageB> <out.ppm> [-t step] [-budget MB]\n");
+	fprintf(stderr, "Renders the morph at step t (default 0.5) in tiles, within a memory budget\n");
+	fprintf(stderr, "(default %d MB). Each image is converted once to a %s tile file next to it.\n",
+		OUTOFCORE_BUDGET_MB, TILEFILE_EXT);
+}
+
+bool CTiledMorph::run()
+{
+	if(!openSource(0) || !openSource(1))
+		return false;
+	m_width = m_source[0].getWidth();
+	m_height = m_source[0].getHeight();
+	if(m_source[1].getWidth() != m_width || m_source[1].getHeight() != m_height)
+	{
+		fprintf(stderr, "Error: Image size not identical\n");
+		return false;
+	}
+
+	// Line files are y-down, as the tile files are
+	vector<float> lines[2];
+	for(int i=0; i<2; i++)
+	{
+		string lineFile = getLineFilename(m_imageFile[i]);
+		if(!loadLineFile(lineFile.c_str(), &lines[i]))
+		{
+			fprintf(stderr, "Error: Cannot read lines of %s\n", m_imageFile[i].c_str());
+			return false;
+		}
+	}
+	if(lines[0].size() != lines[1].size())
+	{
+		fprintf(stderr, "Error: Both images must have the same number of lines\n");
+		return false;
+	}
+	int numLines = lines[0].size() / 4;
+
+	m_kernel.setImageSize(m_width, m_height);
+	if(numLines > 0)
+		m_kernel.setLines(&lines[0][0], &lines[1][0], numLines);
+
+	// Half the budget caches source tiles and a quarter holds the source
+	// regions of a tile. Output tiles shrink until their field and pixels
+	// fit in the last quarter.
+	size_t budget = (size_t)m_budgetMB << 20;
+	while(m_tileSize > OUTOFCORE_MIN_TILE &&
+		(size_t)(m_tileSize + 2) * (m_tileSize + 2) * 4 * sizeof(float) + m_tileSize * m_tileSize * 3 > budget / 4)
+		m_tileSize /= 2;
+	m_tileCache.setCapacity(budget / 2);
+	m_regionBudget = budget / 4;
+
+	m_output = fopen(m_outputFile.c_str(), "wb");
+	if(m_output == NULL)
+	{
+		fprintf(stderr, "Error: Cannot write %s\n", m_outputFile.c_str());
+		return false;
+	}
+	fprintf(m_output, "P6\n%d %d\n255\n", m_width, m_height);
+	m_outputOffset = _ftelli64(m_output);
+	m_outputRow.resize(m_tileSize * 3);
+
+	printf("Rendering %s: %d x %d, %d lines, t = %.3f, budget %d MB\n", m_outputFile.c_str(),
+		m_width, m_height, numLines, m_step, m_budgetMB);
+	DWORD startTime = GetTickCount();
+
+	bool isRendered = true;
+	int tilesY = (m_height + m_tileSize - 1) / m_tileSize;
+	for(int ty=0; ty<tilesY && isRendered; ty++)
+	{
+		for(int x=0; x<m_width && isRendered; x+=m_tileSize)
+		{
+			int y = ty * m_tileSize;
+			isRendered = renderTile(cvRect(x, y, min(m_tileSize, m_width - x), min(m_tileSize, m_height - y)));
+		}
+		printf("\rRendered %d%%", (ty + 1) * 100 / tilesY);
+		fflush(stdout);
+	}
+	printf("\n");
+
+	if(fclose(m_output) != 0)
+		isRendered = false;
+	m_output = NULL;
+	if(!isRendered)
+	{
+		fprintf(stderr, "Error: Cannot render %s\n", m_outputFile.c_str());
+		DeleteFileA(m_outputFile.c_str());
+		return false;
+	}
+
+	printf("Tiles rendered: %d, split: %d\n", m_tilesRendered, m_tilesSplit);
+	printf("Source tiles read: %d, largest source regions: %d KB\n", m_sourceReads, (int)(m_peakRegion >> 10));
+	printf("Time taken: %.3f\n", (GetTickCount() - startTime) / 1000.0f);
+	return true;
+}
+
+//---------------------------------------------------------------------------
+// Open the tile file of an image, building it first if it is missing or
+// older than the image
+//---------------------------------------------------------------------------
+bool CTiledMorph::openSource( int image )
+{
+	const string& imageFile = m_imageFile[image];
+	string tileFile = imageFile + TILEFILE_EXT;
+
+	WIN32_FILE_ATTRIBUTE_DATA imageInfo, tileInfo;
+	if(!GetFileAttributesExA(imageFile.c_str(), GetFileExInfoStandard, &imageInfo))
+	{
+		fprintf(stderr, "Error: Cannot find %s\n", imageFile.c_str());
+		return false;
+	}
+	if(!GetFileAttributesExA(tileFile.c_str(), GetFileExInfoStandard, &tileInfo) ||
+		CompareFileTime(&tileInfo.ftLastWriteTime, &imageInfo.ftLastWriteTime) < 0)
+	{
+		printf("Building %s...\n", tileFile.c_str());
+		if(!CTileFile::build(imageFile.c_str(), tileFile.c_str()))
+			return false;
+	}
+	return m_source[image].open(tileFile.c_str());
+}
+
+//---------------------------------------------------------------------------
+// Render an output tile. Its field covers the pixels around it as well, so
+// levels are chosen exactly as for the whole image.
+//---------------------------------------------------------------------------
+bool CTiledMorph::renderTile( const CvRect& rect )
+{
+	int x0 = max(rect.x - 1, 0);
+	int y0 = max(rect.y - 1, 0);
+	int x1 = min(rect.x + rect.width + 1, m_width);
+	int y1 = min(rect.y + rect.height + 1, m_height);
+	CvRect fieldRect = cvRect(x0, y0, x1 - x0, y1 - y0);
+	vector<float> field(fieldRect.width * fieldRect.height * 4);
+	m_kernel.computeFieldRect(m_step, fieldRect, &field[0]);
+
+	vector<CvRect> regions[2];
+	size_t regionBytes = 0;
+	for(int i=0; i<2; i++)
+	{
+		getRegions(i, &field[0], fieldRect, rect, &regions[i]);
+		for(int level=0; level<(int)regions[i].size(); level++)
+			regionBytes += (size_t)regions[i][level].width * regions[i][level].height * 3;
+	}
+
+	// Smaller tiles span less of a compressed or scattered source. A single
+	// pixel samples a few taps per level, so it only fails to fit a budget
+	// too small to render with.
+	if(regionBytes > m_regionBudget)
+	{
+		if(rect.width <= 1 && rect.height <= 1)
+		{
+			fprintf(stderr, "Error: Pixel %d,%d samples %d KB of source, over the budget\n",
+				rect.x, rect.y, (int)(regionBytes >> 10));
+			return false;
+		}
+
+		int width = (rect.width + 1) / 2;
+		int height = (rect.height + 1) / 2;
+		m_tilesSplit++;
+		vector<float>().swap(field);
+		for(int y=rect.y; y<rect.y+rect.height; y+=height)
+		{
+			for(int x=rect.x; x<rect.x+rect.width; x+=width)
+			{
+				CvRect part = cvRect(x, y, min(width, rect.x + rect.width - x), min(height, rect.y + rect.height - y));
+				if(!renderTile(part))
+					return false;
+			}
+		}
+		return true;
+	}
+	m_peakRegion = max(m_peakRegion, regionBytes);
+
+	// Levels a tile does not sample are left without pixels
+	vector<CMorphKernel::SourceLevel> levels[2];
+	vector<IplImage*> images;
+	bool isLoaded = true;
+	for(int i=0; i<2; i++)
+	{
+		levels[i].resize(regions[i].size());
+		for(int level=0; level<(int)regions[i].size(); level++)
+		{
+			const CvRect& region = regions[i][level];
+			CMorphKernel::SourceLevel& lv = levels[i][level];
+			lv.image = NULL;
+			lv.scaleX = (float)m_source[i].getLevelWidth(level) / m_width;
+			lv.scaleY = (float)m_source[i].getLevelHeight(level) / m_height;
+			lv.originX = region.x;
+			lv.originY = region.y;
+			if(region.width <= 0 || !isLoaded)
+				continue;
+
+			IplImage* image = cvCreateImage(cvSize(region.width, region.height), IPL_DEPTH_8U, 3);
+			images.push_back(image);
+			lv.image = image;
+			isLoaded = loadRegion(i, level, region, image);
+		}
+	}
+
+	if(isLoaded)
+	{
+		vector<char> tile(rect.width * rect.height * 3);
+		m_kernel.renderRect(m_step, &field[0], fieldRect, rect, levels[0], levels[1], &tile[0], rect.width * 3);
+		isLoaded = writeTile(rect, &tile[0]);
+		m_tilesRendered++;
+	}
+
+	for(int i=0; i<(int)images.size(); i++)
+		cvReleaseImage(&images[i]);
+	return isLoaded;
+}
+
+//---------------------------------------------------------------------------
+// Bounds of the level pixels each level of an image is sampled at over
+// rect, found the same way the kernel picks levels and bilinear taps.
+// Unsampled levels get an empty region.
+//---------------------------------------------------------------------------
+void CTiledMorph::getRegions( int image, const float* field, const CvRect& fieldRect, const CvRect& rect,
+	vector<CvRect>* regions )
+{
+	CTileFile& source = m_source[image];
+	int levelCount = source.getLevelCount();
+	vector<int> bounds(levelCount * 4);
+	for(int level=0; level<levelCount; level++)
+	{
+		bounds[level*4] = bounds[level*4+1] = INT_MAX;
+		bounds[level*4+2] = bounds[level*4+3] = INT_MIN;
+	}
+
+	int rowSize = fieldRect.width * 4;
+	int lastY = fieldRect.y + fieldRect.height - 1;
+	for(int y=rect.y; y<rect.y+rect.height; y++)
+	{
+		int prevY = max(y - 1, fieldRect.y);
+		int nextY = min(y + 1, lastY);
+		const float* row = field + (y - fieldRect.y) * rowSize + image * 2;
+		const float* prevRow = field + (prevY - fieldRect.y) * rowSize + image * 2;
+		const float* nextRow = field + (nextY - fieldRect.y) * rowSize + image * 2;
+
+		for(int x=rect.x-fieldRect.x; x<rect.x-fieldRect.x+rect.width; x++)
+		{
+			float lod = CMorphKernel::getLod(row, prevRow, nextRow, x, fieldRect.width, (float)(nextY - prevY));
+			float weight;
+			int level = CMorphKernel::getLevel(lod, levelCount, &weight);
+			int lastLevel = weight > 0 ? level + 1 : level;
+
+			for(; level<=lastLevel; level++)
+			{
+				int width = source.getLevelWidth(level);
+				int height = source.getLevelHeight(level);
+				float scaleX = (float)width / m_width;
+				float scaleY = (float)height / m_height;
+				int tapX = (int)floor(row[x*4] * scaleX - 0.5f);
+				int tapY = (int)floor(row[x*4+1] * scaleY - 0.5f);
+				int* b = &bounds[level*4];
+				b[0] = min(b[0], min(max(tapX, 0), width - 1));
+				b[1] = min(b[1], min(max(tapY, 0), height - 1));
+				b[2] = max(b[2], min(max(tapX + 1, 0), width - 1));
+				b[3] = max(b[3], min(max(tapY + 1, 0), height - 1));
+			}
+		}
+	}
+
+	regions->resize(levelCount);
+	for(int level=0; level<levelCount; level++)
+	{
+		const int* b = &bounds[level*4];
+		(*regions)[level] = b[0] <= b[2] ? cvRect(b[0], b[1], b[2] - b[0] + 1, b[3] - b[1] + 1) : cvRect(0, 0, 0, 0);
+	}
+}
+
+//---------------------------------------------------------------------------
+// Copy a region of a level out of the source tiles covering it
+//---------------------------------------------------------------------------
+bool CTiledMorph::loadRegion( int image, int level, const CvRect& region, IplImage* dst )
+{
+	int tileSize = m_source[image].getTileSize();
+	int right = region.x + region.width;
+	int bottom = region.y + region.height;
+
+	for(int ty=region.y/tileSize; ty<=(bottom-1)/tileSize; ty++)
+	{
+		for(int tx=region.x/tileSize; tx<=(right-1)/tileSize; tx++)
+		{
+			shared_ptr< vector<char> > tile = getSourceTile(image, level, tx, ty);
+			if(!tile)
+				return false;
+
+			int x0 = max(region.x, tx * tileSize);
+			int x1 = min(right, (tx + 1) * tileSize);
+			int y0 = max(region.y, ty * tileSize);
+			int y1 = min(bottom, (ty + 1) * tileSize);
+			for(int y=y0; y<y1; y++)
+			{
+				const char* src = &(*tile)[((y - ty * tileSize) * tileSize + x0 - tx * tileSize) * 3];
+				char* row = dst->imageData + (y - region.y) * dst->widthStep + (x0 - region.x) * 3;
+				memcpy(row, src, (x1 - x0) * 3);
+			}
+		}
+	}
+	return true;
+}
+
+shared_ptr< vector<char> > CTiledMorph::getSourceTile( int image, int level, int tileX, int tileY )
+{
+	long long key = ((long long)image << 56) | ((long long)level << 48) | ((long long)tileY << 24) | tileX;
+	shared_ptr< vector<char> > tile;
+	if(m_tileCache.find(key, &tile))
+		return tile;
+
+	int tileSize = m_source[image].getTileSize();
+	tile.reset(new vector<char>(tileSize * tileSize * 3));
+	if(!m_source[image].readTile(level, tileX, tileY, &(*tile)[0]))
+		return shared_ptr< vector<char> >();
+	m_sourceReads++;
+	m_tileCache.insert(key, tile, tile->size());
+	return tile;
+}
+
+//---------------------------------------------------------------------------
+// Write a BGR tile into its rows of the output, which is RGB
+//---------------------------------------------------------------------------
+bool CTiledMorph::writeTile( const CvRect& rect, const char* data )
+{
+	for(int r=0; r<rect.height; r++)
+	{
+		const char* src = data + r * rect.width * 3;
+		for(int x=0; x<rect.width; x++)
+		{
+			m_outputRow[x*3] = src[x*3+2];
+			m_outputRow[x*3+1] = src[x*3+1];
+			m_outputRow[x*3+2] = src[x*3];
+		}
+
+		__int64 offset = m_outputOffset + ((__int64)(rect.y + r) * m_width + rect.x) * 3;
+		if(_fseeki64(m_output, offset, SEEK_SET) != 0 || fwrite(&m_outputRow[0], rect.width * 3, 1, m_output) != 1)
+			return false;
+	}
+	return true;
+}
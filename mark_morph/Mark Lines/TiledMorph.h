@@ -0,0 +1,75 @@
+/////////////////////////////////////////////////////////////////////////////
+// File: TiledMorph.h
+//
+// Out-of-core morph driver
+// CTiledMorph renders one frame of a morph between images too large to
+// hold in memory, such as print resolution scans. Each image is converted
+// once into a tile file holding its pyramid. The output is rendered in
+// tiles: the displacement field of a tile gives the source pixels it
+// samples at each pyramid level, only the source tiles covering those are
+// paged in, and the finished tile is written straight to the output file.
+//
+// Source tiles are kept in an LRU cache, so neighbouring output tiles
+// share what they read. Memory is bounded by a budget split between the
+// cache, the source regions of the tile being rendered and its field.
+// Output tiles whose sources do not fit are split until they do, down to
+// single pixels if need be; the render fails rather than go over budget.
+//
+// Usage: -tiled <imageA> <imageB> <out.ppm> [-t step] [-budget MB]
+//
+// Author: Leon Ho
+/////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <cv.h>
+#include "LruCache.h"
+#include "MorphKernel.h"
+#include "TileFile.h"
+
+using namespace std;
+
+class CTiledMorph
+{
+private:
+	string m_imageFile[2];
+	string m_outputFile;
+	float m_step;
+	int m_budgetMB;
+
+	CTileFile m_source[2];
+	CMorphKernel m_kernel;
+	CLruCache< long long, shared_ptr< vector<char> > > m_tileCache;
+	size_t m_regionBudget;		// Bytes of source regions per output tile
+	int m_tileSize;				// Output tile size before splitting
+	int m_width, m_height;
+
+	FILE* m_output;
+	__int64 m_outputOffset;		// Offset of the first pixel in the output
+	vector<char> m_outputRow;
+
+	// Statistics
+	int m_tilesRendered, m_tilesSplit;
+	int m_sourceReads;
+	size_t m_peakRegion;
+
+public:
+	bool parseArgs(int argc, char* argv[]);
+	bool run();
+
+	CTiledMorph(void);
+	~CTiledMorph(void);
+
+private:
+	void printUsage();
+	bool openSource(int image);
+	bool renderTile(const CvRect& rect);
+	void getRegions(int image, const float* field, const CvRect& fieldRect, const CvRect& rect,
+		vector<CvRect>* regions);
+	bool loadRegion(int image, int level, const CvRect& region, IplImage* dst);
+	shared_ptr< vector<char> > getSourceTile(int image, int level, int tileX, int tileY);
+	bool writeTile(const CvRect& rect, const char* data);
+};
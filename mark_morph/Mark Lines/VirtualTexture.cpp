@@ -0,0 +1,350 @@
+/////////////////////////////////////////////////////////////////////////////
+// File: VirtualTexture.cpp
+//
+// Virtual texture
+// CVirtualTexture lets the morph shader sample an image and its pyramid at
+// any size, including past GL_MAX_TEXTURE_SIZE. Each level is split into
+// fixed-size pages, and only the pages a draw requests are kept resident,
+// in a single atlas texture. A page table texture maps every page of every
+// level to its place in the atlas, and the shader samples the image
+// through it instead of through one texture of the image's size.
+//
+// Pages missing from the atlas are marked in the table, and the shader
+// falls back to the next coarser level that is resident. Levels that fit
+// in one page are always resident, so a missed page is drawn blurred
+// instead of leaving a hole. When the whole pyramid fits in the atlas it
+// is loaded once and requests are ignored.
+//
+// Page table layout, one RGBA float texel per entry:
+//		row 0, column L: level L's (width / image width,
+//			height / image height, first page row, pixels per page)
+//		page rows: (atlas x, atlas y, resident, 1 / atlas size), the atlas
+//			position being that of the page's first pixel past its border
+//
+// Author: Leon Ho
+/////////////////////////////////////////////////////////////////////////////
+
+#include "VirtualTexture.h"
+#include "shader_util.h"
+#include <algorithm>
+#include <functional>
+#include <math.h>
+#include <stdio.h>
+
+const int PAGE_TEXELS = 128;				// Page size in the atlas
+const int PAGE_STEP = PAGE_TEXELS - 2;		// Level pixels per page; the rest is a border for filtering
+
+CVirtualTexture::CVirtualTexture(void)
+{
+	m_pyramid = NULL;
+	m_width = m_height = 0;
+	m_atlas = m_pageTable = 0;
+	m_atlasSlots = 0;
+	m_pinnedCount = 0;
+	m_isAllResident = false;
+	m_draw = 0;
+	m_staging.resize(PAGE_TEXELS * PAGE_TEXELS * 3);
+}
+
+CVirtualTexture::~CVirtualTexture(void)
+{
+}
+
+//---------------------------------------------------------------------------
+// Page a pyramid's levels and create the atlas, at most maxAtlasSize
+// texels square, and the page table. The pyramid's levels are those
+// CMorphKernel builds, so the GPU and the CPU sample the same levels. The
+// pyramid must outlive this object.
+//---------------------------------------------------------------------------
+bool CVirtualTexture::init( CImagePyramid* pyramid, int maxAtlasSize )
+{
+	release();
+	if(pyramid == NULL || pyramid->getLevelCount() == 0)
+		return false;
+	m_pyramid = pyramid;
+	m_width = pyramid->getLevel(0)->width;
+	m_height = pyramid->getLevel(0)->height;
+
+	int tableHeight = 1;
+	int pageCount = 0;
+	int singlePageCount = 0;
+	for(int i=0; i<pyramid->getLevelCount(); i++)
+	{
+		const IplImage* src = pyramid->getLevel(i);
+		Level level;
+		level.image = src;
+		level.pagesX = (src->width + PAGE_STEP - 1) / PAGE_STEP;
+		level.pagesY = (src->height + PAGE_STEP - 1) / PAGE_STEP;
+		level.firstRow = tableHeight;
+		m_levelList.push_back(level);
+		tableHeight += level.pagesY;
+		pageCount += level.pagesX * level.pagesY;
+		if(level.pagesX * level.pagesY == 1)
+			singlePageCount++;
+	}
+
+	// The atlas is only as large as the whole pyramid needs
+	m_atlasSlots = 1;
+	while(m_atlasSlots * m_atlasSlots < pageCount && (m_atlasSlots + 1) * PAGE_TEXELS <= maxAtlasSize)
+		m_atlasSlots++;
+	m_isAllResident = m_atlasSlots * m_atlasSlots >= pageCount;
+
+	GLint maxTableSize;
+	glGetIntegerv(GL_MAX_RECTANGLE_TEXTURE_SIZE_ARB, &maxTableSize);
+	int tableWidth = max((int)m_levelList.size(), m_levelList[0].pagesX);
+	if(tableWidth > maxTableSize || tableHeight > maxTableSize ||
+		m_atlasSlots * m_atlasSlots <= singlePageCount)
+	{
+		fprintf(stderr, "Error: Cannot page a %dx%d image\n", m_width, m_height);
+		release();
+		return false;
+	}
+
+	Slot empty = {-1, 0, false};
+	m_slotList.assign(m_atlasSlots * m_atlasSlots, empty);
+
+	// Every page starts out missing
+	float invAtlasSize = 1.0f / (m_atlasSlots * PAGE_TEXELS);
+	vector<float> table(tableWidth * tableHeight * 4, 0.0f);
+	for(int i=0; i<(int)m_levelList.size(); i++)
+	{
+		const Level& lv = m_levelList[i];
+		float* info = &table[i * 4];
+		info[0] = (float)lv.image->width / m_width;
+		info[1] = (float)lv.image->height / m_height;
+		info[2] = (float)lv.firstRow;
+		info[3] = (float)PAGE_STEP;
+		for(int py=0; py<lv.pagesY; py++)
+		{
+			for(int px=0; px<lv.pagesX; px++)
+				table[((lv.firstRow + py) * tableWidth + px) * 4 + 3] = invAtlasSize;
+		}
+	}
+
+	glGenTextures(1, &m_atlas);
+	glBindTexture(GL_TEXTURE_2D, m_atlas);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, m_atlasSlots * PAGE_TEXELS, m_atlasSlots * PAGE_TEXELS, 0,
+		GL_BGR, GL_UNSIGNED_BYTE, NULL);
+
+	glGenTextures(1, &m_pageTable);
+	glBindTexture(GL_TEXTURE_RECTANGLE_ARB, m_pageTable);
+	glTexParameteri(GL_TEXTURE_RECTANGLE_ARB, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_RECTANGLE_ARB, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_RECTANGLE_ARB, GL_TEXTURE_WRAP_S, GL_CLAMP);
+	glTexParameteri(GL_TEXTURE_RECTANGLE_ARB, GL_TEXTURE_WRAP_T, GL_CLAMP);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexImage2D(GL_TEXTURE_RECTANGLE_ARB, 0, GL_RGBA32F_ARB, tableWidth, tableHeight, 0,
+		GL_RGBA, GL_FLOAT, &table[0]);
+
+	// Single page levels stay resident for the shader to fall back to.
+	// Everything does when it all fits.
+	int slot = 0;
+	for(int i=0; i<(int)m_levelList.size(); i++)
+	{
+		const Level& lv = m_levelList[i];
+		if(!m_isAllResident && lv.pagesX * lv.pagesY > 1)
+			continue;
+		for(int py=0; py<lv.pagesY; py++)
+		{
+			for(int px=0; px<lv.pagesX; px++)
+				loadPage(CImagePyramid::getKey(i, px, py), slot++, true);
+		}
+	}
+	m_pinnedCount = slot;
+
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glBindTexture(GL_TEXTURE_RECTANGLE_ARB, 0);
+	printOpenGLError();
+	return true;
+}
+
+//---------------------------------------------------------------------------
+// Free the textures. Needs the window's GL context.
+//---------------------------------------------------------------------------
+void CVirtualTexture::release()
+{
+	if(m_atlas != 0)
+		glDeleteTextures(1, &m_atlas);
+	if(m_pageTable != 0)
+		glDeleteTextures(1, &m_pageTable);
+	m_atlas = m_pageTable = 0;
+
+	m_pyramid = NULL;
+	m_levelList.clear();
+	m_slotList.clear();
+	m_pageList.clear();
+	m_requestList.clear();
+	m_atlasSlots = 0;
+	m_pinnedCount = 0;
+	m_isAllResident = false;
+}
+
+int CVirtualTexture::getLevelCount()
+{
+	return m_levelList.size();
+}
+
+bool CVirtualTexture::isAllResident()
+{
+	return m_isAllResident;
+}
+
+void CVirtualTexture::clearRequests()
+{
+	m_requestList.clear();
+}
+
+//---------------------------------------------------------------------------
+// Request the pages of a level covering a region given in image pixels.
+// Pages are added for the bilinear taps either side of the region's edges.
+//---------------------------------------------------------------------------
+void CVirtualTexture::requestRegion( int level, float x0, float y0, float x1, float y1 )
+{
+	if(m_isAllResident)
+		return;
+
+	const Level& lv = m_levelList[level];
+	float scaleX = (float)lv.image->width / m_width;
+	float scaleY = (float)lv.image->height / m_height;
+	int pageX0 = min(max((int)floor((x0 * scaleX - 1) / PAGE_STEP), 0), lv.pagesX - 1);
+	int pageY0 = min(max((int)floor((y0 * scaleY - 1) / PAGE_STEP), 0), lv.pagesY - 1);
+	int pageX1 = min(max((int)floor((x1 * scaleX + 1) / PAGE_STEP), 0), lv.pagesX - 1);
+	int pageY1 = min(max((int)floor((y1 * scaleY + 1) / PAGE_STEP), 0), lv.pagesY - 1);
+
+	for(int py=pageY0; py<=pageY1; py++)
+	{
+		for(int px=pageX0; px<=pageX1; px++)
+			m_requestList.push_back(CImagePyramid::getKey(level, px, py));
+	}
+}
+
+//---------------------------------------------------------------------------
+// Requests are kept coarsest level first and without duplicates
+//---------------------------------------------------------------------------
+void CVirtualTexture::sortRequests()
+{
+	sort(m_requestList.begin(), m_requestList.end(), greater<long long>());
+	m_requestList.erase(unique(m_requestList.begin(), m_requestList.end()), m_requestList.end());
+}
+
+//---------------------------------------------------------------------------
+// Whether every requested page fits in the atlas at once
+//---------------------------------------------------------------------------
+bool CVirtualTexture::isRequestFitting()
+{
+	sortRequests();
+	int count = 0;
+	for(int i=0; i<(int)m_requestList.size(); i++)
+	{
+		auto it = m_pageList.find(m_requestList[i]);
+		if(it == m_pageList.end() || !m_slotList[it->second].isPinned)
+			count++;
+	}
+	return count <= (int)m_slotList.size() - m_pinnedCount;
+}
+
+//---------------------------------------------------------------------------
+// Make the requested pages resident, evicting pages this draw does not use
+// least recently used first. Pages that do not fit are left missing,
+// finest levels first. Returns false if any was. Loading binds the atlas
+// and page table to the active texture unit, so bind() should follow.
+//---------------------------------------------------------------------------
+bool CVirtualTexture::loadRequests()
+{
+	m_draw++;
+	sortRequests();
+
+	// Resident pages are claimed before any is evicted
+	vector<long long> missingList;
+	for(int i=0; i<(int)m_requestList.size(); i++)
+	{
+		auto it = m_pageList.find(m_requestList[i]);
+		if(it != m_pageList.end())
+			m_slotList[it->second].lastUse = m_draw;
+		else
+			missingList.push_back(m_requestList[i]);
+	}
+
+	for(int i=0; i<(int)missingList.size(); i++)
+	{
+		int slot = findSlot();
+		if(slot == -1)
+			return false;
+		loadPage(missingList[i], slot, false);
+	}
+	return true;
+}
+
+//---------------------------------------------------------------------------
+// A free slot, else the least recently used one not pinned or claimed by
+// this draw, or -1
+//---------------------------------------------------------------------------
+int CVirtualTexture::findSlot()
+{
+	int lru = -1;
+	for(int i=0; i<(int)m_slotList.size(); i++)
+	{
+		const Slot& slot = m_slotList[i];
+		if(slot.isPinned || slot.lastUse == m_draw)
+			continue;
+		if(slot.key == -1)
+			return i;
+		if(lru == -1 || slot.lastUse < m_slotList[lru].lastUse)
+			lru = i;
+	}
+	return lru;
+}
+
+void CVirtualTexture::loadPage( long long key, int slot, bool isPinned )
+{
+	Slot& s = m_slotList[slot];
+	if(s.key != -1)
+	{
+		setEntry(s.key, 0, 0, false);
+		m_pageList.erase(s.key);
+	}
+
+	int level, pageX, pageY;
+	CImagePyramid::splitKey(key, &level, &pageX, &pageY);
+	int x = slot % m_atlasSlots * PAGE_TEXELS;
+	int y = slot / m_atlasSlots * PAGE_TEXELS;
+
+	// Pages start a pixel early for their border
+	m_pyramid->copyBlock(level, pageX * PAGE_STEP - 1, pageY * PAGE_STEP - 1, PAGE_TEXELS, &m_staging[0]);
+	glBindTexture(GL_TEXTURE_2D, m_atlas);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, PAGE_TEXELS, PAGE_TEXELS, GL_BGR, GL_UNSIGNED_BYTE, &m_staging[0]);
+	setEntry(key, (float)(x + 1), (float)(y + 1), true);
+
+	s.key = key;
+	s.lastUse = m_draw;
+	s.isPinned = isPinned;
+	m_pageList[key] = slot;
+}
+
+//---------------------------------------------------------------------------
+// Entries are written as pages come and go; a draw loads few pages, so a
+// texel each costs less than uploading the table again
+//---------------------------------------------------------------------------
+void CVirtualTexture::setEntry( long long key, float x, float y, bool isResident )
+{
+	int level, pageX, pageY;
+	CImagePyramid::splitKey(key, &level, &pageX, &pageY);
+	float entry[4] = {x, y, isResident ? 1.0f : 0.0f, 1.0f / (m_atlasSlots * PAGE_TEXELS)};
+
+	glBindTexture(GL_TEXTURE_RECTANGLE_ARB, m_pageTable);
+	glTexSubImage2D(GL_TEXTURE_RECTANGLE_ARB, 0, pageX, m_levelList[level].firstRow + pageY, 1, 1,
+		GL_RGBA, GL_FLOAT, entry);
+}
+
+void CVirtualTexture::bind( int atlasUnit, int tableUnit )
+{
+	glActiveTexture(GL_TEXTURE0 + atlasUnit);
+	glBindTexture(GL_TEXTURE_2D, m_atlas);
+	glActiveTexture(GL_TEXTURE0 + tableUnit);
+	glBindTexture(GL_TEXTURE_RECTANGLE_ARB, m_pageTable);
+}
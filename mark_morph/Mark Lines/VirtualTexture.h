@@ -0,0 +1,89 @@
+/////////////////////////////////////////////////////////////////////////////
+// File: VirtualTexture.h
+//
+// Virtual texture
+// CVirtualTexture lets the morph shader sample an image and its pyramid at
+// any size, including past GL_MAX_TEXTURE_SIZE. Each level is split into
+// fixed-size pages, and only the pages a draw requests are kept resident,
+// in a single atlas texture. A page table texture maps every page of every
+// level to its place in the atlas, and the shader samples the image
+// through it instead of through one texture of the image's size.
+//
+// Pages missing from the atlas are marked in the table, and the shader
+// falls back to the next coarser level that is resident. Levels that fit
+// in one page are always resident, so a missed page is drawn blurred
+// instead of leaving a hole. When the whole pyramid fits in the atlas it
+// is loaded once and requests are ignored.
+//
+// Page table layout, one RGBA float texel per entry:
+//		row 0, column L: level L's (width / image width,
+//			height / image height, first page row, pixels per page)
+//		page rows: (atlas x, atlas y, resident, 1 / atlas size), the atlas
+//			position being that of the page's first pixel past its border
+//
+// Author: Leon Ho
+/////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <map>
+#include <vector>
+#include <cv.h>
+#include <GL/glew.h>
+#include "ImagePyramid.h"
+
+using namespace std;
+
+class CVirtualTexture
+{
+private:
+	struct Level
+	{
+		const IplImage* image;
+		int pagesX, pagesY;
+		int firstRow;				// Page table row of the level's first pages
+	};
+
+	struct Slot
+	{
+		long long key;				// Page held, or -1
+		unsigned int lastUse;
+		bool isPinned;
+	};
+
+private:
+	CImagePyramid* m_pyramid;
+	vector<Level> m_levelList;		// Finest first, as in the pyramid
+	int m_width, m_height;
+	GLuint m_atlas, m_pageTable;
+	int m_atlasSlots;				// Pages per atlas side
+	vector<Slot> m_slotList;
+	map<long long, int> m_pageList;	// Slot of each resident page
+	int m_pinnedCount;
+	vector<long long> m_requestList;
+	bool m_isAllResident;
+	unsigned int m_draw;
+	vector<unsigned char> m_staging;
+
+public:
+	bool init(CImagePyramid* pyramid, int maxAtlasSize);
+	void release();
+	int getLevelCount();
+	bool isAllResident();
+
+	// Pages a draw samples are requested by region, then loaded at once
+	void clearRequests();
+	void requestRegion(int level, float x0, float y0, float x1, float y1);
+	bool isRequestFitting();
+	bool loadRequests();
+	void bind(int atlasUnit, int tableUnit);
+
+	CVirtualTexture(void);
+	~CVirtualTexture(void);
+
+private:
+	void sortRequests();
+	int findSlot();
+	void loadPage(long long key, int slot, bool isPinned);
+	void setEntry(long long key, float x, float y, bool isResident);
+};
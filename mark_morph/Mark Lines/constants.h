@@ -16,9 +16,63 @@
 const char IMAGEA[] = "inputa.jpg";
 const char IMAGEB[] = "inputb.jpg";
 const char OUTVIDEO[] = "outvid.avi";
+const char OUTVIDEO_REVERSE[] = "outvid_reverse.avi";
+const char FRAMESTORE[] = "outvid.frames";
+const char WARPFILE[] = "morph.warp";	// Warp parameters tuned for this pair
 const int FRAMERATE = 24;
 const int DURATION = 3;
 const int CODEC = 0;
+const int EXPORT_POLL_MS = 200;	// Export progress update interval
+
+// Frame store budgets in megabytes
+const int FRAMESTORE_DISK_MB = 2048;
+const int FRAMESTORE_RAM_MB = 256;
+const int FRAMESTORE_STATES = 4;	// Line states whose frames are kept
+const int FRAMESTORE_FILL_MS = 10;	// Background rendering time per update
+
+// Default warp parameters. The output window tunes them for each pair and
+// keeps them in WARPFILE; batch and service modes use these.
+const float WARP_A = 0.5;		// smoothness of warping
+const float WARP_B = 3.25;		// relative line strength
+const float WARP_P = 0.25;
+
+// Result cache settings
+const char RESULTCACHE_DIR[] = "cache";
+const int RESULTCACHE_RAM_MB = 256;
+const int RESULTCACHE_DISK_MB = 4096;
+
+// Batch mode settings
+const char BATCH_OUTDIR[] = "batch";
+const int BATCH_PREFETCH = 8;	// Pairs to decode ahead of the workers
+
+// Service mode settings
+const char SERVICE_PIPE[] = "\\\\.\\pipe\\morphd";
+const char SERVICE_DIR[] = "service";
+const int SERVICE_IMAGE_CACHE_MB = 512;
+const int SERVICE_LINE_CACHE_MB = 16;
+const int SERVICE_KERNEL_CACHE = 32;	// Prepared pairs
+const int SERVICE_FINISHED_JOBS = 64;	// Finished jobs kept for fetching
+
+// Out-of-core mode settings
+const char TILEFILE_EXT[] = ".mtf";
+const int OUTOFCORE_BUDGET_MB = 512;
+const int OUTOFCORE_TILE = 512;		// Output tile size in pixels
+const int OUTOFCORE_MIN_TILE = 16;	// Smallest output tile size chosen up front
+
+// Output window tiling. Faces are paged in through a virtual texture, and
+// the output is rendered in tiles, so images past GL_MAX_TEXTURE_SIZE render
+// on the GPU.
+const int VTEX_ATLAS_SIZE = 4096;	// Largest page atlas, in texels square
+const int VTEX_OUTPUT_TILE = 2048;	// Output tile size; a power of two so preview scales divide it
+const int VTEX_GRID = 16;			// Output pixels between samples of the field finding pages
+const float VTEX_LOD_MARGIN = 0.5f;	// Levels of detail requested either side of the field's
+const int VTEX_MIN_TILE = 64;		// Smallest output rectangle a tile is split into
+
+// Preview settings for dragging and scrubbing
+const int PREVIEW_RATE = 60;			// Most drag previews per second
+const int PREVIEW_LATENCY_MS = 40;		// Render time budget per preview
+const int PREVIEW_REFINE_MS = 150;		// Idle time before refining
+const int PREVIEW_MAX_SCALE = 8;		// Coarsest preview, in image pixels per pixel
 
 // Shaders' filenames.
 const char VERTSHADER[] = "morph.vert";
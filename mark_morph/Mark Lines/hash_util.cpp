@@ -0,0 +1,53 @@
+/////////////////////////////////////////////////////////////////////////////
+// File: hash_util.cpp
+//
+// Hashing routines
+// 64-bit FNV-1a hashes used to key cached and checkpointed renders by
+// their inputs. Hashes can be chained by passing a previous hash as the
+// seed.
+//
+// Author: Leon Ho
+/////////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include "hash_util.h"
+
+const hash64 HASH_PRIME = 1099511628211ULL;
+
+hash64 hashBytes(const void* data, size_t size, hash64 seed)
+{
+	const unsigned char* bytes = (const unsigned char*)data;
+	hash64 hash = seed;
+	for(size_t i=0; i<size; i++)
+	{
+		hash ^= bytes[i];
+		hash *= HASH_PRIME;
+	}
+	return hash;
+}
+
+hash64 hashInt(int value, hash64 seed)
+{
+	return hashBytes(&value, sizeof(value), seed);
+}
+
+hash64 hashFloat(float value, hash64 seed)
+{
+	return hashBytes(&value, sizeof(value), seed);
+}
+
+hash64 hashFile(const char* filename, hash64 seed)
+{
+	FILE* file = fopen(filename, "rb");
+	if(file == NULL)
+		return seed;
+
+	unsigned char buffer[4096];
+	size_t count;
+	hash64 hash = seed;
+	while((count = fread(buffer, 1, sizeof(buffer), file)) > 0)
+		hash = hashBytes(buffer, count, hash);
+
+	fclose(file);
+	return hash;
+}
@@ -0,0 +1,35 @@
+/////////////////////////////////////////////////////////////////////////////
+// File: hash_util.h
+//
+// Hashing routines
+// 64-bit FNV-1a hashes used to key cached and checkpointed renders by
+// their inputs. Hashes can be chained by passing a previous hash as the
+// seed.
+//
+// Author: Leon Ho
+/////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <stddef.h>
+
+typedef unsigned long long hash64;
+
+const hash64 HASH_SEED = 14695981039346656037ULL;
+
+/////////////////////////////////////////////////////////////////////////////
+// Hash size bytes starting at data.
+/////////////////////////////////////////////////////////////////////////////
+hash64 hashBytes(const void* data, size_t size, hash64 seed = HASH_SEED);
+
+/////////////////////////////////////////////////////////////////////////////
+// Hash a single value, e.g. a render parameter.
+/////////////////////////////////////////////////////////////////////////////
+hash64 hashInt(int value, hash64 seed = HASH_SEED);
+hash64 hashFloat(float value, hash64 seed = HASH_SEED);
+
+/////////////////////////////////////////////////////////////////////////////
+// Hash the contents of a file. Returns seed unchanged if the file cannot
+// be read.
+/////////////////////////////////////////////////////////////////////////////
+hash64 hashFile(const char* filename, hash64 seed = HASH_SEED);
@@ -0,0 +1,269 @@
+/////////////////////////////////////////////////////////////////////////////
+// File: line_io.cpp
+//
+// Line file routines
+// Line sets are stored either as legacy .mld text, one "Px Py Qx Qy" line
+// per row, or as binary .mlb files. A .mlb file holds a versioned header
+// followed by the vertex and index buffers exactly as they are held in
+// memory, so it is loaded with a single mapping and no parsing.
+//
+// Coordinates are kept as stored in the file, with y pointing down.
+// Packed lines are (Px, Py, Qx, Qy) floats, the layout used for GPU
+// upload and by the CPU kernel.
+//
+// Author: Leon Ho
+/////////////////////////////////////////////////////////////////////////////
+
+#include <windows.h>
+#include <stdio.h>
+#include <string.h>
+#include <map>
+#include <highgui.h>
+#include "line_io.h"
+
+const char LINEFILE_MAGIC[] = "MLB";
+const int LINEFILE_VERSION = 1;
+
+struct LineFileHeader
+{
+	char magic[4];
+	int version;
+	hash64 imageHash;
+	int imageWidth, imageHeight;
+	int vertexCount, lineCount;
+	int vertexOffset, indexOffset;		// Byte offsets from the file start
+};
+
+static bool hasExtension(const char* filename, const char* ext)
+{
+	size_t length = strlen(filename);
+	size_t extLength = strlen(ext);
+	return length >= extLength && _stricmp(filename + length - extLength, ext) == 0;
+}
+
+static void clearLineSet(LineSet* lineSet)
+{
+	lineSet->vertices.clear();
+	lineSet->lines.clear();
+	lineSet->imageHash = 0;
+	lineSet->imageWidth = lineSet->imageHeight = 0;
+}
+
+//---------------------------------------------------------------------------
+// Map a binary line file and copy its buffers out. Returns false without
+// an error if the file is not a binary line file.
+//---------------------------------------------------------------------------
+static bool readBinary(const char* filename, LineSet* lineSet, bool* isBinary)
+{
+	*isBinary = false;
+	HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL,
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if(file == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER fileSize;
+	HANDLE mapping = NULL;
+	const char* view = NULL;
+	if(GetFileSizeEx(file, &fileSize) && fileSize.QuadPart >= (__int64)sizeof(LineFileHeader))
+		mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if(mapping != NULL)
+		view = (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+
+	bool isRead = false;
+	const LineFileHeader* header = (const LineFileHeader*)view;
+	if(header != NULL && memcmp(header->magic, LINEFILE_MAGIC, sizeof(header->magic)) == 0)
+	{
+		*isBinary = true;
+		__int64 vertexEnd = header->vertexOffset + (__int64)header->vertexCount * sizeof(CvPoint2D32f);
+		__int64 indexEnd = header->indexOffset + (__int64)header->lineCount * sizeof(LineIndex);
+		if(header->version != LINEFILE_VERSION)
+			fprintf(stderr, "Error: %s has unsupported version %d\n", filename, header->version);
+		else if(header->vertexOffset < (int)sizeof(LineFileHeader) ||
+			header->indexOffset < (int)sizeof(LineFileHeader))
+			fprintf(stderr, "Error: %s has vertex or line data inside its header\n", filename);
+		else if(header->vertexCount < 0 || header->lineCount < 0 ||
+			vertexEnd > fileSize.QuadPart || indexEnd > fileSize.QuadPart)
+			fprintf(stderr, "Error: %s is truncated\n", filename);
+		else
+		{
+			const CvPoint2D32f* vertices = (const CvPoint2D32f*)(view + header->vertexOffset);
+			const LineIndex* lines = (const LineIndex*)(view + header->indexOffset);
+			lineSet->vertices.assign(vertices, vertices + header->vertexCount);
+			lineSet->lines.assign(lines, lines + header->lineCount);
+			lineSet->imageHash = header->imageHash;
+			lineSet->imageWidth = header->imageWidth;
+			lineSet->imageHeight = header->imageHeight;
+			isRead = true;
+
+			for(auto it=lineSet->lines.begin(); it!=lineSet->lines.end(); it++)
+			{
+				if(it->start < 0 || it->start >= header->vertexCount ||
+					it->end < 0 || it->end >= header->vertexCount)
+				{
+					fprintf(stderr, "Error: %s has an invalid line index\n", filename);
+					clearLineSet(lineSet);
+					isRead = false;
+					break;
+				}
+			}
+		}
+	}
+
+	if(view != NULL)
+		UnmapViewOfFile(view);
+	if(mapping != NULL)
+		CloseHandle(mapping);
+	CloseHandle(file);
+	return isRead;
+}
+
+static bool readText(const char* filename, LineSet* lineSet)
+{
+	FILE* lineFile = fopen(filename, "r");
+	if(lineFile == NULL)
+		return false;
+
+	// Weld line ends with identical coordinates
+	map<pair<float, float>, int> vertexIndex;
+	float coords[4];
+	while(fscanf(lineFile, "%f %f %f %f", &coords[0], &coords[1], &coords[2], &coords[3]) == 4)
+	{
+		int ends[2];
+		for(int i=0; i<2; i++)
+		{
+			pair<float, float> key(coords[i*2], coords[i*2+1]);
+			auto it = vertexIndex.find(key);
+			if(it == vertexIndex.end())
+			{
+				CvPoint2D32f pt; pt.x = key.first; pt.y = key.second;
+				lineSet->vertices.push_back(pt);
+				it = vertexIndex.insert(make_pair(key, (int)lineSet->vertices.size() - 1)).first;
+			}
+			ends[i] = it->second;
+		}
+		LineIndex line; line.start = ends[0]; line.end = ends[1];
+		lineSet->lines.push_back(line);
+	}
+	fclose(lineFile);
+	return true;
+}
+
+bool readLineSet( const char* filename, LineSet* lineSet )
+{
+	clearLineSet(lineSet);
+
+	bool isBinary;
+	if(readBinary(filename, lineSet, &isBinary))
+		return true;
+	if(isBinary)
+		return false;
+	return readText(filename, lineSet);
+}
+
+bool writeLineSet( const char* filename, const LineSet& lineSet )
+{
+	LineFileHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, LINEFILE_MAGIC, sizeof(header.magic));
+	header.version = LINEFILE_VERSION;
+	header.imageHash = lineSet.imageHash;
+	header.imageWidth = lineSet.imageWidth;
+	header.imageHeight = lineSet.imageHeight;
+	header.vertexCount = lineSet.vertices.size();
+	header.lineCount = lineSet.lines.size();
+	header.vertexOffset = sizeof(header);
+	header.indexOffset = header.vertexOffset + header.vertexCount * sizeof(CvPoint2D32f);
+
+	FILE* lineFile = fopen(filename, "wb");
+	if(lineFile == NULL)
+	{
+		fprintf(stderr, "Error: Cannot write %s\n", filename);
+		return false;
+	}
+	fwrite(&header, sizeof(header), 1, lineFile);
+	if(!lineSet.vertices.empty())
+		fwrite(&lineSet.vertices[0], sizeof(CvPoint2D32f), lineSet.vertices.size(), lineFile);
+	if(!lineSet.lines.empty())
+		fwrite(&lineSet.lines[0], sizeof(LineIndex), lineSet.lines.size(), lineFile);
+	bool isWritten = !ferror(lineFile);
+	return fclose(lineFile) == 0 && isWritten;
+}
+
+bool writeLineText( const char* filename, const LineSet& lineSet )
+{
+	FILE* lineFile = fopen(filename, "w");
+	if(lineFile == NULL)
+	{
+		fprintf(stderr, "Error: Cannot write %s\n", filename);
+		return false;
+	}
+
+	// 9 significant digits round-trip any float exactly
+	for(auto it=lineSet.lines.begin(); it!=lineSet.lines.end(); it++)
+	{
+		const CvPoint2D32f& start = lineSet.vertices[it->start];
+		const CvPoint2D32f& end = lineSet.vertices[it->end];
+		fprintf(lineFile, "%.9g %.9g %.9g %.9g\n", start.x, start.y, end.x, end.y);
+	}
+	bool isWritten = !ferror(lineFile);
+	return fclose(lineFile) == 0 && isWritten;
+}
+
+bool convertLineFile( const char* inFilename, const char* outFilename, const char* imageFilename )
+{
+	LineSet lineSet;
+	if(!readLineSet(inFilename, &lineSet))
+	{
+		fprintf(stderr, "Error: Cannot read %s\n", inFilename);
+		return false;
+	}
+
+	if(imageFilename != NULL)
+	{
+		IplImage* image = cvLoadImage(imageFilename, CV_LOAD_IMAGE_UNCHANGED);
+		if(image == NULL)
+		{
+			fprintf(stderr, "Error: Cannot load image %s\n", imageFilename);
+			return false;
+		}
+		lineSet.imageHash = hashBytes(image->imageData, image->imageSize);
+		lineSet.imageWidth = image->width;
+		lineSet.imageHeight = image->height;
+		cvReleaseImage(&image);
+	}
+
+	if(hasExtension(outFilename, LINEFILE_TEXT_EXT))
+		return writeLineText(outFilename, lineSet);
+	return writeLineSet(outFilename, lineSet);
+}
+
+bool loadLineFile( const char* filename, vector<float>* lines )
+{
+	LineSet lineSet;
+	if(!readLineSet(filename, &lineSet))
+		return false;
+	packLines(lineSet, lines);
+	return true;
+}
+
+void packLines( const LineSet& lineSet, vector<float>* lines )
+{
+	lines->clear();
+	lines->reserve(lineSet.lines.size() * 4);
+	for(auto it=lineSet.lines.begin(); it!=lineSet.lines.end(); it++)
+	{
+		lines->push_back(lineSet.vertices[it->start].x);
+		lines->push_back(lineSet.vertices[it->start].y);
+		lines->push_back(lineSet.vertices[it->end].x);
+		lines->push_back(lineSet.vertices[it->end].y);
+	}
+}
+
+string getLineFilename( const string& imageFilename )
+{
+	string baseName = imageFilename.substr(0, imageFilename.find_last_of("."));
+	string binaryName = baseName + LINEFILE_BINARY_EXT;
+	if(GetFileAttributesA(binaryName.c_str()) != INVALID_FILE_ATTRIBUTES)
+		return binaryName;
+	return baseName + LINEFILE_TEXT_EXT;
+}
@@ -0,0 +1,70 @@
+/////////////////////////////////////////////////////////////////////////////
+// File: line_io.h
+//
+// Line file routines
+// Line sets are stored either as legacy .mld text, one "Px Py Qx Qy" line
+// per row, or as binary .mlb files. A .mlb file holds a versioned header
+// followed by the vertex and index buffers exactly as they are held in
+// memory, so it is loaded with a single mapping and no parsing.
+//
+// Coordinates are kept as stored in the file, with y pointing down.
+// Packed lines are (Px, Py, Qx, Qy) floats, the layout used for GPU
+// upload and by the CPU kernel.
+//
+// Author: Leon Ho
+/////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cv.h>
+#include "hash_util.h"
+
+using namespace std;
+
+const char LINEFILE_TEXT_EXT[] = ".mld";
+const char LINEFILE_BINARY_EXT[] = ".mlb";
+
+struct LineIndex
+{
+	int start, end;
+};
+
+struct LineSet
+{
+	vector<CvPoint2D32f> vertices;
+	vector<LineIndex> lines;
+	hash64 imageHash;			// Hash of the decoded image, 0 if unknown
+	int imageWidth, imageHeight;
+};
+
+/////////////////////////////////////////////////////////////////////////////
+// Read a line set in either format. Text files have their line ends
+// welded into shared vertices where the coordinates are identical.
+// Returns false if the file cannot be read.
+/////////////////////////////////////////////////////////////////////////////
+bool readLineSet(const char* filename, LineSet* lineSet);
+
+/////////////////////////////////////////////////////////////////////////////
+// Write a line set as binary, or as legacy text. Text is written with
+// enough digits that every coordinate reads back to the same float.
+/////////////////////////////////////////////////////////////////////////////
+bool writeLineSet(const char* filename, const LineSet& lineSet);
+bool writeLineText(const char* filename, const LineSet& lineSet);
+
+/////////////////////////////////////////////////////////////////////////////
+// Convert between formats, choosing the output format by its extension.
+/////////////////////////////////////////////////////////////////////////////
+bool convertLineFile(const char* inFilename, const char* outFilename, const char* imageFilename = NULL);
+
+/////////////////////////////////////////////////////////////////////////////
+// Read a line file in either format as packed lines.
+/////////////////////////////////////////////////////////////////////////////
+bool loadLineFile(const char* filename, vector<float>* lines);
+void packLines(const LineSet& lineSet, vector<float>* lines);
+
+/////////////////////////////////////////////////////////////////////////////
+// Line file of an image: the .mlb file if there is one, else the .mld.
+/////////////////////////////////////////////////////////////////////////////
+string getLineFilename(const string& imageFilename);
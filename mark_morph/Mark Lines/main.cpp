@@ -6,10 +6,66 @@
 // Author: Daniel Seah
 /////////////////////////////////////////////////////////////////////////////
 
+#include <string.h>
 #include "ImageMorph.h"
+#include "BatchMorph.h"
+#include "DatasetPack.h"
+#include "MorphService.h"
+#include "TiledMorph.h"
+#include "line_io.h"
 
 int main(int argc, char *argv[])
 {
+	// Batch mode renders without opening any windows
+	if(argc > 1 && strcmp(argv[1], "-batch") == 0)
+	{
+		CBatchMorph batch;
+		if(!batch.parseArgs(argc, argv))
+			return 1;
+		return batch.run() ? 0 : 1;
+	}
+
+	// Service mode serves morph jobs over a local pipe until shut down
+	if(argc > 1 && strcmp(argv[1], "-service") == 0)
+	{
+		CMorphService service;
+		if(!service.parseArgs(argc, argv))
+			return 1;
+		return service.run() ? 0 : 1;
+	}
+
+	// Out-of-core mode renders one frame of images too large for memory
+	if(argc > 1 && strcmp(argv[1], "-tiled") == 0)
+	{
+		CTiledMorph tiled;
+		if(!tiled.parseArgs(argc, argv))
+			return 1;
+		return tiled.run() ? 0 : 1;
+	}
+
+	// Convert line files between the .mld and .mlb formats
+	if(argc > 1 && strcmp(argv[1], "-convert") == 0)
+	{
+		if(argc < 4)
+		{
+			fprintf(stderr, "Usage: -convert <in.mld|in.mlb> <out.mld|out.mlb> [image]\n");
+			return 1;
+		}
+		return convertLineFile(argv[2], argv[3], argc > 4 ? argv[4] : NULL) ? 0 : 1;
+	}
+
+	// Build a dataset pack for batch mode
+	if(argc > 1 && strcmp(argv[1], "-pack") == 0)
+	{
+		if(argc < 4 || (argc > 4 && (argc != 6 || strcmp(argv[4], "-levels") != 0)))
+		{
+			fprintf(stderr, "Usage: -pack <manifest> <out.pack> [-levels n]\n");
+			return 1;
+		}
+		int levelCount = argc > 4 ? atoi(argv[5]) : 1;
+		return CDatasetPack::build(argv[2], argv[3], levelCount) ? 0 : 1;
+	}
+
 	CImageMorph app;
 	app.run();
 	return 0;
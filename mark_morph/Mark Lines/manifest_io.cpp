@@ -0,0 +1,58 @@
+/////////////////////////////////////////////////////////////////////////////
+// File: manifest_io.cpp
+//
+// Manifest routines
+// A manifest lists the images of a dataset, one "image [lines]" entry per
+// row. Relative paths are relative to the manifest itself, and the line
+// file defaults to the image's .mlb or .mld file. Rows starting with # are
+// ignored.
+//
+// Author: Leon Ho
+/////////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include "manifest_io.h"
+#include "line_io.h"
+
+static string resolvePath(const string& baseDir, const string& path)
+{
+	if(path.empty() || path[0] == '/' || path[0] == '\\' || (path.size() > 1 && path[1] == ':'))
+		return path;
+	return baseDir + path;
+}
+
+bool readManifest( const char* filename, vector<ManifestEntry>* entries )
+{
+	FILE* manifest = fopen(filename, "r");
+	if(manifest == NULL)
+		return false;
+
+	string manifestFile = filename;
+	string baseDir = manifestFile.substr(0, manifestFile.find_last_of("/\\") + 1);
+	char buffer[1024], imageFile[512], lineFile[512];
+	while(fgets(buffer, sizeof(buffer), manifest) != NULL)
+	{
+		int count = sscanf(buffer, "%511s %511s", imageFile, lineFile);
+		if(count < 1 || imageFile[0] == '#')
+			continue;
+
+		ManifestEntry entry;
+		entry.imageFile = resolvePath(baseDir, imageFile);
+		if(count > 1)
+			entry.lineFile = resolvePath(baseDir, lineFile);
+		else
+			entry.lineFile = getLineFilename(entry.imageFile);
+
+		entry.name = entry.imageFile.substr(entry.imageFile.find_last_of("/\\") + 1);
+		entry.name = entry.name.substr(0, entry.name.find_last_of("."));
+		entry.subject = getSubject(entry.name);
+		entries->push_back(entry);
+	}
+	fclose(manifest);
+	return true;
+}
+
+string getSubject( const string& name )
+{
+	return name.substr(0, name.find("-"));
+}
@@ -0,0 +1,35 @@
+/////////////////////////////////////////////////////////////////////////////
+// File: manifest_io.h
+//
+// Manifest routines
+// A manifest lists the images of a dataset, one "image [lines]" entry per
+// row. Relative paths are relative to the manifest itself, and the line
+// file defaults to the image's .mlb or .mld file. Rows starting with # are
+// ignored.
+//
+// Author: Leon Ho
+/////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+using namespace std;
+
+struct ManifestEntry
+{
+	string imageFile, lineFile;
+	string name;				// Image file name without directory or extension
+	string subject;				// Name prefix before the first '-', e.g. 01-2m
+};
+
+/////////////////////////////////////////////////////////////////////////////
+// Read a manifest. Returns false if the file cannot be opened.
+/////////////////////////////////////////////////////////////////////////////
+bool readManifest(const char* filename, vector<ManifestEntry>* entries);
+
+/////////////////////////////////////////////////////////////////////////////
+// Subject of an entry name.
+/////////////////////////////////////////////////////////////////////////////
+string getSubject(const string& name);
@@ -1,7 +1,10 @@
 #extension GL_ARB_texture_rectangle : require
+#extension GL_ARB_shader_texture_lod : require
 
-uniform sampler2DRect TexA;		// Input texture A
-uniform sampler2DRect TexB;		// Input texture B
+uniform sampler2D PagesA;		// Resident pages of input A's pyramid
+uniform sampler2D PagesB;		// Resident pages of input B's pyramid
+uniform sampler2DRect PageTableA;	// Where each page of A is in PagesA
+uniform sampler2DRect PageTableB;	// Where each page of B is in PagesB
 
 uniform sampler2DRect ALines;	// Input texture A
 uniform sampler2DRect BLines;	// Input texture B
@@ -11,10 +14,13 @@ uniform float LineCount;
 uniform float TexWidth;
 uniform float TexHeight;
 uniform float BlendType;
+uniform float PixelScale;		// Image pixels per output pixel, above 1 for previews
+uniform vec2 TileOrigin;		// Image position of the output tile's first pixel
+uniform float LevelCount;		// Pyramid levels of each input
 
-const float a = 0.5;			// smoothness of warping
-const float b = 3.25;			// relative line strength
-const float p = 0.25;
+uniform float WarpA;			// smoothness of warping
+uniform float WarpB;			// relative line strength
+uniform float WarpP;			// influence of line length
 
 const float Epsilon = 0.0000001;
 
@@ -81,12 +87,100 @@ float calcV(vec2 X, vec2 P, vec2 Q)
 	return dot(PX, PQperp) / length(PQ);
 }
 
+//------------------------------------------------------------------------------
+// Function name: calcLod
+// Parameters:
+//		-Xprime: the source position of the current pixel
+// Return:
+//		The mipmap level to sample the source at
+// Description:
+//		Estimates the Jacobian of the warp from the differences of the
+//		source position between neighbouring pixels. Where the warp
+//		compresses the source, the longer column of the Jacobian spans
+//		several source pixels, and a coarser level is sampled instead of
+//		aliasing. The CPU kernel selects its levels the same way.
+//------------------------------------------------------------------------------
+float calcLod(vec2 Xprime)
+{
+	vec2 dx = dFdx(Xprime);
+	vec2 dy = dFdy(Xprime);
+	float rhoSq = max(dot(dx, dx), dot(dy, dy));
+	return rhoSq > 1.0 ? 0.5 * log2(rhoSq) : 0.0;
+}
+
+//------------------------------------------------------------------------------
+// Function name: samplePage
+// Parameters:
+//		-pages: the atlas of resident pages
+//		-pageTable: the page table of the atlas
+//		-Xprime: the source position, in image pixels
+//		-level: the pyramid level to sample
+// Return:
+//		The bilinear sample, with alpha 0 if its page is not resident
+// Description:
+//		Finds the page of the level holding the source position in the
+//		page table, and samples the page in the atlas. Pages have a one
+//		pixel border, so filtering does not read neighbouring pages.
+//------------------------------------------------------------------------------
+vec4 samplePage(sampler2D pages, sampler2DRect pageTable, vec2 Xprime, float level)
+{
+	vec4 info = texture2DRect(pageTable, vec2(level + 0.5, 0.5));
+	vec2 pos = Xprime * info.xy;
+	vec2 page = floor(pos / info.w);
+	vec4 entry = texture2DRect(pageTable, vec2(page.x + 0.5, info.z + page.y + 0.5));
+	vec2 texel = entry.xy + pos - page * info.w;
+	return vec4(texture2DLod(pages, texel * entry.w, 0.0).rgb, entry.z);
+}
+
+//------------------------------------------------------------------------------
+// Function name: sampleLevel
+// Parameters:
+//		-pages: the atlas of resident pages
+//		-pageTable: the page table of the atlas
+//		-Xprime: the source position, in image pixels
+//		-level: the pyramid level to sample
+// Return:
+//		The sample at the level, or at the next coarser level resident
+// Description:
+//		Levels that fit in one page are always resident, so the search
+//		ends at the coarsest level at the latest.
+//------------------------------------------------------------------------------
+vec4 sampleLevel(sampler2D pages, sampler2DRect pageTable, vec2 Xprime, float level)
+{
+	vec4 pixel = samplePage(pages, pageTable, Xprime, level);
+	for(float coarser=level+1.0; pixel.a < 0.5 && coarser<LevelCount; coarser++)
+		pixel = samplePage(pages, pageTable, Xprime, coarser);
+	return pixel;
+}
+
+//------------------------------------------------------------------------------
+// Function name: sampleSource
+// Parameters:
+//		-pages: the atlas of resident pages
+//		-pageTable: the page table of the atlas
+//		-Xprime: the source position, in image pixels
+//		-lod: the level of detail from calcLod
+// Return:
+//		The trilinear sample of the source
+// Description:
+//		Blends the two levels either side of lod, as mipmapping does
+//------------------------------------------------------------------------------
+vec4 sampleSource(sampler2D pages, sampler2DRect pageTable, vec2 Xprime, float lod)
+{
+	float level = min(floor(lod), LevelCount - 1.0);
+	float weight = level < LevelCount - 1.0 ? lod - level : 0.0;
+	vec4 pixel = sampleLevel(pages, pageTable, Xprime, level);
+	if(weight > 0.0)
+		pixel = mix(pixel, sampleLevel(pages, pageTable, Xprime, level + 1.0), weight);
+	return pixel;
+}
+
 void main()
 {
 	float weightsum = 0.0;
 	vec2 dsumA, dsumB;
 	dsumA = dsumB = vec2(0);
-	vec2 X = gl_FragCoord.xy; 
+	vec2 X = gl_FragCoord.xy * PixelScale + TileOrigin;
 
 	for(float i=0.5; i<LineCount; i++)
 	{
@@ -115,8 +209,8 @@ void main()
 		else
 			dist = abs(uv.y);
 		float len = distance(P, Q);
-		float weight = pow(len, p) / (a + dist);
-		weight = pow(weight, b);
+		float weight = pow(len, WarpP) / (WarpA + dist);
+		weight = pow(weight, WarpB);
 
 		dsumA += displacementA * weight;
 		dsumB += displacementB * weight;
@@ -127,16 +221,14 @@ void main()
 	vec2 XprimeA = X + dsumA / weightsum;
 	vec2 XprimeB = X + dsumB / weightsum;
 
-	vec4 startPixel, endPixel;
-	if(XprimeA.x >= 0.0 && XprimeA.x < TexWidth && XprimeA.y >= 0.0 && XprimeA.y < TexHeight)
-		startPixel = texture2DRect(TexA, XprimeA);
-	else
-		startPixel = texture2DRect(TexA, gl_FragCoord.xy);
+	if(XprimeA.x < 0.0 || XprimeA.x >= TexWidth || XprimeA.y < 0.0 || XprimeA.y >= TexHeight)
+		XprimeA = X;
+	if(XprimeB.x < 0.0 || XprimeB.x >= TexWidth || XprimeB.y < 0.0 || XprimeB.y >= TexHeight)
+		XprimeB = X;
 
-	if(XprimeB.x >= 0.0 && XprimeB.x < TexWidth && XprimeB.y >= 0.0 && XprimeB.y < TexHeight)
-		endPixel = texture2DRect(TexB, XprimeB);
-	else
-		endPixel = texture2DRect(TexB, gl_FragCoord.xy);
+	// Derivatives are taken outside any branch, so every pixel has them
+	vec4 startPixel = sampleSource(PagesA, PageTableA, XprimeA, calcLod(XprimeA));
+	vec4 endPixel = sampleSource(PagesB, PageTableB, XprimeB, calcLod(XprimeB));
 
 	if(abs(BlendType) < Epsilon)
 		gl_FragColor = mix(startPixel, endPixel, Step);